@@ -33,6 +33,8 @@
 //
 
 #include <vector>
+#include <bitset>
+#include <cstddef>
 #include <algorithm>
 #include <assert.h>
 #include <sstream>
@@ -41,6 +43,10 @@
 #include <string>
 #include <codecvt>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
 
 // This gets around an issue with the windows header files defining max
 const long long StreamMax = std::numeric_limits<std::streamsize>::max();
@@ -63,6 +69,8 @@ const long long StreamMax = std::numeric_limits<std::streamsize>::max();
 #include "capsapi/CapsLibAll.h"
 
 #include "ibm_sectors.h"
+#include "mfm_kernels.h"
+#include "scp_file.h"
 
 #include <math.h>
 
@@ -109,17 +117,106 @@ typedef struct alignas(8)  {
 	uint32_t dataChecksumCalculated;     // The data checksum we calculate
 
 	RawDecodedSector data;          // decoded sector data
-
-	RawMFMData rawSector;   // raw track data, for analysis of invalid sectors
 } DecodedSector;
 
-// To hold a list of valid and checksum failed sectors
+// Bit-sliced vote counter for the raw MFM of a sector.  Every bit of the sector has a small counter, stored "vertically" so that
+// plane[n] holds bit n of 64 counters.  Adding a whole copy of the sector is then a few logical operations per 64 bits
+class SectorVotes {
+private:
+	static const unsigned int Planes = 4;                       // So each counter goes up to 15
+	static const unsigned int Words = RAW_SECTOR_SIZE / 8;
+	static_assert((RAW_SECTOR_SIZE % 8) == 0, "RAW_SECTOR_SIZE must be a multiple of 8");
+
+	std::vector<uint64_t> m_planes;   // Planes*Words.  Allocated the first time it's needed and then kept
+	unsigned int m_count = 0;         // How many copies are counted
+
+public:
+	unsigned int count() const { return m_count; }
+	void clear() { m_count = 0; }
+
+	// Add a copy of the sector, read straight from the track
+	void add(const MFM::BitReader& rawSector);
+
+	// Builds the sector where each bit is whatever occurred most.  Ties count as a '1'
+	void majority(RawEncodedSector& output) const;
+};
+
+void SectorVotes::add(const MFM::BitReader& rawSector) {
+	if (m_planes.empty()) m_planes.resize(Planes * Words);
+	uint64_t* planes = m_planes.data();
+
+	if (m_count == 0) {
+		std::fill(m_planes.begin(), m_planes.end(), 0);
+	} 
+	else
+		if (m_count >= (1U << Planes) - 1) {
+			// Counters are full.  Halve them all (drop the lowest plane) so the memory stays fixed but newer copies still count
+			memmove(planes, planes + Words, (Planes - 1) * Words * sizeof(uint64_t));
+			memset(planes + ((Planes - 1) * Words), 0, Words * sizeof(uint64_t));
+			m_count >>= 1;
+		}
+
+	// Ripple the new bits into the counters 64 at a time
+	for (unsigned int word = 0; word < Words; word++) {
+		uint64_t carry = (((uint64_t)rawSector.readBits(word * 8)) << 32) | rawSector.readBits((word * 8) + 4);
+		for (unsigned int plane = 0; (plane < Planes) && carry; plane++) {
+			uint64_t& counter = planes[(plane * Words) + word];
+			const uint64_t nextCarry = counter & carry;
+			counter ^= carry;
+			carry = nextCarry;
+		}
+	}
+	m_count++;
+}
+
+void SectorVotes::majority(RawEncodedSector& output) const {
+	// A bit is set if ones >= zeros, ie: counter >= (count+1)/2.  This compares 64 counters at once, from the top plane down
+	const unsigned int threshold = (m_count + 1) / 2;
+	const uint64_t* planes = m_planes.data();
+
+	for (unsigned int word = 0; word < Words; word++) {
+		uint64_t greater = 0;
+		uint64_t equal = ~0ULL;
+		for (int plane = Planes - 1; plane >= 0; plane--) {
+			const uint64_t bits = planes[(plane * Words) + word];
+			if (threshold & (1 << plane)) 
+				equal &= bits;
+			else {
+				greater |= equal & bits;
+				equal &= ~bits;
+			}
+		}
+		const uint64_t result = greater | equal;
+		for (unsigned int byte = 0; byte < 8; byte++)
+			output[(word * 8) + byte] = (unsigned char)(result >> (56 - (byte * 8)));
+	}
+}
+
+// To hold the valid and checksum failed sectors.  Each sector number has its own slot and sectors are decoded straight into them, so
+// finding one is just an index and they come out already in order
 struct DecodedTrack {
-	// A list of valid sectors where the checksums are OK
-	std::vector<DecodedSector> validSectors;
-	// A list of sectors found with invalid checksums.  These are used if ignore errors is triggered
-	// We keep copies of each one so we can perform a statistical analysis to see if we can get a working one based on which bits are mostly set the same
-	std::vector<DecodedSector> invalidSectors[NUM_SECTORS_PER_TRACK_HD];
+	// Sectors where the checksums are OK.  Only the slots marked in validFound are in use
+	DecodedSector validSectors[NUM_SECTORS_PER_TRACK_HD];
+	std::bitset<NUM_SECTORS_PER_TRACK_HD> validFound;
+	// The first copy of each sector found with an invalid checksum.  These are used if ignore errors is triggered
+	DecodedSector invalidSectors[NUM_SECTORS_PER_TRACK_HD];
+	std::bitset<NUM_SECTORS_PER_TRACK_HD> invalidFound;
+	// Every invalid copy seen is counted here so we can perform a statistical analysis to see if we can get a working one based on which bits are mostly set the same
+	SectorVotes sectorVotes[NUM_SECTORS_PER_TRACK_HD];
+
+	DecodedTrack() {}
+	// This is quite big, so make sure it's never copied by accident
+	DecodedTrack(const DecodedTrack&) = delete;
+	DecodedTrack& operator=(const DecodedTrack&) = delete;
+
+	unsigned int numValid() const { return (unsigned int)validFound.count(); }
+	unsigned int numInvalid() const { return (unsigned int)invalidFound.count(); }
+
+	// Forget all of the sectors
+	void clear() { validFound.reset(); invalidFound.reset(); }
+
+	// Marks validSectors[sectorNumber] as good, which replaces any invalid copy
+	void setValid(const unsigned int sectorNumber) { validFound.set(sectorNumber); invalidFound.reset(sectorNumber); }
 };
 
 
@@ -127,24 +224,9 @@ struct DecodedTrack {
 // *input;	MFM coded data buffer (size == 2*data_size) 
 // *output;	decoded data buffer (size == data_size) 
 // Returns the checksum calculated over the data
+// The odd and even longs are located 'data_size' bytes apart.  The split, mask, interleave and checksum are done in one pass by mfm_kernels
 uint32_t decodeMFMdata(const uint32_t* input, uint32_t* output, const unsigned int data_size) {
-	uint32_t odd_bits, even_bits;
-	uint32_t chksum = 0L;
-	unsigned int count;
-
-	// the decoding is made here long by long : with data_size/4 iterations 
-	for (count = 0; count < data_size / 4; count++) {
-		odd_bits = *input;					// longs with odd bits 
-		even_bits = *(uint32_t*)(((unsigned char*)input) + data_size);   // longs with even bits - located 'data_size' bytes after the odd bits
-
-		chksum ^= odd_bits;              // XOR Checksum
-		chksum ^= even_bits;
-
-		*output = ((even_bits & MFM_MASK) | ((odd_bits & MFM_MASK) << 1));
-		input++;      /* next 'odd' long and 'even bits' long  */
-		output++;     /* next location of the future decoded long */
-	}
-	return chksum & MFM_MASK;
+	return MFM::decodeOddEven(input, output, data_size);
 }
 
 // MFM encoding algorithm part 1 - this just writes the actual data bits in the right places
@@ -152,174 +234,80 @@ uint32_t decodeMFMdata(const uint32_t* input, uint32_t* output, const unsigned i
 // *output;	MFM encoded buffer (size == data_size*2) 
 // Returns the checksum calculated over the data
 uint32_t encodeMFMdataPart1(const uint32_t* input, uint32_t* output, const unsigned int data_size) {
-	uint32_t chksum = 0L;
-	unsigned int count;
-
-	uint32_t* outputOdd = output;
-	uint32_t* outputEven = (uint32_t*)(((unsigned char*)output) + data_size);
-
-	// Encode over two passes.  First split out the odd and even data, then encode the MFM values, the /4 is because we're working in longs, not bytes
-	for (count = 0; count < data_size / 4; count++) {
-		*outputEven = *input & MFM_MASK;
-		*outputOdd = ((*input)>>1) & MFM_MASK;
-		outputEven++;
-		outputOdd++;
-		input++;
-	}
-	
-	// Checksum calculator
-	// Encode over two passes.  First split out the odd and even data, then encode the MFM values, the /4 is because we're working in longs, not bytes
-	for (count = 0; count < (data_size / 4) * 2; count++) {
-		chksum ^= *output;
-		output++;
-	}
-
-	return chksum & MFM_MASK;
+	return MFM::encodeOddEven(input, output, data_size);
 }
 
-// Copys the data from inTrack into outTrack but fixes the bit/byte alignment so its aligned on the start of a byte 
-void alignSectorToByte(const unsigned char* inTrack, const int dataLength, int byteStart, int bitStart, RawEncodedSector& outSector) {
-	unsigned char byteOut = 0;
-	unsigned int byteOutPosition = 0;
-
-	// Bit counter output
-	unsigned int counter = 0;
-
-	// The position supplied is the last bit of the track sync.  
-	bitStart--;   // goto the next bit
-	if (bitStart < 0) {
-		// Could do a MEMCPY here, but for now just let the code below run
-		bitStart = 7;
-		byteStart++;
-	}
-	byteStart -= 8;   // wind back 8 bytes
-
-	// This is mis-aligned.  So we need to shift the data into byte boundarys
-	for (;;) {
-		for (int bitCounter = bitStart; bitCounter >= 0; bitCounter--) {
-			byteOut <<= 1;
-			if (inTrack[byteStart % dataLength] & (1 << bitCounter)) byteOut |= 1;
-
-			if (++counter >= 8) {
-				outSector[byteOutPosition] = byteOut;
-				byteOutPosition++;
-				if (byteOutPosition >= RAW_SECTOR_SIZE) return;
-				counter = 0;
-			}
-		}
-
-		// Move along and reset
-		byteStart++;
-		bitStart = 7;
-	}
-}
-
-// Attempt to repair the MFM data.  Returns TRUE if errors are detected
-bool repairMFMData(unsigned char* data, const unsigned int dataLength) {
-	bool errors = false;
-	// Only certain bit-patterns are allowed.  So if we come across an invalid one we will try to repair it.  
-	// You cannot have two '1's together, and a max of three '0' in a row
-	// Allowed combinations:  (note the SYNC WORDS and TRACK START are designed to break these rules, but we shouldn't encounter them)
-	// 
-	//	00010
-	//	00100
-	//	00101
-	//	01000
-	//	01001
-	//	01010
-	//	10001
-	//	10010
-	//	10100
-	//	10101
-	//
-	unsigned char testByte = 0;
-	int counter = 0;
-	for (unsigned int position = 0; position < dataLength; position++) {
-		// Fixed: This was the wrong way around
-		for (int bitIndex = 7; bitIndex >= 0; bitIndex--) {
-			testByte <<= 1;   // shift off one bit to make room for the new bit
-			if (*data & (1 << bitIndex)) {
-				// Make sure two '1's dont come in together as this is not allowed! This filters out a lot of BAD combinations
-				if ((testByte & 0x2) != 0x2) {
-					testByte |= 1;
-				} 
-				else {
-					// We detected two '1's in a row, which isnt allowed.  From reading this most likely means this was a weak bit, so we change it to zero.
-					errors = true;
-				}
-			} 
-
-			// We're only interested in the last so many bits, and only when we have received that many
-			if (++counter > 4) {
-				switch (testByte & 0x1F) {
-					// These are the only possible invalid combinations left
-				case 0x00:
-				case 0x01:
-				case 0x10:
-					// No idea how to repair these	
-					errors = true;
-					break;
-				}
-			}
-		}
-		data++;
-	}
-
-	return errors;
-	 
+// Only certain bit-patterns are allowed: you cannot have two '1's together, and a max of three '0' in a row.  Where a sector breaks those rules
+// one of the data bits at or just before the break is most likely a weak bit.  Each of those is flipped in turn, and kept if the data checksum then passes and the rules hold.
+// Returns TRUE if it did.  outputSector.dataChecksum must already be set.  If the rules are broken in too many places it's more than a weak bit or two, so it isn't tried
+#define MAX_MFM_VIOLATIONS_TO_FIX 8
+bool fixWeakBits(RawEncodedSector& rawSector, DecodedSector& outputSector) {
+	unsigned char* data = rawSector + 64;
+	const unsigned int dataBits = SECTOR_BYTES * 2 * 8;
+	std::vector<uint32_t> violations;
+	const unsigned int numViolations = MFM::checkMFM(data, SECTOR_BYTES * 2, &violations);
+	if ((numViolations == 0) || (numViolations > MAX_MFM_VIOLATIONS_TO_FIX)) return false;
+
+	for (const uint32_t violation : violations) {
+		// Two '1's together means one of the pair shouldn't be there.  Too many '0's means a '1' went missing somewhere in the last four
+		const bool extraOne = (data[violation >> 3] & (0x80 >> (violation & 7))) != 0;
+		const uint32_t first = extraOne ? ((violation >= 1) ? violation - 1 : 0) : ((violation >= 3) ? violation - 3 : 0);
+
+		for (uint32_t position = first; (position <= violation) && (position < dataBits); position++) {
+			// The clock bits aren't part of the data or the checksum, only the odd positions are data bits
+			if (!(position & 1)) continue;
+			const unsigned char mask = 0x80 >> (position & 7);
+			if (((data[position >> 3] & mask) != 0) != extraOne) continue;
+
+			data[position >> 3] ^= mask;
+			outputSector.dataChecksumCalculated = decodeMFMdata((uint32_t*)data, (uint32_t*)&outputSector.data[0], SECTOR_BYTES);
+			// The checksum is only an XOR, so a different bit in the same column would pass too.  The real one also leaves the MFM with no breaks at all
+			if ((outputSector.dataChecksum == outputSector.dataChecksumCalculated) && (MFM::checkMFM(data, SECTOR_BYTES * 2) == 0)) return true;
+			data[position >> 3] ^= mask;
+		}
+	}
+
+	// Put it back to how it was
+	outputSector.dataChecksumCalculated = decodeMFMdata((uint32_t*)data, (uint32_t*)&outputSector.data[0], SECTOR_BYTES);
+	return false;
 }
 
-// Looks at the history for this sector number and creates a new sector where the bits are set to whatever occurs more.  We then do a checksum and if it succeeds we use it
+// Looks at the history for this sector number and creates a new sector where the bits are set to whatever occurs more.  If that doesn't pass
+// the data checksum, the bits around any breaks in the MFM encoding rules are tried too.  Returns TRUE if the data checksum passes
+// outputSector receives the first invalid copy with the data replaced by the majority vote
 bool attemptFixSector(const DecodedTrack& decodedTrack, DecodedSector& outputSector) {
-	int sectorNumber = outputSector.sectorNumber;
-
-	if (decodedTrack.invalidSectors[sectorNumber].size() < 2) return false;
-
-	typedef struct {
-		int zeros = 0;
-		int ones = 0;
-	} SectorCounter[8];
+	const int sectorNumber = outputSector.sectorNumber;
 
-	SectorCounter* sectorSum = new SectorCounter[SECTOR_BYTES + SECTOR_BYTES];
-	if (!sectorSum) return false;
-
-	memset(sectorSum, 0, sizeof(sectorSum));
-
-	// Calculate the number of '1's and '0's in each block
-	for (const DecodedSector& sec : decodedTrack.invalidSectors[sectorNumber]) 
-		for (int byteNumber = 0; byteNumber < SECTOR_BYTES + SECTOR_BYTES; byteNumber++) 
-			for (int bit = 0; bit <= 7; bit++) 
-				if (sec.rawSector[byteNumber] & (1 << bit))
-					sectorSum[byteNumber][bit].ones++; else sectorSum[byteNumber][bit].zeros++;
+	if (!decodedTrack.invalidFound[sectorNumber]) return false;
+	const SectorVotes& votes = decodedTrack.sectorVotes[sectorNumber];
+	if (votes.count() < 1) return false;
 
 	// Now create a sector based on this data
-	memset(outputSector.rawSector, 0, sizeof(outputSector.rawSector));
-	for (int byteNumber = 0; byteNumber < SECTOR_BYTES + SECTOR_BYTES; byteNumber++)
-		for (int bit = 0; bit <= 7; bit++)
-			if (sectorSum[byteNumber][bit].ones >= sectorSum[byteNumber][bit].zeros)
-				outputSector.rawSector[byteNumber] |= (1 << bit);
+	RawEncodedSector rawSector;
+	votes.majority(rawSector);
 
-	delete[] sectorSum;
+	outputSector = decodedTrack.invalidSectors[sectorNumber];
+	decodeMFMdata((uint32_t*)(rawSector + 56), &outputSector.dataChecksum, 4);
+	outputSector.dataChecksumCalculated = decodeMFMdata((uint32_t*)(rawSector + 64), (uint32_t*)&outputSector.data[0], SECTOR_BYTES);
+	if (outputSector.dataChecksum == outputSector.dataChecksumCalculated) return true;
 
-	return true;
+	return fixWeakBits(rawSector, outputSector);
 }
 
 // Extract and convert the sector.  This may be a duplicate so we may reject it.  Returns TRUE if it was valid, or false if not
-bool decodeSector(const RawEncodedSector& rawSector, const unsigned int trackNumber, bool isHD, const DiskSurface surface, DecodedTrack& decodedTrack, bool ignoreHeaderChecksum, int& lastSectorNumber) {
+// The sector is read straight out of the track data (rawSector starts 8 bytes before the end of the SYNC), it is never copied
+bool decodeSector(const MFM::BitReader& rawSector, const unsigned int trackNumber, bool isHD, const DiskSurface surface, DecodedTrack& decodedTrack, bool ignoreHeaderChecksum, int& lastSectorNumber) {
+	// Only the header is decoded here, the data goes straight into the sector's slot once we know which one it is
 	DecodedSector sector;
 
 	lastSectorNumber = -1;
-	memcpy(sector.rawSector, rawSector, sizeof(RawMFMData));
 
-	// Easier to operate on
-	unsigned char* sectorData = (unsigned char*)rawSector;
- 
 	// Read the first 4 bytes (8).  This  is the track header data	
-	sector.headerChecksumCalculated = decodeMFMdata((uint32_t*)(sectorData + 8), (uint32_t*)&sector, 4);
+	sector.headerChecksumCalculated = MFM::decodeOddEven(rawSector, 8, (uint32_t*)&sector, 4);
 	// Decode the label data and update the checksum
-	sector.headerChecksumCalculated ^= decodeMFMdata((uint32_t*)(sectorData + 16), (uint32_t*)&sector.sectorLabel[0], 16);
+	sector.headerChecksumCalculated ^= MFM::decodeOddEven(rawSector, 16, (uint32_t*)&sector.sectorLabel[0], 16);
 	// Get the checksum for the header
-	decodeMFMdata((uint32_t*)(sectorData + 48), (uint32_t*)&sector.headerChecksum, 4);  // (computed on mfm longs, longs between offsets 8 and 44 == 2 * (1 + 4) longs)
+	MFM::decodeOddEven(rawSector, 48, (uint32_t*)&sector.headerChecksum, 4);  // (computed on mfm longs, longs between offsets 8 and 44 == 2 * (1 + 4) longs)
 	// If the header checksum fails we just cant trust anything we received, so we just drop it
 	if ((sector.headerChecksum != sector.headerChecksumCalculated) && (!ignoreHeaderChecksum)) {
 		return false;
@@ -343,37 +331,36 @@ bool decodeSector(const RawEncodedSector& rawSector, const unsigned int trackNum
 	if (sector.trackNumber != targetTrackNumber) return false; // this'd be weird
 
 	// Get the checksum for the data
-	decodeMFMdata((uint32_t*)(sectorData + 56), (uint32_t*)&sector.dataChecksum, 4);
+	MFM::decodeOddEven(rawSector, 56, (uint32_t*)&sector.dataChecksum, 4);
 	
 
-	// Lets see if we already have this one
-	const int searchSector = sector.sectorNumber;
-	auto index = std::find_if(decodedTrack.validSectors.begin(), decodedTrack.validSectors.end(), [searchSector](const DecodedSector& sector) -> bool {
-		return (sector.sectorNumber == searchSector);
-	});
-
 	// We already have it as a GOOD VALID sector, so skip, we don't need it.
-	if (index != decodedTrack.validSectors.end()) return true;
+	const int sectorNumber = sector.sectorNumber;
+	if (decodedTrack.validFound[sectorNumber]) return true;
+
+	// Decode straight into its slot.  The slot only counts as used once the checksum is OK
+	DecodedSector& slot = decodedTrack.validSectors[sectorNumber];
+	memcpy(&slot, &sector, offsetof(DecodedSector, data));
 
 	// Decode the data and receive it's checksum
-	sector.dataChecksumCalculated = decodeMFMdata((uint32_t*)(sectorData + 64), (uint32_t*)&sector.data[0], SECTOR_BYTES); // (from 64 to 1088 == 2*512 bytes)
+	slot.dataChecksumCalculated = MFM::decodeOddEven(rawSector, 64, (uint32_t*)&slot.data[0], SECTOR_BYTES); // (from 64 to 1088 == 2*512 bytes)
 
-	lastSectorNumber = sector.sectorNumber;
+	lastSectorNumber = sectorNumber;
 
 	// Is the data valid?
-	if (sector.dataChecksum != sector.dataChecksumCalculated) {
-		// Keep a copy
-		decodedTrack.invalidSectors[sector.sectorNumber].push_back(sector);
+	if (slot.dataChecksum != slot.dataChecksumCalculated) {
+		// Keep the first copy, and add the raw MFM to the votes so attemptFixSector can use it
+		if (!decodedTrack.invalidFound[sectorNumber]) {
+			decodedTrack.invalidSectors[sectorNumber] = slot;
+			decodedTrack.invalidFound.set(sectorNumber);
+			decodedTrack.sectorVotes[sectorNumber].clear();
+		}
+		decodedTrack.sectorVotes[sectorNumber].add(rawSector);
 		return false;
 	}
 	else {
-		// Its a good sector, and we dont have it yet
-		decodedTrack.validSectors.push_back(sector);
-
-		// Lets delete it from invalid sectors list
-		decodedTrack.invalidSectors[sector.sectorNumber].clear();
-
-
+		// Its a good sector, and we dont have it yet.  This also deletes it from the invalid sectors
+		decodedTrack.setValid(sectorNumber);
 		return true;
 	}
 }
@@ -391,127 +378,165 @@ void encodeSector(const unsigned int trackNumber, const DiskSurface surface, boo
 	encodedSector[6] = 0x44;
 	encodedSector[7] = 0x89;
 
-	// MFM Encoded header
-	DecodedSector header;
-	memset(&header, 0, sizeof(header));
+	// MFM Encoded header.  This is the first long of DecodedSector followed by the sector label (which isnt used)
+	uint32_t header[5] = { 0 };
+	unsigned char* headerBytes = (unsigned char*)header;
+	headerBytes[0] = 0xFF;
+	headerBytes[1] = (trackNumber << 1) | ((surface == DiskSurface::dsUpper) ? 1 : 0);
+	headerBytes[2] = sectorNumber;
+	headerBytes[3] = (isHD ? NUM_SECTORS_PER_TRACK_HD : NUM_SECTORS_PER_TRACK_DD) - sectorNumber;  //1..11
 
-	header.trackFormat = 0xFF;
-	header.trackNumber = (trackNumber << 1) | ((surface == DiskSurface::dsUpper) ? 1 : 0);
-	header.sectorNumber = sectorNumber; 
-	header.sectorsRemaining = (isHD ? NUM_SECTORS_PER_TRACK_HD : NUM_SECTORS_PER_TRACK_DD) - sectorNumber;  //1..11
-	
-	
-	header.headerChecksumCalculated = encodeMFMdataPart1((const uint32_t*)&header, (uint32_t*)&encodedSector[8], 4);
+	uint32_t headerChecksum = encodeMFMdataPart1(&header[0], (uint32_t*)&encodedSector[8], 4);
 	// Then theres the 16 bytes of the volume label that isnt used anyway
-	header.headerChecksumCalculated ^= encodeMFMdataPart1((const uint32_t*)&header.sectorLabel, (uint32_t*)&encodedSector[16], 16);
+	headerChecksum ^= encodeMFMdataPart1(&header[1], (uint32_t*)&encodedSector[16], 16);
 	// Thats 40 bytes written as everything doubles (8+4+4+16+16). - Encode the header checksum
-	encodeMFMdataPart1((const uint32_t*)&header.headerChecksumCalculated, (uint32_t*)&encodedSector[48], 4);
+	encodeMFMdataPart1(&headerChecksum, (uint32_t*)&encodedSector[48], 4);
 	// And move on to the data section.  Next should be the checksum, but we cant encode that until we actually know its value!
-	header.dataChecksumCalculated = encodeMFMdataPart1((const uint32_t*)&input, (uint32_t*)&encodedSector[64], SECTOR_BYTES);
+	const uint32_t dataChecksum = encodeMFMdataPart1((const uint32_t*)&input, (uint32_t*)&encodedSector[64], SECTOR_BYTES);
 	// And add the checksum
-	encodeMFMdataPart1( (const uint32_t*)&header.dataChecksumCalculated, (uint32_t*)&encodedSector[56], 4);
+	encodeMFMdataPart1(&dataChecksum, (uint32_t*)&encodedSector[56], 4);
 
 	// Now fill in the MFM clock bits
-	bool lastBit = encodedSector[7] & (1 << 0);
-	bool thisBit = lastBit;
-
-	// Clock bits are bits 7, 5, 3 and 1
-	// Data is 6, 4, 2, 0
-	for (int count = 8; count < RAW_SECTOR_SIZE; count++) {
-		for (int bit = 7; bit >= 1; bit -= 2) {
-			lastBit = thisBit;			
-			thisBit = encodedSector[count] & (1 << (bit-1));
-	
-			if (!(lastBit || thisBit)) {
-				// Encode a 1!
-				encodedSector[count] |= (1 << bit);
-			}
-		}
-	}
-
-	lastByte = encodedSector[RAW_SECTOR_SIZE - 1];
+	lastByte = MFM::addClockBits(&encodedSector[8], RAW_SECTOR_SIZE - 8, encodedSector[7]);
 }
 
-// Find sectors within raw data read from the drive by searching bit-by-bit for the SYNC bytes
-void findSectors(const unsigned char* track, bool isHD, unsigned int trackNumber, DiskSurface side, unsigned short trackSync, DecodedTrack& decodedTrack, bool ignoreHeaderChecksum) {
-	// Work out what we need to search for which is syncsync
-	const uint32_t search = (trackSync | (((uint32_t)trackSync) << 16));
+// Encode a whole track, gap, sync and all, into the format for disk.  Nothing is allocated, so the same output can be used track after track
+template<typename FullDiskTrack, unsigned int numSectors>
+static void encodeTrack(const unsigned int trackNumber, const DiskSurface surface, const RawDecodedSector* input, FullDiskTrack& output) {
+	memset(output.filler1, 0xAA, sizeof(output.filler1));  // Pad with "0"s which as an MFM encoded byte is 0xAA
+	unsigned char lastByte = output.filler1[sizeof(output.filler1) - 1];
 
-	// Prepare our test buffer
-	uint32_t decoded = 0;
+	for (unsigned int sector = 0; sector < numSectors; sector++)
+		encodeSector(trackNumber, surface, numSectors == NUM_SECTORS_PER_TRACK_HD, sector, input[sector], output.sectors[sector], lastByte);
 
-	// Keep runnign until we run out of data
-	unsigned int byteIndex = 0;
+	memset(output.filler2, 0xAA, sizeof(output.filler2));
+	output.filler2[sizeof(output.filler2) - 1] = (lastByte & 1) ? 0x2F : 0xFF;
+}
 
-	int nextTrackBitCount = 0;
+void encodeTrack(const unsigned int trackNumber, const DiskSurface surface, const RawDecodedTrackDD& input, FullDiskTrackDD& output) {
+	encodeTrack<FullDiskTrackDD, NUM_SECTORS_PER_TRACK_DD>(trackNumber, surface, input, output);
+}
 
-	const unsigned int dataLength = isHD ? RAW_TRACKDATA_LENGTH_HD : RAW_TRACKDATA_LENGTH_DD;
+void encodeTrack(const unsigned int trackNumber, const DiskSurface surface, const RawDecodedTrackHD& input, FullDiskTrackHD& output) {
+	encodeTrack<FullDiskTrackHD, NUM_SECTORS_PER_TRACK_HD>(trackNumber, surface, input, output);
+}
+
+// Tries to decode the sector ending in the SYNC at syncPosition (the bit position of its last bit).  Returns TRUE if a good sector was found there, in which case any
+// SYNC before syncPosition + SECTOR_SKIP_BITS is inside it
+static bool decodeSectorAtSync(const unsigned char* track, const unsigned int dataLength, const uint32_t syncPosition, bool isHD, unsigned int trackNumber, DiskSurface side, DecodedTrack& decodedTrack, bool ignoreHeaderChecksum) {
 	const int maxSectors = isHD ? NUM_SECTORS_PER_TRACK_HD : NUM_SECTORS_PER_TRACK_DD;
+	int lastSectorNumber = -1;
 
-	// run the entire track length
-	while (byteIndex < dataLength) {
+	// The sector starts 8 bytes before the end of the SYNC.  This is read directly from the track, whatever the bit alignment
+	const MFM::BitReader rawSector(track, dataLength, (int)syncPosition - 63);
 
-		// Check each bit, the "decoded" variable slowly slides left providing a 32-bit wide "window" into the bitstream
-		for (int bitIndex = 7; bitIndex >= 0; bitIndex--) {
-			decoded <<= 1;   // shift off one bit to make room for the new bit
+	// Now see if there's a valid sector there.  We now only skip the sector if its valid, incase rogue data gets in there
+	if (decodeSector(rawSector, trackNumber, isHD, side, decodedTrack, ignoreHeaderChecksum, lastSectorNumber)) return true;
 
-			if (track[byteIndex] & (1 << bitIndex)) decoded |= 1;
+	// Decode failed.  Lets try a "homemade" one from all the copies we've seen
+	if ((lastSectorNumber >= 0) && (lastSectorNumber < maxSectors)) {
+		DecodedSector& newSector = decodedTrack.validSectors[lastSectorNumber];
+		newSector.sectorNumber = lastSectorNumber;
+		if (attemptFixSector(decodedTrack, newSector)) {
+			decodedTrack.setValid(lastSectorNumber);
+			return true;
+		}
+	}
+	return false;
+}
 
-			// Have we matched the sync words correctly
-			++nextTrackBitCount;
-			int lastSectorNumber = -1;
-			if (decoded == search) {
-				RawEncodedSector alignedSector;
-				
-				// We extract ALL of the track data from this BIT to byte align it properly, then pass it onto the code to read the sector (from the start of the sync code)
-				alignSectorToByte(track, dataLength, byteIndex, bitIndex, alignedSector);
-
-				// Now see if there's a valid sector there.  We now only skip the sector if its valid, incase rogue data gets in there
-				if (decodeSector(alignedSector, trackNumber, isHD, side, decodedTrack, ignoreHeaderChecksum, lastSectorNumber)) {
-					// We know the size of this buffer, so we can skip by exactly this amount
-					byteIndex += RAW_SECTOR_SIZE - 8; // skip this many bytes as we know this is part of the track! minus 8 for the SYNC
-					if (byteIndex >= dataLength) break;
-					// We know that 8 bytes from here should be another track. - we allow 1 bit either way for slippage, but this allows an extra check incase the SYNC pattern is damaged
-					nextTrackBitCount = 0;
-				}
-				else {
+// After a good sector we skip over its data (minus 8 for the SYNC).  Any SYNC found has to be entirely after that point
+#define SECTOR_SKIP_BITS (((RAW_SECTOR_SIZE - 8) * 8) + 32)
 
-					// Decode failed.  Lets try a "homemade" one
-					DecodedSector newTrack;
-					if ((lastSectorNumber >= 0) && (lastSectorNumber < maxSectors)) {
-						newTrack.sectorNumber = lastSectorNumber;
-						if (attemptFixSector(decodedTrack, newTrack)) {
-							memcpy(newTrack.rawSector, alignedSector, sizeof(newTrack.rawSector));
-							// See if our makeshift data will decode or not
-							if (decodeSector(alignedSector, trackNumber, isHD, side, decodedTrack, ignoreHeaderChecksum, lastSectorNumber)) {
-								// We know the size of this buffer, so we can skip by exactly this amount
-								byteIndex += RAW_SECTOR_SIZE - 8; // skip this many bytes as we know this is part of the track! minus 8 for the SYNC
-								if (byteIndex >= dataLength) break;
-							}
-						}
-					}
-					if (decoded == search) nextTrackBitCount = 0;
-				}
-			}
-		}
-		byteIndex++;
+// Find sectors within raw data read from the drive.  The SYNC bytes are located first (see mfm_kernels) and then each one is decoded in turn
+void findSectors(const unsigned char* track, bool isHD, unsigned int trackNumber, DiskSurface side, unsigned short trackSync, DecodedTrack& decodedTrack, bool ignoreHeaderChecksum) {
+	const unsigned int dataLength = isHD ? RAW_TRACKDATA_LENGTH_HD : RAW_TRACKDATA_LENGTH_DD;
+	const int maxSectors = isHD ? NUM_SECTORS_PER_TRACK_HD : NUM_SECTORS_PER_TRACK_DD;
+
+	// Bit positions of the last bit of each syncsync found
+	std::vector<uint32_t> syncOffsets;
+	syncOffsets.reserve(maxSectors * 2);
+	MFM::findSyncOffsets(track, dataLength, trackSync, syncOffsets);
+
+	uint32_t nextSyncAllowed = 0;
+	for (const uint32_t syncPosition : syncOffsets) {
+		if (syncPosition < nextSyncAllowed) continue;
+		if (decodeSectorAtSync(track, dataLength, syncPosition, isHD, trackNumber, side, decodedTrack, ignoreHeaderChecksum))
+			nextSyncAllowed = syncPosition + SECTOR_SKIP_BITS;
 	}
 }
 
+// Finds sectors in MFM data that is still arriving from the drive.  Each update() only searches what's new since the last one, and a sector is
+// decoded as soon as all of it is there.  Unlike findSectors the data isn't treated as circular, it's a stream of one or more revolutions
+class StreamingSectorFinder {
+private:
+	const unsigned char* m_data;
+	const bool m_isHD;
+	const unsigned int m_trackNumber;
+	const DiskSurface m_side;
+	DecodedTrack& m_track;
+	const bool m_ignoreHeaderChecksum;
+
+	unsigned int m_scannedBytes = 0;       // The SYNC search has been done this far
+	int64_t m_lastSync = -1;               // Last SYNC found
+	uint32_t m_nextSyncAllowed = 0;
+	std::vector<uint32_t> m_waiting;       // SYNCs whose sectors haven't all arrived yet
+	std::vector<uint32_t> m_found;
+
+public:
+	StreamingSectorFinder(const unsigned char* data, bool isHD, unsigned int trackNumber, DiskSurface side, DecodedTrack& decodedTrack, bool ignoreHeaderChecksum) :
+		m_data(data), m_isHD(isHD), m_trackNumber(trackNumber), m_side(side), m_track(decodedTrack), m_ignoreHeaderChecksum(ignoreHeaderChecksum) {
+		m_waiting.reserve(NUM_SECTORS_PER_TRACK_HD * 2);
+		m_found.reserve(NUM_SECTORS_PER_TRACK_HD * 2);
+	}
+
+	// bytesAvailable is how much of the data has now arrived
+	void update(const unsigned int bytesAvailable) {
+		if (bytesAvailable <= m_scannedBytes) return;
+
+		// A SYNC can straddle the end of the last block, so go back over the last 4 bytes.  Anything ending in them has already been found
+		const unsigned int from = (m_scannedBytes > 4) ? m_scannedBytes - 4 : 0;
+		m_found.clear();
+		MFM::findSyncOffsets(m_data + from, bytesAvailable - from, AMIGA_WORD_SYNC, m_found);
+		for (const uint32_t offset : m_found) {
+			if ((from) && (offset < 31)) continue;   // Part of it would be before 'from'
+			const uint32_t syncPosition = offset + (from * 8);
+			if ((int64_t)syncPosition <= m_lastSync) continue;
+			m_waiting.push_back(syncPosition);
+			m_lastSync = syncPosition;
+		}
+		m_scannedBytes = bytesAvailable;
+
+		// Decode any sectors that have fully arrived
+		unsigned int used = 0;
+		for (; used < m_waiting.size(); used++) {
+			const uint32_t syncPosition = m_waiting[used];
+			// The header is before the start of the stream
+			if (syncPosition < 63) continue;
+			// Not all here yet
+			if (syncPosition - 63 + (RAW_SECTOR_SIZE * 8) > bytesAvailable * 8) break;
+			if (syncPosition < m_nextSyncAllowed) continue;
+			if (decodeSectorAtSync(m_data, bytesAvailable, syncPosition, m_isHD, m_trackNumber, m_side, m_track, m_ignoreHeaderChecksum))
+				m_nextSyncAllowed = syncPosition + SECTOR_SKIP_BITS;
+		}
+		m_waiting.erase(m_waiting.begin(), m_waiting.begin() + used);
+	}
+};
+
 // Merges any invalid sectors into the valid ones as a last resort
 void mergeInvalidSectors(DecodedTrack& track, bool isHD) {
 	const int maxSectors = isHD ? NUM_SECTORS_PER_TRACK_HD : NUM_SECTORS_PER_TRACK_DD;
 
 	for (unsigned char sector = 0; sector < maxSectors; sector++) {
-		if (track.invalidSectors[sector].size()) {
+		if (track.invalidFound[sector]) {
 			// Lets try to make the best sector we can
-			DecodedSector sec = track.invalidSectors[sector][0];
+			DecodedSector& sec = track.validSectors[sector];
+			sec = track.invalidSectors[sector];
 			// Repair maybe!?
 			attemptFixSector(track, sec);
 
-			track.validSectors.push_back(sec);
+			track.setValid(sector);
 		}
-		track.invalidSectors[sector].clear();
 	}
 }
 
@@ -942,11 +967,9 @@ bool ADFWriter::runDiagnostics(const std::string& portName, std::function<void(b
 		DecodedTrack trk1;
 		findSectors(*data, readSize, 40, ArduinoFloppyReader::DiskSurface::dsUpper, AMIGA_WORD_SYNC, trk1, true);
 		
-		counter=0; 
-		for (unsigned int sec=0; sec< maxSectorsPerTrack; sec++)
-			if (trk1.invalidSectors[sec].size()) counter++;
+		counter = trk1.numInvalid();
 
-		if (counter + trk1.validSectors.size() > 0) {
+		if (counter + trk1.numValid() > 0) {
 			messageOutput(false, "Tracks found!");
 			tracksFound = true;
 			break;
@@ -955,11 +978,9 @@ bool ADFWriter::runDiagnostics(const std::string& portName, std::function<void(b
 		DecodedTrack trk2;
 		findSectors(*data, readSize, 40, ArduinoFloppyReader::DiskSurface::dsLower, AMIGA_WORD_SYNC, trk2, true);
 		
-		counter = 0;
-		for (unsigned int sec = 0; sec< maxSectorsPerTrack; sec++)
-			if (trk2.invalidSectors[sec].size()) counter++;
+		counter = trk2.numInvalid();
 
-		if (counter + trk2.validSectors.size() > 0) {
+		if (counter + trk2.numValid() > 0) {
 			messageOutput(false, "Tracks found but on the wrong side.  Please check the following PINS on the Arduino: 9");
 			free(data);
 			return false;
@@ -998,11 +1019,9 @@ bool ADFWriter::runDiagnostics(const std::string& portName, std::function<void(b
 		DecodedTrack trk1;
 		findSectors(*data, readSize, 40, ArduinoFloppyReader::DiskSurface::dsLower, AMIGA_WORD_SYNC, trk1, true);
 
-		counter = 0;
-		for (unsigned int sec = 0; sec< maxSectorsPerTrack; sec++)
-			if (trk1.invalidSectors[sec].size()) counter++;
+		counter = trk1.numInvalid();
 
-		if (counter + trk1.validSectors.size() > 0) {
+		if (counter + trk1.numValid() > 0) {
 			messageOutput(false, "Tracks found!");
 			tracksFound = true;
 			break;
@@ -1011,11 +1030,9 @@ bool ADFWriter::runDiagnostics(const std::string& portName, std::function<void(b
 		DecodedTrack trk2;
 		findSectors(*data, readSize, 40, ArduinoFloppyReader::DiskSurface::dsUpper, AMIGA_WORD_SYNC, trk2, true);
 
-		counter = 0;
-		for (unsigned int sec = 0; sec< maxSectorsPerTrack; sec++)
-			if (trk2.invalidSectors[sec].size()) counter++;
+		counter = trk2.numInvalid();
 
-		if (counter + trk2.validSectors.size() > 0) {
+		if (counter + trk2.numValid() > 0) {
 			messageOutput(false, "Tracks found but on the wrong side.  Please check the following PINS on the Arduino: 9");
 			free(data);
 			return false;
@@ -1167,11 +1184,12 @@ bool ADFWriter::runDiagnostics(const std::string& portName, std::function<void(b
 				DecodedTrack trk;
 				findSectors(*data, isHDDrive, 41, ArduinoFloppyReader::DiskSurface::dsUpper, AMIGA_WORD_SYNC, trk, true);
 				// Have a look at any of the found sectors and see if any are valid and matched the phrase we wrote onto the disk
-				for (const DecodedSector& sec : trk.validSectors) {
+				for (unsigned int sector = 0; sector < maxSectorsPerTrack; sector++) {
+					if (!trk.validFound[sector]) continue;
 					// See if we can find the sequence in here somewhere 
 					std::string s;
 					s.resize(SECTOR_BYTES);
-					memcpy(&s[0], sec.data, SECTOR_BYTES);
+					memcpy(&s[0], trk.validSectors[sector].data, SECTOR_BYTES);
 
 					if (s.find(TEST_BYTE_SEQUENCE) != std::string::npos) {
 						// Excellent
@@ -1213,11 +1231,12 @@ bool ADFWriter::runDiagnostics(const std::string& portName, std::function<void(b
 				DecodedTrack trk;
 				findSectors(*data, readSize, 41, currentSurface, AMIGA_WORD_SYNC, trk, true);
 				// Have a look at any of the found sectors and see if any are valid and matched the phrase we wrote onto the disk
-				for (const DecodedSector& sec : trk.validSectors) {
+				for (unsigned int sector = 0; sector < maxSectorsPerTrack; sector++) {
+					if (!trk.validFound[sector]) continue;
 					// See if we can find the sequence in here somewhere 
 					std::string s;
 					s.resize(SECTOR_BYTES);
-					memcpy(&s[0], sec.data, SECTOR_BYTES);
+					memcpy(&s[0], trk.validSectors[sector].data, SECTOR_BYTES);
 
 					if (s.find(TEST_BYTE_SEQUENCE) != std::string::npos) {
 						// Excellent
@@ -1228,16 +1247,15 @@ bool ADFWriter::runDiagnostics(const std::string& portName, std::function<void(b
 				if (!writtenOK) {
 					// See if we can find the sequence in one of the partial sectors
 					for (unsigned int sector = 0; sector < maxSectorsPerTrack; sector++) {
-						for (const DecodedSector& sec : trk.invalidSectors[sector]) {
+						if (trk.invalidFound[sector]) {
 							// See if we can find the sequence in here somewhere 
 							std::string s;
 							s.resize(SECTOR_BYTES);
-							memcpy(&s[0], sec.data, SECTOR_BYTES);
+							memcpy(&s[0], trk.invalidSectors[sector].data, SECTOR_BYTES);
 
 							if (s.find(TEST_BYTE_SEQUENCE) != std::string::npos) {
 								// Excellent
 								writtenOK = true;
-								break;
 							}
 						}
 						if (writtenOK) break;
@@ -1291,23 +1309,93 @@ const FirmwareVersion ADFWriter::getFirwareVersion() const {
 	return m_device->getFirwareVersion(); 
 };
 
-class TrackMemoryUsed {
+// How many tracks ADFToDisk and sectorFileToDisk encode ahead of the one being written
+#define TRACKENCODER_ENCODE_AHEAD 3
+
+// Reads and encodes the tracks for ADFToDisk and sectorFileToDisk on its own thread, so the next track is already waiting as MFM while
+// the current one is written and verified.  Tracks are numbered in the order they appear in the file.  The buffers are reused, so
+// only TRACKENCODER_ENCODE_AHEAD + 1 tracks are ever held in memory
+class TrackEncoder {
+public:
+	struct EncodedTrack {
+		unsigned int position;
+		std::vector<unsigned char> source;  // The track as it was in the file, for verifying
+		std::vector<uint32_t> mfm;          // The encoded track.  Held as uint32_t so it's aligned for the encoders
+		unsigned int mfmOffset = 0;         // Where in mfm writing starts, in bytes
+		unsigned int mfmLength = 0;         // How many bytes to write
+
+		const unsigned char* mfmData() const { return (const unsigned char*)mfm.data() + mfmOffset; }
+	};
+
+	// Reads and encodes the track at position into track.  Returns FALSE if there are no more.  This is called on the encoder's thread
+	typedef std::function<bool(const unsigned int position, EncodedTrack& track)> Encoder;
+
+private:
+	Encoder m_encoder;
+
+	std::mutex m_lock;
+	std::condition_variable m_changed;
+	std::deque<std::unique_ptr<EncodedTrack>> m_ready;     // Encoded and waiting to be written
+	std::vector<std::unique_ptr<EncodedTrack>> m_free;     // Buffers waiting to be encoded into
+	std::unique_ptr<EncodedTrack> m_writing;               // The track the writer has
+	bool m_finished = false;
+	bool m_stop = false;
+	std::thread m_thread;
+
+	void run() {
+		unsigned int position = 0;
+		std::unique_lock<std::mutex> lock(m_lock);
+		for (;;) {
+			m_changed.wait(lock, [this]() { return m_stop || !m_free.empty(); });
+			if (m_stop) break;
+
+			std::unique_ptr<EncodedTrack> track = std::move(m_free.back());
+			m_free.pop_back();
+			lock.unlock();
+
+			track->position = position;
+			const bool encoded = m_encoder(position, *track);
+
+			lock.lock();
+			if (!encoded) {
+				m_finished = true;
+				m_changed.notify_all();
+				break;
+			}
+			m_ready.push_back(std::move(track));
+			position++;
+			m_changed.notify_all();
+		}
+	}
+
 public:
-	RawDecodedTrackHD* trackHD;
-	FullDiskTrackHD* disktrackHD;
-	FullDiskTrackDD* disktrackDD;
-
-	TrackMemoryUsed() {
-		trackHD = (RawDecodedTrackHD*)malloc(sizeof(RawDecodedTrackHD));
-		disktrackHD = (FullDiskTrackHD*)malloc(sizeof(FullDiskTrackHD));
-		disktrackDD = (FullDiskTrackDD*)malloc(sizeof(FullDiskTrackDD));
-		memset(disktrackDD, 0xAA, sizeof(FullDiskTrackDD));  // Pad with "0"s which as an MFM encoded byte is 0xAA
-		memset(disktrackHD, 0xAA, sizeof(FullDiskTrackHD));  // Pad with "0"s which as an MFM encoded byte is 0xAA
-	}
-	~TrackMemoryUsed() {
-		free(trackHD);
-		free(disktrackHD);
-		free(disktrackDD);
+	TrackEncoder(Encoder encoder) : m_encoder(encoder) {
+		for (unsigned int index = 0; index <= TRACKENCODER_ENCODE_AHEAD; index++)
+			m_free.push_back(std::unique_ptr<EncodedTrack>(new EncodedTrack()));
+		m_thread = std::thread(&TrackEncoder::run, this);
+	}
+	~TrackEncoder() {
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_stop = true;
+			m_changed.notify_all();
+		}
+		if (m_thread.joinable()) m_thread.join();
+	}
+
+	// Waits for the next track.  The one returned last time is handed back to be reused.  Returns nullptr once there are no more
+	const EncodedTrack* next() {
+		std::unique_lock<std::mutex> lock(m_lock);
+		if (m_writing) {
+			m_free.push_back(std::move(m_writing));
+			m_changed.notify_all();
+		}
+		m_changed.wait(lock, [this]() { return m_finished || !m_ready.empty(); });
+		if (m_ready.empty()) return nullptr;
+
+		m_writing = std::move(m_ready.front());
+		m_ready.pop_front();
+		return m_writing.get();
 	}
 };
 
@@ -1413,22 +1501,39 @@ ADFResult ADFWriter::sectorFileToDisk(const std::string& inputFile, const bool i
 	bool fileIsHD = sectorsPerTrack > 11;
 	if (inHDMode != fileIsHD) return ADFResult::adfrMediaSizeMismatch;
 
-	// Make space for each track
-	track.resize(bytesPerSector * sectorsPerTrack);
-	IBM::DecodedSector sectorDecoded;
-	sectorDecoded.data.resize(bytesPerSector);
-	std::vector<uint32_t> mfmBuffer;
-	mfmBuffer.resize(IBM::MaxTrackSize);
-
 	hFile.seekg(0, std::ios_base::beg);
 
-	while (hFile.good()) {
-		hFile.read((char*)&track[0], track.size());
-		std::streamsize bytesRead = hFile.gcount();
+	// Only used by the encoder's thread
+	IBM::DecodedTrack trk;
+
+	// Read and encode the tracks ahead of the one being written
+	TrackEncoder encoder([&hFile, &trk, inHDMode, useAtariSTTiming, bytesPerSector, sectorsPerTrack](const unsigned int position, TrackEncoder::EncodedTrack& encoded)->bool {
+		// There is a physical limit
+		if (position >= 84 * 2) return false;
 
+		encoded.source.resize(bytesPerSector * sectorsPerTrack);
+		if (!hFile.good()) return false;
+		hFile.read((char*)encoded.source.data(), encoded.source.size());
 		// Stop if we didnt read a full track
-		if (bytesRead != (std::streamsize)track.size()) break;
+		if (hFile.gcount() != (std::streamsize)encoded.source.size()) return false;
+
+		trk.clear();
+		for (uint32_t i = 0; i < sectorsPerTrack; i++) {
+			IBM::DecodedSector* sectorDecoded = trk.add(i, bytesPerSector);
+			if (sectorDecoded) memcpy(sectorDecoded->data, &encoded.source[bytesPerSector * i], bytesPerSector);
+		}
+
+		encoded.mfm.resize(IBM::MaxTrackSize);
+		encoded.mfmOffset = 0;
+		encoded.mfmLength = IBM::encodeSectorsIntoMFM_IBM(inHDMode, useAtariSTTiming, &trk, position, (uint32_t)encoded.mfm.size(), encoded.mfm.data());
+		return true;
+	});
 
+	// Used to verify each track
+	IBM::DecodedTrack trackRead;
+
+	while (const TrackEncoder::EncodedTrack* encoded = encoder.next()) {
+		currentTrack = encoded->position;
 		const unsigned int cylinder = currentTrack / numHeads;
 		DiskSurface surface = ((currentTrack % numHeads) == 1) ? DiskSurface::dsUpper : DiskSurface::dsLower;
 
@@ -1440,21 +1545,11 @@ ADFResult ADFWriter::sectorFileToDisk(const std::string& inputFile, const bool i
 		if (callback)
 			if (callback(cylinder, surface, false, CallbackOperation::coReadingFile) == WriteResponse::wrAbort) return ADFResult::adfrAborted;
 
-
-		IBM::DecodedTrack trk;
-		for (uint32_t i = 0; i < sectorsPerTrack; i++) {
-			memcpy(&sectorDecoded.data[0], &track[bytesPerSector * i], bytesPerSector);
-			trk.sectors.insert({ i, sectorDecoded });
-		}
-	
-		const uint32_t totalBytesToWrite = IBM::encodeSectorsIntoMFM_IBM(inHDMode, useAtariSTTiming, &trk, currentTrack, mfmBuffer.size(),  &mfmBuffer[0]);		
-
 		// Keep looping until it wrote correctly
-		IBM::DecodedTrack trackRead;
-		trackRead.sectors.clear();
+		trackRead.clear();
 
 		int failCount = 0;
-		while ((trackRead.sectors.size() < sectorsPerTrack) || (trackRead.sectorsWithErrors))  {
+		while ((trackRead.count() < sectorsPerTrack) || (trackRead.sectorsWithErrors))  {
 
 			if (eraseFirst) {
 				// Run the erase cycle twice
@@ -1467,8 +1562,8 @@ ADFResult ADFWriter::sectorFileToDisk(const std::string& inputFile, const bool i
 				if (callback(cylinder, surface, false, failCount > 0 ? CallbackOperation::coRetryWriting : CallbackOperation::coWriting) == WriteResponse::wrAbort) return ADFResult::adfrAborted;
 
 			DiagnosticResponse resp;
-			resp = m_device->writeCurrentTrackPrecomp((const unsigned char*)& mfmBuffer[0], totalBytesToWrite, true, (cylinder >= 40) && usePrecompMode);
-			if (resp == DiagnosticResponse::drOldFirmware) resp = m_device->writeCurrentTrack((const unsigned char*)&mfmBuffer[0], totalBytesToWrite, true);
+			resp = m_device->writeCurrentTrackPrecomp(encoded->mfmData(), encoded->mfmLength, true, (cylinder >= 40) && usePrecompMode);
+			if (resp == DiagnosticResponse::drOldFirmware) resp = m_device->writeCurrentTrack(encoded->mfmData(), encoded->mfmLength, true);
 
 			switch (resp) {
 			case DiagnosticResponse::drWriteProtected: return ADFResult::adfrDiskWriteProtected;
@@ -1486,37 +1581,36 @@ ADFResult ADFWriter::sectorFileToDisk(const std::string& inputFile, const bool i
 					if (m_device->readCurrentTrack(data, inHDMode ? sizeof(RawTrackDataHD) : sizeof(RawTrackDataDD), false) == DiagnosticResponse::drOK) {
 						// Find hopefully all sectors
 						bool nonStandard;
-						trackRead.sectors.clear();
+						trackRead.clear();
 						IBM::findSectors_IBM(data, sizeof(data) * 8, inHDMode, currentTrack, sectorsPerTrack, trackRead, nonStandard);						
 					}
-					if ((trackRead.sectors.size() == sectorsPerTrack) && (trackRead.sectorsWithErrors==0)) break;
+					if ((trackRead.count() == sectorsPerTrack) && (trackRead.sectorsWithErrors==0)) break;
 
 					if (callback)
 						if (callback(cylinder, surface, false, CallbackOperation::coReVerifying) == WriteResponse::wrAbort) return ADFResult::adfrAborted;
 				}
 
 				// So we found all sectors, but were they the ones we actually wrote!?
-				if ((trackRead.sectors.size() == sectorsPerTrack) && (trackRead.sectorsWithErrors == 0)) {
+				if ((trackRead.count() == sectorsPerTrack) && (trackRead.sectorsWithErrors == 0)) {
 					int sectorsGood = 0;
 					for (unsigned int sector = 0; sector < sectorsPerTrack; sector++) {
-						auto writtenTrk = trackRead.sectors.find(sector);
-						auto originalTrk = trk.sectors.find(sector);
+						const IBM::DecodedSector* writtenTrk = trackRead.find(sector);
 						
-						if ((originalTrk != trk.sectors.end()) && (writtenTrk != trackRead.sectors.end()))
-							if (originalTrk->second.data.size() == writtenTrk->second.data.size())
-								if (memcmp(originalTrk->second.data.data(), writtenTrk->second.data.data(), writtenTrk->second.data.size()) == 0) {
+						if (writtenTrk)
+							if (writtenTrk->size == bytesPerSector)
+								if (memcmp(&encoded->source[bytesPerSector * sector], writtenTrk->data, writtenTrk->size) == 0) {
 								sectorsGood++;  // this one matches on read!
 							}
 					}
 					if ((unsigned int)sectorsGood != sectorsPerTrack) {
 						// Something went wrong, so we clear them all so it gets reported as an error
-						trackRead.sectors.clear();
+						trackRead.clear();
 					}
 				}
 
 
 				// We failed to verify this track.
-				if ((trackRead.sectors.size() < sectorsPerTrack) || (trackRead.sectorsWithErrors)) {
+				if ((trackRead.count() < sectorsPerTrack) || (trackRead.sectorsWithErrors)) {
 					failCount++;
 					if (failCount >= 5) {
 						if (!callback) break;
@@ -1534,12 +1628,7 @@ ADFResult ADFWriter::sectorFileToDisk(const std::string& inputFile, const bool i
 			}
 			else break;
 		}
-
-		currentTrack++;
-		// But there is a physical limit
-		if (currentTrack >= 84*2) break;
 	}
-	hFile.close();
 	
 	return errors ? ADFResult::adfrCompletedWithErrors : ADFResult::adfrComplete;
 }
@@ -1574,9 +1663,9 @@ ADFResult ADFWriter::diskToIBMST(const std::string& outputFile, const bool inHDM
 
 		if (m_device->readCurrentTrack(data, readSize, false) == DiagnosticResponse::drOK) {
 			IBM::findSectors_IBM(data, readSize * 8, inHDMode, 0, 9, decodedTrack, nonStandard);
-			auto trk0 = decodedTrack.sectors.find(0);
-			if (trk0 != decodedTrack.sectors.end()) {
-				if (trk0->second.numErrors < 1) break;
+			const IBM::DecodedSector* trk0 = decodedTrack.find(0);
+			if (trk0) {
+				if (trk0->numErrors < 1) break;
 			}
 		}
 	}
@@ -1588,12 +1677,12 @@ ADFResult ADFWriter::diskToIBMST(const std::string& outputFile, const bool inHDM
 	uint32_t bytesPerSector = 512;
 
 	// And then see if we can actually determine this from the disk
-	auto trk0 = decodedTrack.sectors.find(0);
-	if (trk0 != decodedTrack.sectors.end()) {
-		if (trk0->second.numErrors < 1) {
+	const IBM::DecodedSector* trk0 = decodedTrack.find(0);
+	if (trk0) {
+		if (trk0->numErrors < 1) {
 			uint32_t serialNumber;
 			uint32_t totalSectors;
-			IBM::getTrackDetails_IBM(trk0->second.data.data(), serialNumber, numHeads, totalSectors, sectorsPerTrack, bytesPerSector);
+			IBM::getTrackDetails_IBM(trk0->data, serialNumber, numHeads, totalSectors, sectorsPerTrack, bytesPerSector);
 		}
 	}
 
@@ -1618,14 +1707,14 @@ ADFResult ADFWriter::diskToIBMST(const std::string& outputFile, const bool inHDM
 		if (m_device->selectSurface(surface) != DiagnosticResponse::drOK) ADFResult::adfrCompletedWithErrors;
 
 		// Reset (but keep the initial ones!)
-		if (currentTrack > 0) decodedTrack.sectors.clear();
+		if (currentTrack > 0) decodedTrack.clear();
 
 		uint32_t failureTotal = 0;
 
 		bool ignoreChecksums = false;
 
 		// Repeat until we have all 11 sectors
-		while ((decodedTrack.sectors.size() < sectorsPerTrack) || (decodedTrack.sectorsWithErrors))  {
+		while ((decodedTrack.count() < sectorsPerTrack) || (decodedTrack.sectorsWithErrors))  {
 
 			if (callback) {
 				if ((failureTotal % 6) == 5) {
@@ -1646,11 +1735,9 @@ ADFResult ADFWriter::diskToIBMST(const std::string& outputFile, const bool inHDM
 				case WriteResponse::wrSkipBadChecksums:
 					if (ignoreChecksums) {
 						for (uint32_t i=0; i< sectorsPerTrack; i++)
-							if (decodedTrack.sectors.find(i) == decodedTrack.sectors.end()) {
-								IBM::DecodedSector sec;
-								sec.numErrors = 0;
-								sec.data.resize(bytesPerSector);
-								decodedTrack.sectors.insert({ i, sec });
+							if (!decodedTrack.find(i)) {
+								IBM::DecodedSector* sec = decodedTrack.add(i, bytesPerSector);
+								if (sec) memset(sec->data, 0, bytesPerSector);
 							}
 						decodedTrack.sectorsWithErrors = 0;
 					}
@@ -1670,7 +1757,7 @@ ADFResult ADFWriter::diskToIBMST(const std::string& outputFile, const bool inHDM
 		// Now write all of them to disk
 		for (unsigned int sector = 0; sector < sectorsPerTrack; sector++) {
 			try {
-				hFile.write((const char*)decodedTrack.sectors[sector].data.data(), 512);
+				hFile.write((const char*)decodedTrack.sectors[sector].data, 512);
 			}
 			catch (...) {
 				hFile.close();
@@ -1683,9 +1770,21 @@ ADFResult ADFWriter::diskToIBMST(const std::string& outputFile, const bool inHDM
 	return includesBadSectors ? ADFResult::adfrCompletedWithErrors : ADFResult::adfrComplete;
 }
 
+// How many times ADFToDisk reads a track to see if it already matches before deciding it needs writing
+#define ADFTODISK_CHANGE_CHECK_READS 2
+
+// Returns TRUE if every sector of the track was found and holds the same data as the track from the ADF file
+static bool trackMatchesADF(const DecodedTrack& trackRead, const unsigned char* adfTrack, const unsigned int maxSectorsPerTrack) {
+	if (trackRead.numValid() != maxSectorsPerTrack) return false;
+	for (unsigned int sector = 0; sector < maxSectorsPerTrack; sector++)
+		if (memcmp(trackRead.validSectors[sector].data, adfTrack + (sector * SECTOR_BYTES), SECTOR_BYTES) != 0) return false;
+	return true;
+}
+
 // Writes an ADF file back to a floppy disk.  Return FALSE in the callback to abort this operation 
 // IF using precomp mode then DO NOT connect the Arduino via a USB hub, and try to plug it into a USB2 port
-ADFResult ADFWriter::ADFToDisk(const std::string& inputFile, bool mediaIsHD, bool verify, bool usePrecompMode, bool eraseFirst, bool writeFromIndex, std::function < WriteResponse(const int currentTrack, const DiskSurface currentSide, const bool isVerifyError, const CallbackOperation operation) > callback) {
+ADFResult ADFWriter::ADFToDisk(const std::string& inputFile, bool mediaIsHD, bool verify, bool usePrecompMode, bool eraseFirst, bool writeFromIndex, std::function < WriteResponse(const int currentTrack, const DiskSurface currentSide, const bool isVerifyError, const CallbackOperation operation) > callback, bool onlyChangedTracks, unsigned int* tracksSkipped) {
+	if (tracksSkipped) *tracksSkipped = 0;
 	if (!m_device->isOpen()) return ADFResult::adfrDriveError;
 
 	if (callback)
@@ -1744,12 +1843,6 @@ ADFResult ADFWriter::ADFToDisk(const std::string& inputFile, bool mediaIsHD, boo
 		return ADFResult::adfrDriveError;
 	}
 
-	unsigned int currentTrack = 0;
-	unsigned int surfaceIndex = 0;
-
-	// Buffer to hold the track
-	TrackMemoryUsed tracks;
-
 	// Just make sure nothing weird is going on
 	assert(sizeof(RawDecodedTrackDD) == ADF_TRACK_SIZE_DD);
 	assert(sizeof(RawDecodedTrackHD) == ADF_TRACK_SIZE_HD);
@@ -1758,69 +1851,83 @@ ADFResult ADFWriter::ADFToDisk(const std::string& inputFile, bool mediaIsHD, boo
 	const unsigned int AdfTrackSize = mediaIsHD ? ADF_TRACK_SIZE_HD : ADF_TRACK_SIZE_DD;
 	const unsigned int maxSectorsPerTrack = mediaIsHD ? NUM_SECTORS_PER_TRACK_HD : NUM_SECTORS_PER_TRACK_DD;
 
+	// Read and encode the tracks ahead of the one being written
+	TrackEncoder encoder([&hADFFile, mediaIsHD, writeFromIndex, AdfTrackSize](const unsigned int position, TrackEncoder::EncodedTrack& encoded)->bool {
+		// There is a physical limit
+		if (position >= 84 * 2) return false;
 
-	while (hADFFile.good()) {
-		hADFFile.read((char*)tracks.trackHD, AdfTrackSize);
-		std::streamsize bytesRead = hADFFile.gcount();
-
+		encoded.source.resize(AdfTrackSize);
+		if (!hADFFile.good()) return false;
+		hADFFile.read((char*)encoded.source.data(), AdfTrackSize);
 		// Stop if we didnt read a full track
-		if (bytesRead != (std::streamsize)AdfTrackSize) break;
-
-		// Select the track we're working on
-		if (m_device->selectTrack(currentTrack)!= DiagnosticResponse::drOK) {
-			hADFFile.close();
-			return ADFResult::adfrDriveError;
-		}
-
-		DiskSurface surface = (surfaceIndex == 1) ? DiskSurface::dsUpper : DiskSurface::dsLower;
-		// Change the surface we're targeting
-		if (m_device->selectSurface(surface) != DiagnosticResponse::drOK) {
-			hADFFile.close();
-			return ADFResult::adfrDriveError;
-		}
+		if (hADFFile.gcount() != (std::streamsize)AdfTrackSize) return false;
 
-		// Handle callback
-		if (callback)
-			if (callback(currentTrack, surface, false, CallbackOperation::coReadingFile) == WriteResponse::wrAbort) {
-				hADFFile.close();
-				return ADFResult::adfrAborted;
-			}
+		const unsigned int trackNumber = position / 2;
+		const DiskSurface surface = (position & 1) ? DiskSurface::dsUpper : DiskSurface::dsLower;
 
-		 
-		unsigned char lastByte;
-		unsigned int dataToWrite;
-		unsigned char* dataToWritePtr;
 		// Now encode the sector into the output buffer
 		if (mediaIsHD) {
-			lastByte = tracks.disktrackHD->filler1[sizeof(tracks.disktrackHD->filler1) - 1];
-
-			for (unsigned int sector = 0; sector < maxSectorsPerTrack; sector++)
-				encodeSector(currentTrack, surface, mediaIsHD, sector, (*tracks.trackHD)[sector], tracks.disktrackHD->sectors[sector], lastByte);
-
-			if (lastByte & 1) tracks.disktrackHD->filler2[7] = 0x2F; else tracks.disktrackHD->filler2[7] = 0xFF;
-			dataToWrite = sizeof(FullDiskTrackHD) - (writeFromIndex ? (sizeof(tracks.disktrackHD->filler1)-2) : 0);
-			dataToWritePtr = writeFromIndex ? &tracks.disktrackHD->filler1[sizeof(tracks.disktrackHD->filler1) - 2] : (unsigned char*)tracks.disktrackHD;
+			encoded.mfm.resize((sizeof(FullDiskTrackHD) + 3) / 4);
+			FullDiskTrackHD& disktrack = *(FullDiskTrackHD*)encoded.mfm.data();
+			encodeTrack(trackNumber, surface, *(const RawDecodedTrackHD*)encoded.source.data(), disktrack);
+			encoded.mfmLength = sizeof(FullDiskTrackHD) - (writeFromIndex ? (sizeof(disktrack.filler1) - 2) : 0);
+			encoded.mfmOffset = writeFromIndex ? (unsigned int)(&disktrack.filler1[sizeof(disktrack.filler1) - 2] - (unsigned char*)&disktrack) : 0;
 		}
 		else {
-			lastByte = tracks.disktrackDD->filler1[sizeof(tracks.disktrackDD->filler1) - 1];
+			encoded.mfm.resize((sizeof(FullDiskTrackDD) + 3) / 4);
+			FullDiskTrackDD& disktrack = *(FullDiskTrackDD*)encoded.mfm.data();
+			encodeTrack(trackNumber, surface, *(const RawDecodedTrackDD*)encoded.source.data(), disktrack);
+			encoded.mfmLength = sizeof(FullDiskTrackDD) - (writeFromIndex ? (sizeof(disktrack.filler1) - 2) : 0);
+			encoded.mfmOffset = writeFromIndex ? (unsigned int)(&disktrack.filler1[sizeof(disktrack.filler1) - 2] - (unsigned char*)&disktrack) : 0;
+		}
+		return true;
+	});
+
+	// Used to verify each track
+	DecodedTrack trackRead;
+
+	while (const TrackEncoder::EncodedTrack* encoded = encoder.next()) {
+		const unsigned int currentTrack = encoded->position / 2;
 
-			for (unsigned int sector = 0; sector < maxSectorsPerTrack; sector++)
-				encodeSector(currentTrack, surface, mediaIsHD, sector, (*tracks.trackHD)[sector], tracks.disktrackDD->sectors[sector], lastByte);
+		// Select the track we're working on
+		if (m_device->selectTrack(currentTrack)!= DiagnosticResponse::drOK) return ADFResult::adfrDriveError;
 
-			if (lastByte & 1) tracks.disktrackDD->filler2[7] = 0x2F; else tracks.disktrackDD->filler2[7] = 0xFF;
+		DiskSurface surface = (encoded->position & 1) ? DiskSurface::dsUpper : DiskSurface::dsLower;
+		// Change the surface we're targeting
+		if (m_device->selectSurface(surface) != DiagnosticResponse::drOK) return ADFResult::adfrDriveError;
 
-			dataToWrite = sizeof(FullDiskTrackDD) - (writeFromIndex ? (sizeof(tracks.disktrackDD->filler1) - 2) : 0);
-			dataToWritePtr = writeFromIndex ? &tracks.disktrackDD->filler1[sizeof(tracks.disktrackDD->filler1) - 2] : (unsigned char*)tracks.disktrackDD;
+		// Handle callback
+		if (callback)
+			if (callback(currentTrack, surface, false, CallbackOperation::coReadingFile) == WriteResponse::wrAbort) return ADFResult::adfrAborted;
+
+		// See if the disk already has this track on it, in which case it can be left alone
+		if (onlyChangedTracks) {
+			if (callback)
+				if (callback(currentTrack, surface, false, CallbackOperation::coReading) == WriteResponse::wrAbort) return ADFResult::adfrAborted;
+
+			bool unchanged = false;
+			trackRead.clear();
+			for (int retries = 0; (retries < ADFTODISK_CHANGE_CHECK_READS) && (!unchanged); retries++) {
+				RawTrackDataHD data;
+				if (m_device->readCurrentTrack(data, mediaIsHD ? sizeof(RawTrackDataHD) : sizeof(RawTrackDataDD), false) != DiagnosticResponse::drOK) break;
+				findSectors(data, mediaIsHD, currentTrack, surface, AMIGA_WORD_SYNC, trackRead, false);
+				unchanged = trackMatchesADF(trackRead, encoded->source.data(), maxSectorsPerTrack);
+			}
+			if (unchanged) {
+				if (tracksSkipped) (*tracksSkipped)++;
+				continue;
+			}
 		}
 
+		const unsigned int dataToWrite = encoded->mfmLength;
+		const unsigned char* dataToWritePtr = encoded->mfmData();
+
 		// Keep looping until it wrote correctly
-		DecodedTrack trackRead;
-		trackRead.validSectors.clear();
-		for (unsigned int a = 0; a < maxSectorsPerTrack; a++) trackRead.invalidSectors[a].clear();
+		trackRead.clear();
 
 
 		int failCount = 0;
-		while (trackRead.validSectors.size()< maxSectorsPerTrack) {
+		while (trackRead.numValid() < maxSectorsPerTrack) {
 
 			if (eraseFirst) {
 				// Run the erase cycle twice
@@ -1832,10 +1939,7 @@ ADFResult ADFWriter::ADFToDisk(const std::string& inputFile, bool mediaIsHD, boo
 					m_device->eraseCurrentTrack();
 
 			if (callback)
-				if (callback(currentTrack, surface, false, failCount > 0 ? CallbackOperation::coRetryWriting : CallbackOperation::coWriting) == WriteResponse::wrAbort) {
-					hADFFile.close();
-					return ADFResult::adfrAborted;
-				}
+				if (callback(currentTrack, surface, false, failCount > 0 ? CallbackOperation::coRetryWriting : CallbackOperation::coWriting) == WriteResponse::wrAbort) return ADFResult::adfrAborted;
 
 			DiagnosticResponse resp;
 			resp = m_device->writeCurrentTrackPrecomp(dataToWritePtr, dataToWrite, writeFromIndex, (currentTrack >= 40) && usePrecompMode);
@@ -1843,21 +1947,16 @@ ADFResult ADFWriter::ADFToDisk(const std::string& inputFile, bool mediaIsHD, boo
 
 			switch (resp) {
 			case DiagnosticResponse::drWriteProtected:	
-				hADFFile.close();
 				return ADFResult::adfrDiskWriteProtected;
 			case DiagnosticResponse::drOK: 
 				break;
 			default: 
-				hADFFile.close();
 				return ADFResult::adfrDriveError;
 			}
 
 			if (verify) {	
 				if (callback)
-					if (callback(currentTrack, surface, false, CallbackOperation::coVerifying) == WriteResponse::wrAbort) {
-						hADFFile.close();
-						return ADFResult::adfrAborted;
-					}
+					if (callback(currentTrack, surface, false, CallbackOperation::coVerifying) == WriteResponse::wrAbort) return ADFResult::adfrAborted;
 
 				for (int retries=0; retries<10; retries++) {
 					RawTrackDataHD data;
@@ -1866,40 +1965,21 @@ ADFResult ADFWriter::ADFToDisk(const std::string& inputFile, bool mediaIsHD, boo
 						// Find hopefully all sectors
 						findSectors(data, mediaIsHD, currentTrack, surface, AMIGA_WORD_SYNC, trackRead, false);
 					}
-					if (trackRead.validSectors.size() == maxSectorsPerTrack) break;
+					if (trackRead.numValid() == maxSectorsPerTrack) break;
 
 					if (callback) 
-						if (callback(currentTrack, surface, false, CallbackOperation::coReVerifying) == WriteResponse::wrAbort) {
-							hADFFile.close();
-							return ADFResult::adfrAborted;
-						}
+						if (callback(currentTrack, surface, false, CallbackOperation::coReVerifying) == WriteResponse::wrAbort) return ADFResult::adfrAborted;
 				} 
 
 				// So we found all sectors, but were they the ones we actually wrote!?
-				if (trackRead.validSectors.size() == maxSectorsPerTrack) {
-					int sectorsGood = 0;
-					for (unsigned int sector = 0; sector < maxSectorsPerTrack; sector++) {
-						auto index = std::find_if(trackRead.validSectors.begin(), trackRead.validSectors.end(), [sector](const DecodedSector& sectorfound) -> bool {
-							return (sectorfound.sectorNumber == sector);
-						});
-
-						// We found this sector.
-						if (index != trackRead.validSectors.end()) {
-							DecodedSector& rec = trackRead.validSectors[index - trackRead.validSectors.begin()];
-							if (memcmp(rec.data, (*tracks.trackHD)[sector], SECTOR_BYTES) == 0) {
-								sectorsGood++;  // this one matches on read!
-							}
-						}
-					}
-					if ((unsigned int)sectorsGood != maxSectorsPerTrack) {
-						// Something went wrong, so we clear them all so it gets reported as an error
-						trackRead.validSectors.clear();
-					}
+				if ((trackRead.numValid() == maxSectorsPerTrack) && (!trackMatchesADF(trackRead, encoded->source.data(), maxSectorsPerTrack))) {
+					// Something went wrong, so we clear them all so it gets reported as an error
+					trackRead.validFound.reset();
 				}
 
 
 				// We failed to verify this track.
-				if (trackRead.validSectors.size() < maxSectorsPerTrack) {
+				if (trackRead.numValid() < maxSectorsPerTrack) {
 					failCount++;
 					if (failCount >= 5) {
 						if (!callback) break;
@@ -1907,7 +1987,6 @@ ADFResult ADFWriter::ADFToDisk(const std::string& inputFile, bool mediaIsHD, boo
 
 						switch (callback(currentTrack, surface, true, CallbackOperation::coReVerifying)) {
 						case WriteResponse::wrAbort: 
-							hADFFile.close();
 							return ADFResult::adfrAborted;
 						case WriteResponse::wrSkipBadChecksums: breakOut = true; errors = true; break;
 						case WriteResponse::wrContinue: break;
@@ -1920,69 +1999,11 @@ ADFResult ADFWriter::ADFToDisk(const std::string& inputFile, bool mediaIsHD, boo
 			}
 			else break;
 		}
-
-		// Goto the next surface/track
-		surfaceIndex++;
-		if (surfaceIndex > 1) {
-			surfaceIndex = 0;
-			currentTrack++;
-		}
-		// But there is a physical limit
-		if (currentTrack > 83) break; 
 	}
-	hADFFile.close();
 
 	return errors? ADFResult::adfrCompletedWithErrors: ADFResult::adfrComplete;
 }
 
-#pragma pack(1) 
-
-/* Taken from https://www.cbmstuff.com/downloads/scp/scp_image_specs.txt
-This information is copyright(C) 2012 - 2020 By Jim Drew. Permission is granted
-for inclusion with any source code when keeping this copyright notice.
-*/
-struct SCPFileHeader {
-	char			headerSCP[3];
-	unsigned char	version;
-	unsigned char	diskType;
-	unsigned char	numRevolutions;
-	unsigned char	startTrack;
-	unsigned char   endTrack;
-	unsigned char	flags;
-	unsigned char	bitcellEncoding;   // 0=16 bits per sample, 
-	unsigned char	numHeads;
-	unsigned char   timeBase;          // Resolution. Time in ns = (timeBase+1)*25
-	uint32_t	checksum;
-};
-
-struct SCPTrackHeader {
-	char			headerTRK[3];
-	unsigned char	trackNumber;
-};
-
-struct SCPTrackRevolution {
-	uint32_t	indexTime;		// Time in NS/25 for this revolution
-	uint32_t	trackLength;	// Number of bit-cells in this revolution
-	uint32_t	dataOffset;		// From the start of SCPTrackHeader 
-};
-
-// Track data is 16-bit value in NS/25.  If =0 means no flux transition for max time 
-#pragma pack()
-
-#define BITFLAG_INDEX		0
-#define BITFLAG_96TPI		1
-#define BITFLAG_NORMALISED  3
-#define BITFLAG_EXTENDED    6
-#define BITFLAG_FLUXCREATOR 7
-
-typedef std::vector<uint16_t> SCPTrackData;
-
-struct SCPTrackInMemory {
-	SCPTrackHeader header;
-	std::vector<SCPTrackRevolution> revolution;
-	std::vector<SCPTrackData> revolutionData;
-}; 
-
 // Reads the disk and write the data to the SCP file supplied.  The callback is for progress, and you can returns FALSE to abort the process
 // numTracks is the number of tracks to read.  Usually 80 (0..79), sometimes track 80 and 81 are needed. revolutions is hwo many revolutions of the disk to save (1-5)
 // SCP files are a low level flux record of the disk and usually can backup copy protected disks to.  Without special hardware they can't usually be written back to disks.
@@ -2004,11 +2025,6 @@ ADFResult ADFWriter::DiskToSCP(const std::string& outputFile, bool isHDMode, con
 	if (revolutions < 1) return ADFResult::adfrDriveError;
 	if (revolutions > 5) return ADFResult::adfrDriveError;
 
-	// Attempt ot open the file
-	std::fstream hADFFile = std::fstream(outputFile, std::ofstream::out | std::ofstream::in | std::ofstream::binary | std::ofstream::trunc);
-
-	if (!hADFFile.is_open()) return ADFResult::adfrFileError;
-	 
 	SCPFileHeader header;
 	header.headerSCP[0] = 'S';
 	header.headerSCP[1] = 'C';
@@ -2027,29 +2043,15 @@ ADFResult ADFWriter::DiskToSCP(const std::string& outputFile, bool isHDMode, con
 
 	assert(sizeof(SCPFileHeader) == 16);
 
+	// Attempt ot open the file
+	SCPFileWriter hADFFile;
+	if (!hADFFile.open(outputFile, header)) return ADFResult::adfrFileError;
+
 	SCPTrackInMemory track;
 	track.header.headerTRK[0] = 'T';
 	track.header.headerTRK[1] = 'R';
 	track.header.headerTRK[2] = 'K';
 
-	try {
-		hADFFile.write((const char*)&header, sizeof(header));
-	} catch (...) {
-			hADFFile.close();
-		return ADFResult::adfrFileIOError;
-	}
-
-	// Pad out the records.  Theres 4 bytes for each track
-	uint32_t notPresent = 0;
-	for (unsigned int a = 0; a <168; a++) {
-		try {
-			hADFFile.write((const char*)&notPresent, sizeof(notPresent));
-		} catch (...) {
-			hADFFile.close();
-			return ADFResult::adfrFileIOError;
-		}
-	}
-
 	RotationExtractor::MFMSample samples[RAW_TRACKDATA_LENGTH_HD];
 	RotationExtractor extractor;
 	extractor.setAlwaysUseIndex(true);
@@ -2092,60 +2094,18 @@ ADFResult ADFWriter::DiskToSCP(const std::string& outputFile, bool isHDMode, con
 
 			// Read in the data in 'raw' mode
 			RotationExtractor::IndexSequenceMarker startPatterns;
-			SCPTrackRevolution currentRev;
-			currentRev.indexTime = 0;
-			currentRev.trackLength = 0;
 
 			pll.reset();
 			extractor.reset(isHDMode);
 
-			SCPTrackData currentRevData;
-
 			std::function<bool(RotationExtractor::MFMSample** mfmData, const unsigned int dataLengthInBits)> callbackFunction = 
-				[this, &track, &currentRev, &currentRevData, revolutions, isHDMode](RotationExtractor::MFMSample** _mfmData, unsigned int dataLengthInBits)->bool {
+				[&track, revolutions, isHDMode](RotationExtractor::MFMSample** _mfmData, unsigned int dataLengthInBits)->bool {
 					if (track.revolution.size() >= revolutions) return false;
 
-					RotationExtractor::MFMSample* mfmData = *_mfmData;
-					unsigned int currentTime = 0;
-					
-					for (unsigned int a = 0; a < dataLengthInBits; a++) {
-						const unsigned int bit = 7 - (a & 7);
-
-						currentTime += isHDMode ? ((unsigned int)mfmData->bittime[bit] / 2) : ((unsigned int)mfmData->bittime[bit]);
-
-						// Bit found?
-						if (mfmData->mfmData & (1 << bit)) {
-
-							// Convert to 25ns times
-							currentTime /= 25;
-
-							// Keep track of time
-							currentRev.indexTime += currentTime; 
-
-							// Handle data too big
-							while (currentTime > 65535) {
-								currentRevData.push_back(0);
-								currentTime -= 65536;
-							}
-
-							// Save
-							currentRevData.push_back((unsigned short)(((currentTime & 0xFF) << 8) | ((currentTime >> 8) & 0xFF)));
-							currentRev.trackLength++;
-
-							// Reset
-							currentTime = 0;
-						}
-							
-						// Skip to next bit of data
-						if (bit == 0) mfmData++;
-					}
-
+					SCPTrackRevolution currentRev;
+					track.revolutionData.emplace_back();
+					revolutionToSCP(*_mfmData, dataLengthInBits, isHDMode, currentRev, track.revolutionData.back());
 					track.revolution.push_back(currentRev);
-					track.revolutionData.push_back(currentRevData);
-
-					currentRev.indexTime = 0;
-					currentRev.trackLength = 0;
-					currentRevData.clear();
 
 					// Stop when we have enough data
 					return track.revolution.size() < revolutions;
@@ -2164,81 +2124,16 @@ ADFResult ADFWriter::DiskToSCP(const std::string& outputFile, bool isHDMode, con
 			if (track.revolution.size() < revolutions) 
 				return ADFResult::adfrDriveError;
 
-			// Get the current position
-			uint32_t currentPosition = (uint32_t)hADFFile.tellp();
-
-			// Move to the beginning of the file, and write the offset for where this starts
-			hADFFile.seekp(sizeof(header) + (track.header.trackNumber * 4), std::fstream::beg);
-			try {
-				hADFFile.write((const char*)&currentPosition, 4);
-			} catch (...) {
+			// Save it
+			if (!hADFFile.writeTrack(track)) {
 				hADFFile.close();
 				return ADFResult::adfrFileIOError;
 			}
-
-			// Restore position and save data
-			hADFFile.seekp(currentPosition, std::fstream::beg);
-
-			// Write the header
-			try {
-				hADFFile.write((const char*)&track.header, sizeof(track.header));
-			} catch (...) {
-				hADFFile.close();
-				return ADFResult::adfrFileIOError;
-			}
-
-			// Write out the revolution headers
-			unsigned int dataPos = sizeof(track.header) + (track.revolution.size() * sizeof(SCPTrackRevolution));
-			for (unsigned int a = 0; a < track.revolution.size(); a++) {
-				track.revolution[a].dataOffset = dataPos;
-				try {
-					hADFFile.write((const char*)&track.revolution[a], sizeof(track.revolution[a]));
-				} catch (...) {
-					hADFFile.close();
-					return ADFResult::adfrFileIOError;
-				}
-				dataPos += track.revolutionData[a].size() * 2;
-			}
-
-			// Now write out the data
-			for (unsigned int a = 0; a < track.revolutionData.size(); a++) {
-				try {
-					hADFFile.write((const char*)track.revolutionData[a].data(), track.revolutionData[a].size() * 2);
-				} catch (...) {
-					hADFFile.close();
-					return ADFResult::adfrFileIOError;
-				}
-			}
 		}
 	}
-		
-	// Compute the checksum
-	hADFFile.seekg(sizeof(SCPFileHeader), std::fstream::beg);
-	unsigned char buffer[256];
-	header.checksum = 0;
-
-	while (hADFFile.good()) {
-		try {
-			hADFFile.read((char*)buffer, sizeof(buffer));
-			const std::streamsize read = hADFFile.gcount();
-			for (size_t pos = 0; pos < (size_t)read; pos++)
-				header.checksum += buffer[pos];
-		}
-		catch (...) {			
-		}		
-	}
-	hADFFile.clear();
-	hADFFile.seekp(0, std::fstream::beg);
 
-	// Write the header again with the checksum in it
-	try {
-		hADFFile.write((const char*)&header, sizeof(header));
-	} catch (...) {
-		hADFFile.close();
-		return ADFResult::adfrFileIOError;
-	}
-
-	hADFFile.close();
+	// Write the header again with the checksum and offsets in it
+	if (!hADFFile.finish()) return ADFResult::adfrFileIOError;
 
 	return ADFResult::adfrComplete;
 }
@@ -2252,21 +2147,16 @@ ADFResult ADFWriter::SCPToDisk(const std::string& inputFile, bool extraErases, s
 	m_device->checkForDisk(true);
 	if (!m_device->isDiskInDrive()) return ADFResult::adfrDriveError;
 
-	// Attempt ot open the file
-	std::fstream hADFFile = std::fstream(inputFile, std::ofstream::in | std::ofstream::binary);
-
-	if (!hADFFile.is_open()) return ADFResult::adfrFileError;
+	// Attempt ot open the file.  This also checks it's a format that we support
 	assert(sizeof(SCPFileHeader) == 16);
-	// Try to read the header
-
-	SCPFileHeader header;
-	try {
-		hADFFile.read((char*)&header, sizeof(header));
-	}
-	catch (...) {
-		hADFFile.close();
-		return ADFResult::adfrFileIOError;
+	SCPImage image;
+	switch (image.open(inputFile)) {
+		case SCPImage::Result::rOK: break;
+		case SCPImage::Result::rFileError: return ADFResult::adfrFileError;
+		case SCPImage::Result::rBadFile: return ADFResult::adfrBadSCPFile;
+		default: return ADFResult::adfrFileIOError;
 	}
+	const SCPFileHeader& header = image.header();
 
 	// Get the drive RPM spin speed
 	if (callback)
@@ -2278,28 +2168,10 @@ ADFResult ADFWriter::SCPToDisk(const std::string& inputFile, bool extraErases, s
 	driveRPM = 301;
 #endif
 
-	// Validate the format that we support
-	if ((header.headerSCP[0] != 'S') || (header.headerSCP[1] != 'C') || (header.headerSCP[2] != 'P'))
-		return ADFResult::adfrBadSCPFile;
-	if (header.numHeads != 0)
-		return ADFResult::adfrBadSCPFile;
-	if (header.numHeads != 0)
-		return ADFResult::adfrBadSCPFile;
-	if (header.flags & (1<<BITFLAG_EXTENDED))
-		return ADFResult::adfrBadSCPFile;
-
 	const uint32_t fluxMultiplier = (header.timeBase + 1) * 25;
 
-	// Read the offsets table
-	std::vector<uint32_t> trackOffsets;
-	trackOffsets.resize(168);
-	try {
-		hADFFile.read((char*)trackOffsets.data(), sizeof(uint32_t) * trackOffsets.size());
-	}
-	catch (...) {
-		hADFFile.close();
-		return ADFResult::adfrFileIOError;
-	}
+	std::vector<SCPImage::Revolution> revolutions;
+	std::vector<uint32_t> masterTimes;
 
 	// Now write the tracks.
 	for (unsigned int track = header.startTrack; track <= header.endTrack; track++) {
@@ -2309,77 +2181,26 @@ ADFResult ADFWriter::SCPToDisk(const std::string& inputFile, bool extraErases, s
 		if (callback)
 			if (callback(track / 2, (track & 1) ? DiskSurface::dsUpper : DiskSurface::dsLower, false, CallbackOperation::coWriting)== WriteResponse::wrAbort) return ADFResult::adfrAborted;
 
-
 		// Find the track data
-		hADFFile.seekp(trackOffsets[track], std::fstream::beg);
-
-		SCPTrackInMemory trk;
-
-		// Read the header
-		try {
-			hADFFile.read((char*)&trk.header, sizeof(trk.header));
-		}
-		catch (...) {
-			hADFFile.close();
-			return ADFResult::adfrFileIOError;
-		}
-		if (trk.header.trackNumber != track) return ADFResult::adfrBadSCPFile;
-		if ((trk.header.headerTRK[0] != 'T') || (trk.header.headerTRK[1] != 'R') || (trk.header.headerTRK[2] != 'K')) return ADFResult::adfrBadSCPFile;
-
-		// Now read in the track info
-		for (int r = 0; r < header.numRevolutions; r++) {
-			SCPTrackRevolution rev;
-			try {
-				hADFFile.read((char*)&rev, sizeof(SCPTrackRevolution));
-				trk.revolution.push_back(rev);
-			}
-			catch (...) {
-				hADFFile.close();
-				return ADFResult::adfrFileIOError;
+		switch (image.readTrack(track, revolutions)) {
+			case SCPImage::Result::rOK: break;
+			case SCPImage::Result::rBadFile: return ADFResult::adfrBadSCPFile;
+			default: return ADFResult::adfrFileIOError;
+		}
+
+		// Convert the revolution we're going to write into proper flux times in nanoseconds.  The first revolution is sometimes incorrect
+		const SCPImage::Revolution& revolution = revolutions[(header.numRevolutions > 1) ? 1 : 0];
+		masterTimes.clear();
+		masterTimes.reserve(revolution.numCells);
+		uint32_t lastTime = 0;
+		for (uint32_t i = 0; i < revolution.numCells; i++) {
+			const uint16_t t2 = revolution.cell(i);
+			if (t2 == 0) lastTime += 65536; else {
+				masterTimes.push_back((lastTime + t2) * fluxMultiplier);
+				lastTime = 0;
 			}
 		}
 
-		std::vector<uint32_t> actualFluxTimes;
-		{
-
-			SCPTrackData allData;
-			// And now read in their data
-			for (int r = 0; r < header.numRevolutions; r++) {
-				// Goto the data
-				hADFFile.seekp(trk.revolution[r].dataOffset + trackOffsets[track], std::fstream::beg);
-
-				allData.resize(trk.revolution[r].trackLength);
-				trk.revolution[r].dataOffset = actualFluxTimes.size();  // for use later on
-				try {
-					hADFFile.read((char*)allData.data(), trk.revolution[r].trackLength * 2);
-					// Convert allData into proper flux times in nanoseconds
-					// Move the first sample to the end as its sometimes incorrect
-					uint32_t lastTime = 0;
-					for (const uint16_t t : allData) {
-						const uint16_t t2 = htons(t);  // paws naidne
-						if (t2 == 0) lastTime += 65536; else {
-							uint32_t totalFlux = (lastTime + t2) * fluxMultiplier;							
-							actualFluxTimes.push_back(totalFlux);
-							lastTime = 0;
-						}
-					}
-
-					trk.revolution[r].trackLength = actualFluxTimes.size() - trk.revolution[r].dataOffset;
-				}
-				catch (...) {
-					hADFFile.close();
-					return ADFResult::adfrFileIOError;
-				}
-			}
-		}
-
-		// Now compute a master flux times structure from the data for all three.  They *should* all be the same length
-		int revolutionToWrite = (header.numRevolutions>1) ? 1 : 0;
-		std::vector<uint32_t> masterTimes;
-		for (uint32_t i = 0; i < trk.revolution[revolutionToWrite].trackLength; i++) {
-			masterTimes.push_back(actualFluxTimes[i+ trk.revolution[revolutionToWrite].dataOffset]);
-		}
-
 		if (extraErases) {
 			m_device->eraseFluxOnTrack();
 			m_device->eraseFluxOnTrack();
@@ -2399,8 +2220,324 @@ ADFResult ADFWriter::SCPToDisk(const std::string& inputFile, bool extraErases, s
 }
 
 
+// How many surfaces DiskToADF reads ahead of the one being decoded
+#define DISKTOADF_READ_AHEAD 2
+// How many revolutions a single streamed read can cover while it waits for missing sectors
+#define DISKTOADF_STREAM_REVOLUTIONS 3
+// How many revolutions each retry captures
+#define DISKTOADF_RETRY_REVOLUTIONS 5
+
+// Reads the raw tracks for DiskToADF on its own thread, so the drive is already reading the next surface while the last one is
+// decoded.  Surfaces are numbered (track * 2) + surfaceIndex, and are read in the order they're queued.  Reads are identified by
+// their index in that order.  While this is running nothing else may use the device.
+// With firmware that can stream, the data is handed over while it's still arriving so the decoder can stop the read as soon as it has
+// every sector, or let it carry on over the following revolutions for the ones it's missing.  Retries capture several whole revolutions
+// with readRotation, each one passed over as soon as it's complete
+class TrackAcquirer {
+public:
+	enum class ReadStatus { rsOK, rsSeekError, rsReadError };
+	enum class ReadKind { rkTrack, rkStream, rkRotations };
+
+	// A read of a surface.  Everything other than data is protected by the acquirer's lock
+	struct RawRead {
+		unsigned int index;
+		unsigned int position;
+		ReadStatus status = ReadStatus::rsOK;
+		ReadKind kind = ReadKind::rkTrack;
+		std::vector<unsigned char> data;
+		unsigned int available = 0;         // How much of data has arrived
+		bool finished = false;
+		bool stopRequested = false;
+	};
+
+private:
+	ArduinoInterface* m_device;
+	const unsigned int m_readSize;
+	bool m_canStream;
+
+	// For the retries.  The extractor is kept so the rotation speed is only learnt once
+	RotationExtractor m_extractor;
+	std::vector<RotationExtractor::MFMSample> m_samples;
+
+	std::mutex m_lock;
+	std::condition_variable m_changed;
+	std::deque<std::shared_ptr<RawRead>> m_reads;      // Reads for the decoder, including the one in progress
+	std::shared_ptr<RawRead> m_current;                 // The read in progress
+	std::vector<unsigned int> m_order;                  // The surfaces to read, in order
+	unsigned int m_nextIndex = 0;                       // Next read to make ahead of the decoder
+	unsigned int m_decoderIndex = 0;                    // Read the decoder is working on
+	bool m_failed = false;                              // A read failed, so there's no point making any more
+	bool m_retryRequested = false;
+	bool m_retryReseek = false;
+	bool m_stop = false;
+	std::thread m_thread;
+
+	// Only used by the thread
+	int m_headPosition = -1;
+
+	// Moves the head to the surface
+	ReadStatus seek(const unsigned int position, const bool reseek) {
+		const int currentTrack = (int)(position / 2);
+		if (reseek) {
+			// simulate what the Amiga kinda sounded like it was doing by re-seeking to the track.  This sometimes fixes it, weird eh, and sounds cool
+			m_device->selectTrack(currentTrack < 40 ? currentTrack + 30 : currentTrack - 30, ArduinoFloppyReader::TrackSearchSpeed::tssSlow);
+			if (m_device->selectTrack(currentTrack) != DiagnosticResponse::drOK) return ReadStatus::rsSeekError;
+		}
+		else
+		if ((m_headPosition < 0) || (m_headPosition / 2 != currentTrack)) {
+			if (m_device->selectTrack(currentTrack) != DiagnosticResponse::drOK) return ReadStatus::rsSeekError;
+		}
+
+		if (m_headPosition != (int)position) {
+			if (m_device->selectSurface((position & 1) ? DiskSurface::dsUpper : DiskSurface::dsLower) != DiagnosticResponse::drOK) return ReadStatus::rsSeekError;
+			m_headPosition = (int)position;
+		}
+		return ReadStatus::rsOK;
+	}
+
+	// Reads the surface into raw, which the decoder can already see
+	ReadStatus read(const unsigned int position, const bool reseek, RawRead& raw) {
+		const ReadStatus status = seek(position, reseek);
+		if (status != ReadStatus::rsOK) return status;
+
+		switch (raw.kind) {
+			case ReadKind::rkTrack: {
+				if (m_device->readCurrentTrack(raw.data.data(), m_readSize, false) != DiagnosticResponse::drOK) return ReadStatus::rsReadError;
+				std::lock_guard<std::mutex> lock(m_lock);
+				raw.available = m_readSize;
+				return ReadStatus::rsOK;
+			}
+
+			case ReadKind::rkRotations: {
+				// The revolutions are joined back together into one stream, bit for bit, so sectors across the joins aren't lost
+				RotationExtractor::IndexSequenceMarker startPatterns;
+				unsigned int bitPosition = 0;
+				unsigned int revolutions = 0;
+				const unsigned int maxBits = (unsigned int)(raw.data.size() - 1) * 8;
+				const DiagnosticResponse response = m_device->readRotation(m_extractor, (unsigned int)m_samples.size(), m_samples.data(), startPatterns, [this, &raw, &bitPosition, &revolutions, maxBits](RotationExtractor::MFMSample** mfmData, const unsigned int dataLengthInBits)->bool {
+					const unsigned int bits = std::min(dataLengthInBits, maxBits - bitPosition);
+					const unsigned int shift = bitPosition & 7;
+					const RotationExtractor::MFMSample* samples = *mfmData;
+					unsigned char* output = raw.data.data() + (bitPosition >> 3);
+					for (unsigned int index = 0; index < (bits + 7) / 8; index++) {
+						unsigned char value = samples[index].mfmData;
+						// Anything past the end of the revolution isn't part of it
+						if ((index + 1) * 8 > bits) value &= (unsigned char)(0xFF << (((index + 1) * 8) - bits));
+						output[index] |= value >> shift;
+						if (shift) output[index + 1] |= (unsigned char)(value << (8 - shift));
+					}
+					bitPosition += bits;
+					revolutions++;
+
+					std::lock_guard<std::mutex> lock(m_lock);
+					raw.available = bitPosition / 8;
+					m_changed.notify_all();
+					return (!raw.stopRequested) && (revolutions < DISKTOADF_RETRY_REVOLUTIONS) && (bitPosition < maxBits);
+				}, false);
+				// If no rotation could be found there's just nothing to decode, the same as a track full of noise
+				return (response == DiagnosticResponse::drReadResponseFailed) ? ReadStatus::rsReadError : ReadStatus::rsOK;
+			}
+
+			default:
+				break;
+		}
+
+		const DiagnosticResponse response = m_device->streamCurrentTrack(raw.data.data(), (unsigned int)raw.data.size(), [this, &raw](const unsigned int bytesAvailable)->bool {
+			std::lock_guard<std::mutex> lock(m_lock);
+			raw.available = bytesAvailable;
+			m_changed.notify_all();
+			return !raw.stopRequested;
+		});
+		return (response == DiagnosticResponse::drOK) ? ReadStatus::rsOK : ReadStatus::rsReadError;
+	}
+
+	void run() {
+		std::unique_lock<std::mutex> lock(m_lock);
+		while (!m_stop) {
+			unsigned int index;
+			bool reseek = false;
+			ReadKind kind = m_canStream ? ReadKind::rkStream : ReadKind::rkTrack;
+
+			// Retries come first, the decoder is waiting for them
+			if (m_retryRequested) {
+				index = m_decoderIndex;
+				reseek = m_retryReseek;
+				m_retryRequested = false;
+				kind = m_canStream ? ReadKind::rkRotations : ReadKind::rkTrack;
+			}
+			else
+			if ((!m_failed) && (m_nextIndex < m_order.size()) && (m_nextIndex <= m_decoderIndex + DISKTOADF_READ_AHEAD)) {
+				index = m_nextIndex++;
+			}
+			else {
+				m_changed.wait(lock);
+				continue;
+			}
+			const unsigned int position = m_order[index];
+
+			std::shared_ptr<RawRead> raw = std::make_shared<RawRead>();
+			raw->index = index;
+			raw->position = position;
+			raw->kind = kind;
+			switch (kind) {
+				case ReadKind::rkStream:    raw->data.resize(m_readSize * DISKTOADF_STREAM_REVOLUTIONS); break;
+				case ReadKind::rkRotations: raw->data.resize(m_readSize * DISKTOADF_RETRY_REVOLUTIONS); break;
+				default:                    raw->data.resize(m_readSize); break;
+			}
+			m_reads.push_back(raw);
+			m_current = raw;
+			m_changed.notify_all();
+			lock.unlock();
+
+			const ReadStatus status = read(position, reseek, *raw);
+
+			lock.lock();
+			raw->status = status;
+			raw->finished = true;
+			m_current.reset();
+			// No point going any further, the decoder will stop when it gets here
+			if (status != ReadStatus::rsOK) m_failed = true;
+			m_changed.notify_all();
+		}
+	}
+
+public:
+	TrackAcquirer(ArduinoInterface* device, const unsigned int readSize) : m_device(device), m_readSize(readSize) {
+		const FirmwareVersion version = m_device->getFirwareVersion();
+		m_canStream = (version.major > 1) || ((version.major == 1) && (version.minor >= 8));
+		if (m_canStream) m_samples.resize(RAW_TRACKDATA_LENGTH_HD);
+		m_thread = std::thread(&TrackAcquirer::run, this);
+	}
+	~TrackAcquirer() {
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_stop = true;
+			if (m_current) m_current->stopRequested = true;
+			m_changed.notify_all();
+		}
+		if (m_thread.joinable()) m_thread.join();
+	}
+
+	// Adds a surface to the end of the reading order
+	void queue(const unsigned int position) {
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_order.push_back(position);
+		m_changed.notify_all();
+	}
+
+	// Tell the reader which read is being decoded.  Any before it are thrown away
+	void setDecoderIndex(const unsigned int index) {
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_decoderIndex = index;
+		m_reads.erase(std::remove_if(m_reads.begin(), m_reads.end(), [index](const std::shared_ptr<RawRead>& raw) { return raw->index < index; }), m_reads.end());
+		m_changed.notify_all();
+	}
+
+	// Ask for the surface being decoded to be read again, optionally re-seeking to it first
+	void requestRetry(const bool reseek) {
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_retryRequested = true;
+		m_retryReseek = reseek;
+		m_changed.notify_all();
+	}
+
+	// Waits for the next read of the surface at index to start
+	std::shared_ptr<RawRead> take(const unsigned int index) {
+		std::unique_lock<std::mutex> lock(m_lock);
+		for (;;) {
+			for (auto it = m_reads.begin(); it != m_reads.end(); ++it)
+				if ((*it)->index == index) {
+					std::shared_ptr<RawRead> raw = std::move(*it);
+					m_reads.erase(it);
+					return raw;
+				}
+			m_changed.wait(lock);
+		}
+	}
+
+	// Waits until more than 'available' bytes of the read have arrived and updates it.  Returns FALSE once the read has finished and it's all been seen
+	bool waitForData(const RawRead& raw, unsigned int& available) {
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_changed.wait(lock, [&raw, available]() { return (raw.available > available) || (raw.finished); });
+		if (raw.available > available) {
+			available = raw.available;
+			return true;
+		}
+		return false;
+	}
+
+	// The decoder has everything it needs from this read
+	void stopRead(RawRead& raw) {
+		std::lock_guard<std::mutex> lock(m_lock);
+		raw.stopRequested = true;
+	}
+};
+
+// The standard AmigaDOS floppy layout.  The root block is in the middle of the disk, which is the start of cylinder 40
+#define AMIGADOS_NUM_CYLINDERS 80
+#define AMIGADOS_RESERVED_BLOCKS 2            // The bootblock.  The bitmap starts from the block after it
+#define AMIGADOS_T_HEADER 2                   // Root block type, the first long
+#define AMIGADOS_ST_ROOT 1                    // Root block secondary type, the last long
+#define AMIGADOS_ROOT_BM_FLAG 78              // Long in the root block that's -1 if the bitmap is valid
+#define AMIGADOS_ROOT_BM_PAGES 79             // Long in the root block where the 25 bitmap block pointers start
+#define AMIGADOS_ROOT_NUM_BM_PAGES 25
+#define AMIGADOS_BITMAP_LONGS 127             // Longs of bitmap in each bitmap block, after its checksum
+// How many reads a surface gets for sectors whose blocks the filesystem isn't using
+#define DISKTOADF_FREE_BLOCK_READS 2
+
+typedef std::bitset<NUM_SECTORS_PER_TRACK_HD> AmigaDOSSectorMask;
+
+// AmigaDOS blocks are made of big endian longs
+static uint32_t amigaDOSLong(const unsigned char* block, const unsigned int index) {
+	const unsigned char* value = block + (index * 4);
+	return ((uint32_t)value[0] << 24) | ((uint32_t)value[1] << 16) | ((uint32_t)value[2] << 8) | (uint32_t)value[3];
+}
+
+// The root and bitmap blocks are valid if all of their longs add up to zero
+static bool amigaDOSChecksumValid(const unsigned char* block) {
+	uint32_t sum = 0;
+	for (unsigned int index = 0; index < SECTOR_BYTES / 4; index++) sum += amigaDOSLong(block, index);
+	return sum == 0;
+}
+
+// Checks the bootblock and root block are AmigaDOS, and gets the blocks holding the bitmap.  Returns FALSE if there's no usable bitmap
+static bool amigaDOSFindBitmap(const unsigned char* bootBlock, const unsigned char* rootBlock, const unsigned int numBlocks, std::vector<uint32_t>& bitmapBlocks) {
+	bitmapBlocks.clear();
+	if ((bootBlock[0] != 'D') || (bootBlock[1] != 'O') || (bootBlock[2] != 'S')) return false;
+	if ((amigaDOSLong(rootBlock, 0) != AMIGADOS_T_HEADER) || (amigaDOSLong(rootBlock, (SECTOR_BYTES / 4) - 1) != AMIGADOS_ST_ROOT)) return false;
+	if (!amigaDOSChecksumValid(rootBlock)) return false;
+	if (amigaDOSLong(rootBlock, AMIGADOS_ROOT_BM_FLAG) != 0xFFFFFFFF) return false;
+
+	// Enough bitmap blocks to cover the disk, which on a floppy is always just one
+	const unsigned int bitsPerBlock = AMIGADOS_BITMAP_LONGS * 32;
+	const unsigned int pagesNeeded = ((numBlocks - AMIGADOS_RESERVED_BLOCKS) + bitsPerBlock - 1) / bitsPerBlock;
+	if (pagesNeeded > AMIGADOS_ROOT_NUM_BM_PAGES) return false;
+	for (unsigned int page = 0; page < pagesNeeded; page++) {
+		const uint32_t block = amigaDOSLong(rootBlock, AMIGADOS_ROOT_BM_PAGES + page);
+		if ((block < AMIGADOS_RESERVED_BLOCKS) || (block >= numBlocks)) return false;
+		bitmapBlocks.push_back(block);
+	}
+	return true;
+}
+
+// Clears the sectors in usedSectors that hold blocks the bitmap says are free.  Returns FALSE if the bitmap isn't valid
+static bool amigaDOSReadBitmap(const std::vector<const unsigned char*>& bitmap, const unsigned int numBlocks, const unsigned int sectorsPerTrack, std::vector<AmigaDOSSectorMask>& usedSectors) {
+	for (const unsigned char* block : bitmap)
+		if (!amigaDOSChecksumValid(block)) return false;
+
+	// A set bit means the block is free.  Bit 0 of the first long is the first block after the bootblock
+	const unsigned int bitsPerBlock = AMIGADOS_BITMAP_LONGS * 32;
+	for (unsigned int block = AMIGADOS_RESERVED_BLOCKS; block < numBlocks; block++) {
+		const unsigned int bit = block - AMIGADOS_RESERVED_BLOCKS;
+		if (bit / bitsPerBlock >= bitmap.size()) break;
+		const uint32_t bits = amigaDOSLong(bitmap[bit / bitsPerBlock], 1 + ((bit % bitsPerBlock) / 32));
+		if (bits & (1U << (bit & 31))) usedSectors[block / sectorsPerTrack].reset(block % sectorsPerTrack);
+	}
+	return true;
+}
+
 // Reads the disk and write the data to the ADF file supplied.  The callback is for progress, and you can returns FALSE to abort the process
-ADFResult ADFWriter::DiskToADF(const std::string& outputFile, const bool inHDMode, const unsigned int numTracks, std::function < WriteResponse(const int currentTrack, const DiskSurface currentSide, const int retryCounter, const int sectorsFound, const int badSectorsFound, const int maxSectors, const CallbackOperation operation)> callback) {
+ADFResult ADFWriter::DiskToADF(const std::string& outputFile, const bool inHDMode, const unsigned int numTracks, std::function < WriteResponse(const int currentTrack, const DiskSurface currentSide, const int retryCounter, const int sectorsFound, const int badSectorsFound, const int maxSectors, const CallbackOperation operation)> callback, bool useFilesystem, std::vector<unsigned int>* skippedBlocks) {
 	if (!m_device->isOpen()) {
 		return ADFResult::adfrDriveError;
 	}
@@ -2427,125 +2564,205 @@ ADFResult ADFWriter::DiskToADF(const std::string& outputFile, const bool inHDMod
 		return ADFResult::adfrFileError;
 	}
 
-	// To hold a raw track
-	RawTrackDataHD data;
 	DecodedTrack track;
 	bool includesBadSectors = false;
+	if (skippedBlocks) skippedBlocks->clear();
 
 	const unsigned int readSize = inHDMode ? sizeof(ArduinoFloppyReader::RawTrackDataHD) : sizeof(ArduinoFloppyReader::RawTrackDataDD);
 	const unsigned int maxSectorsPerTrack = inHDMode ? NUM_SECTORS_PER_TRACK_HD : NUM_SECTORS_PER_TRACK_DD;
+	const unsigned int trackSize = maxSectorsPerTrack * SECTOR_BYTES;
+	const unsigned int numPositions = numTracks * 2;
+
+	// Which sectors of each surface hold blocks the filesystem is using.  Until the bitmap has been read, that's all of them
+	AmigaDOSSectorMask allSectors;
+	for (unsigned int sector = 0; sector < maxSectorsPerTrack; sector++) allSectors.set(sector);
+	std::vector<AmigaDOSSectorMask> usedSectors(numPositions, allSectors);
+
+	// In filesystem mode the surfaces aren't read in order, so the image is put together in memory and saved at the end
+	const unsigned int rootPosition = AMIGADOS_NUM_CYLINDERS;
+	const bool selective = useFilesystem && (numTracks >= AMIGADOS_NUM_CYLINDERS);
+	std::vector<unsigned char> image;
+	std::vector<bool> surfaceQueued(numPositions, false);
+	std::vector<unsigned int> order;
+	if (selective) image.resize(numPositions * trackSize);
+
+	// The drive is handled by this from here on, and it reads ahead while we decode
+	TrackAcquirer acquirer(m_device, readSize);
+	auto queueSurface = [&acquirer, &order, &surfaceQueued](const unsigned int position) {
+		if (surfaceQueued[position]) return;
+		surfaceQueued[position] = true;
+		order.push_back(position);
+		acquirer.queue(position);
+	};
+
+	// The filesystem is worked out in stages as the surfaces it needs arrive.  First the bootblock and root block
+	enum class FilesystemStage { fsRoot, fsBitmap, fsDone };
+	FilesystemStage stage = selective ? FilesystemStage::fsRoot : FilesystemStage::fsDone;
+	std::vector<uint32_t> bitmapBlocks;
+	if (selective) {
+		queueSurface(0);
+		queueSurface(rootPosition);
+	}
+	else
+		for (unsigned int position = 0; position < numPositions; position++) queueSurface(position);
+
+	// Works out what to read next once everything queued so far has been decoded
+	auto planReads = [&]() {
+		const unsigned int numBlocks = AMIGADOS_NUM_CYLINDERS * 2 * maxSectorsPerTrack;
+		const unsigned char* rootBlock = &image[(numBlocks / 2) * SECTOR_BYTES];
+
+		if (stage == FilesystemStage::fsRoot) {
+			stage = FilesystemStage::fsDone;
+			if (!amigaDOSFindBitmap(image.data(), rootBlock, numBlocks, bitmapBlocks)) return;
+			// The bitmap is normally next to the root block, but it doesn't have to be
+			stage = FilesystemStage::fsBitmap;
+			for (const uint32_t block : bitmapBlocks) queueSurface(block / maxSectorsPerTrack);
+		}
+		else
+		if (stage == FilesystemStage::fsBitmap) {
+			stage = FilesystemStage::fsDone;
+			std::vector<const unsigned char*> bitmap;
+			for (const uint32_t block : bitmapBlocks) bitmap.push_back(&image[block * SECTOR_BYTES]);
+			if (!amigaDOSReadBitmap(bitmap, numBlocks, maxSectorsPerTrack, usedSectors)) usedSectors.assign(numPositions, allSectors);
+		}
+		if (stage != FilesystemStage::fsDone) return;
+
+		// Everything the filesystem uses first, then the rest
+		for (unsigned int position = 0; position < numPositions; position++)
+			if (usedSectors[position].any()) queueSurface(position);
+		for (unsigned int position = 0; position < numPositions; position++) queueSurface(position);
+	};
+
+	// Do all surfaces
+	for (unsigned int index = 0; index < order.size(); index++) {
+		const unsigned int position = order[index];
+		const unsigned int currentTrack = position / 2;
+		const DiskSurface surface = (position & 1) ? DiskSurface::dsUpper : DiskSurface::dsLower;
+		const AmigaDOSSectorMask& required = usedSectors[position];
+		acquirer.setDecoderIndex(index);
+
+		// Reset the sectors list
+		track.clear();
+
+		// Extract phase code
+		int failureTotal = 0;
+		unsigned int readsMade = 0;
+		bool ignoreChecksums = false;
+		bool firstRead = true;
 
-	// Do all tracks
-	for (unsigned int currentTrack = 0; currentTrack < numTracks; currentTrack++) {
-		// Select the track we're working on
-		if (m_device->selectTrack(currentTrack) != DiagnosticResponse::drOK) {
-			hADFFile.close();
-			return ADFResult::adfrCompletedWithErrors;
-		}
-
-		// Now select the side
-		for (unsigned int surfaceIndex = 0; surfaceIndex < 2; surfaceIndex++) {
-			// Surface 
-			const DiskSurface surface = (surfaceIndex == 1) ? DiskSurface::dsUpper : DiskSurface::dsLower;
-
-			// Change the surface we're looking at
-			if (m_device->selectSurface(surface) != DiagnosticResponse::drOK) {
-				hADFFile.close();
-				return ADFResult::adfrCompletedWithErrors;
-			}
-
-			// Reset the sectors list
-			for (unsigned int sector=0; sector< maxSectorsPerTrack; sector++)
-				track.invalidSectors[sector].clear();
-
-			track.validSectors.clear();
-
-			// Extract phase code
-			int failureTotal = 0;
-			bool ignoreChecksums = false;
-
-			// Repeat until we have all 11 sectors
-			while (track.validSectors.size() < maxSectorsPerTrack) {
-
-				if (callback) {
-					int total = 0;
-					for (unsigned int sector = 0; sector < maxSectorsPerTrack; sector++)
-						if (track.invalidSectors[sector].size()) total++;
-
-					if ((failureTotal%6)==5) {
-						// simulate what the Amiga kinda sounded like it was doing by re-seeking to the track.  This sometimes fixes it, weird eh, and sounds cool
-						if (currentTrack < 40) {
-							m_device->selectTrack(currentTrack+30, ArduinoFloppyReader::TrackSearchSpeed::tssSlow);
-						}
-						else {
-							m_device->selectTrack(currentTrack-30, ArduinoFloppyReader::TrackSearchSpeed::tssSlow);
-						}
-						m_device->selectTrack(currentTrack);
-					}
+		// Repeat until we have all 11 sectors, or at least the ones in use once the sectors of free blocks have had a few tries
+		while (track.numValid() < maxSectorsPerTrack) {
+			if (((track.validFound & required) == required) && (readsMade >= DISKTOADF_FREE_BLOCK_READS)) break;
+			bool reseek = false;
 
-					switch (callback(currentTrack, surface, failureTotal, track.validSectors.size(), total, maxSectorsPerTrack, failureTotal > 0 ? CallbackOperation::coRetryReading : CallbackOperation::coReading)) {
-						case WriteResponse::wrContinue: break;  // do nothing
-						case WriteResponse::wrRetry:    failureTotal = 0; break;
-						case WriteResponse::wrAbort:    hADFFile.close();
-														return ADFResult::adfrAborted;
-
-						case WriteResponse::wrSkipBadChecksums: 
-							if (ignoreChecksums) {
-								// Already been here, so we'll create blank sectors just to get this going
-								for (unsigned char sectornumber = 0; sectornumber <= maxSectorsPerTrack; sectornumber++) {
-									auto index = std::find_if(track.validSectors.begin(), track.validSectors.end(), [sectornumber](const DecodedSector& sector) -> bool {
-										return (sector.sectorNumber == sectornumber);
-									});
-									// Not found. Lets add it
-									if (index == track.validSectors.end()) {
-										DecodedSector sector;
-										memset(&sector, 0, sizeof(sector));
-										sector.sectorNumber = sectornumber;
-										track.validSectors.push_back(sector);
-									}
+			if (callback) {
+				const int total = track.numInvalid();
+
+				// The re-seek happens before the next read
+				if ((failureTotal%6)==5) reseek = true;
+
+				switch (callback(currentTrack, surface, failureTotal, track.numValid(), total, maxSectorsPerTrack, failureTotal > 0 ? CallbackOperation::coRetryReading : CallbackOperation::coReading)) {
+					case WriteResponse::wrContinue: break;  // do nothing
+					case WriteResponse::wrRetry:    failureTotal = 0; break;
+					case WriteResponse::wrAbort:    hADFFile.close();
+													return ADFResult::adfrAborted;
+
+					case WriteResponse::wrSkipBadChecksums: 
+						if (ignoreChecksums) {
+							// Already been here, so we'll create blank sectors just to get this going
+							for (unsigned char sectornumber = 0; sectornumber < maxSectorsPerTrack; sectornumber++) {
+								// Not found. Lets add it
+								if (!track.validFound[sectornumber]) {
+									DecodedSector& sector = track.validSectors[sectornumber];
+									memset(&sector, 0, sizeof(sector));
+									sector.sectorNumber = sectornumber;
+									track.setValid(sectornumber);
 								}
 							}
-							ignoreChecksums = true;
-							failureTotal = 0;
-							break;
-					}
+						}
+						ignoreChecksums = true;
+						failureTotal = 0;
+						break;
 				}
+			}
 
-				if (m_device->readCurrentTrack(data, readSize, false) == DiagnosticResponse::drOK) {
-					findSectors(data, inHDMode, currentTrack, surface, AMIGA_WORD_SYNC, track, ignoreChecksums);
-					failureTotal++;
+			// The first read was made while the previous surface was being decoded
+			if (!firstRead) acquirer.requestRetry(reseek);
+			firstRead = false;
+
+			// Decode it as it arrives, and stop the read once we have everything
+			std::shared_ptr<TrackAcquirer::RawRead> raw = acquirer.take(index);
+			StreamingSectorFinder finder(raw->data.data(), inHDMode, currentTrack, surface, track, ignoreChecksums);
+			unsigned int available = 0;
+			bool complete = false;
+			while ((!complete) && (acquirer.waitForData(*raw, available))) {
+				if (raw->kind == TrackAcquirer::ReadKind::rkTrack)
+					findSectors(raw->data.data(), inHDMode, currentTrack, surface, AMIGA_WORD_SYNC, track, ignoreChecksums);
+				else
+					finder.update(available);
+				if (track.numValid() >= maxSectorsPerTrack) {
+					acquirer.stopRead(*raw);
+					complete = true;
 				}
-				else {
+			}
+
+			switch (complete ? TrackAcquirer::ReadStatus::rsOK : raw->status) {
+				case TrackAcquirer::ReadStatus::rsOK:
+					failureTotal++;
+					readsMade++;
+					break;
+
+				case TrackAcquirer::ReadStatus::rsSeekError:
+					hADFFile.close();
+					return ADFResult::adfrCompletedWithErrors;
+
+				default:
 					hADFFile.close();
 					return ADFResult::adfrDriveError;
-				}
+			}
 
-				// If the user wants to skip invalid sectors and save them
-				if (ignoreChecksums) {
-					for (unsigned int sector = 0; sector < maxSectorsPerTrack; sector++)
-						if (track.invalidSectors[sector].size()) {
-							includesBadSectors = true;
-							break;
-						}
-					mergeInvalidSectors(track, inHDMode);
-				}
+			// If the user wants to skip invalid sectors and save them
+			if (ignoreChecksums) {
+				if (track.numInvalid()) includesBadSectors = true;
+				mergeInvalidSectors(track, inHDMode);
 			}
+		}
 
-			// Sort the sectors in order
-			std::sort(track.validSectors.begin(), track.validSectors.end(), [](const DecodedSector & a, const DecodedSector & b) -> bool {
-				return a.sectorNumber < b.sectorNumber;
-			});
+		// Anything still missing is in a block the filesystem isn't using, so it's left blank
+		for (unsigned int sectorNumber = 0; sectorNumber < maxSectorsPerTrack; sectorNumber++)
+			if (!track.validFound[sectorNumber]) {
+				DecodedSector& sector = track.validSectors[sectorNumber];
+				memset(&sector, 0, sizeof(sector));
+				sector.sectorNumber = sectorNumber;
+				track.setValid(sectorNumber);
+				if (skippedBlocks) skippedBlocks->push_back((position * maxSectorsPerTrack) + sectorNumber);
+			}
 
-			// Now write all of them to disk
-			for (unsigned int sector = 0; sector < maxSectorsPerTrack; sector++) {
-				try {
-					hADFFile.write((const char*)track.validSectors[sector].data, 512);
-				}
-				catch (...) {
-					hADFFile.close();
-					return ADFResult::adfrFileIOError;
-				}
+		// Now write all of them to disk, the slots are already in order
+		for (unsigned int sector = 0; sector < maxSectorsPerTrack; sector++) {
+			if (selective) {
+				memcpy(&image[(position * trackSize) + (sector * SECTOR_BYTES)], track.validSectors[sector].data, SECTOR_BYTES);
+				continue;
+			}
+			try {
+				hADFFile.write((const char*)track.validSectors[sector].data, 512);
 			}
+			catch (...) {
+				hADFFile.close();
+				return ADFResult::adfrFileIOError;
+			}
+		}
+
+		while ((stage != FilesystemStage::fsDone) && (index + 1 == order.size())) planReads();
+	}
+
+	if (selective) {
+		try {
+			hADFFile.write((const char*)image.data(), image.size());
+		}
+		catch (...) {
+			hADFFile.close();
+			return ADFResult::adfrFileIOError;
 		}
 	}
 
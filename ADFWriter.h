@@ -35,6 +35,7 @@
 
 #pragma once
 #include <functional>
+#include <vector>
 
 #include "RotationExtractor.h"
 #include "ArduinoInterface.h"
@@ -124,7 +125,9 @@ namespace ArduinoFloppyReader {
 
 		// Reads the disk and write the data to the ADF file supplied.  The callback is for progress, and you can returns FALSE to abort the process
 		// numTracks is the number of tracks to read.  Usually 80 (0..79), sometimes track 80 and 81 are needed
-		ADFResult DiskToADF(const std::string& outputFile, const bool inHDMode, const unsigned int numTracks, std::function < WriteResponse(const int currentTrack, const DiskSurface currentSide, const int retryCounter, const int sectorsFound, const int badSectorsFound, const int maxSectors, const CallbackOperation operation)> callback);
+		// If useFilesystem is set and the disk is AmigaDOS, the bootblock, root block and bitmap are read first, then the tracks the filesystem is using.  Sectors
+		// of blocks the bitmap says are free only get a couple of reads, and any that can't be read are left blank and listed in skippedBlocks
+		ADFResult DiskToADF(const std::string& outputFile, const bool inHDMode, const unsigned int numTracks, std::function < WriteResponse(const int currentTrack, const DiskSurface currentSide, const int retryCounter, const int sectorsFound, const int badSectorsFound, const int maxSectors, const CallbackOperation operation)> callback, bool useFilesystem = false, std::vector<unsigned int>* skippedBlocks = nullptr);
 
 		// Reads the disk and write the data to the SCP file supplied.  The callback is for progress, and you can returns FALSE to abort the process
 		// numTracks is the number of tracks to read.  Usually 80 (0..79), sometimes track 80 and 81 are needed. revolutions is hwo many revolutions of the disk to save (1-5)
@@ -132,7 +135,8 @@ namespace ArduinoFloppyReader {
 		ADFResult DiskToSCP(const std::string& outputFile, bool isHDMode, const unsigned int numTracks, const unsigned char revolutions, std::function < WriteResponse(const int currentTrack, const DiskSurface currentSide, const int retryCounter, const int sectorsFound, const int badSectorsFound, const int maxSectors, const CallbackOperation operation)> callback, bool useNewFluxReader = false);
 
 		// Writes an ADF file back to a floppy disk.  Return FALSE in the callback to abort this operation.  If verify is set then the track isread back and and sector checksums are checked for 11 valid sectors
-		ADFResult ADFToDisk(const std::string& inputFile, const bool inHDMode, bool verify, bool usePrecompMode, bool eraseFirst, bool writeFromIndex, std::function < WriteResponse(const int currentTrack, const DiskSurface currentSide, const bool isVerifyError, const CallbackOperation operation) > callback);
+		// If onlyChangedTracks is set each track is read first, and only written if its sectors don't already match the ADF.  The number of tracks (surfaces) that didn't need writing is stored in tracksSkipped
+		ADFResult ADFToDisk(const std::string& inputFile, const bool inHDMode, bool verify, bool usePrecompMode, bool eraseFirst, bool writeFromIndex, std::function < WriteResponse(const int currentTrack, const DiskSurface currentSide, const bool isVerifyError, const CallbackOperation operation) > callback, bool onlyChangedTracks = false, unsigned int* tracksSkipped = nullptr);
 
 		// Writes an IMG, IMA or ST file to disk. Return FALSE in the callback to abort this operation.  If verify is set then the track isread back and and sector checksums are checked for 11 valid sectors
 		ADFResult sectorFileToDisk(const std::string& inputFile, const bool inHDMode, bool verify, bool usePrecompMode, bool eraseFirst, bool useAtariSTTiming, std::function < WriteResponse(const int currentTrack, const DiskSurface currentSide, const bool isVerifyError, const CallbackOperation operation) > callback);
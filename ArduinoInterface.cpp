@@ -40,6 +40,8 @@
 #include <string.h>
 #include <iostream>
 #include <unistd.h>
+#include "ring_buffer.h"
+#include "stream_decoder.h"
 
 using namespace ArduinoFloppyReader;
 
@@ -82,6 +84,73 @@ using namespace ArduinoFloppyReader;
 
 #define SPECIAL_ABORT_CHAR 'x'
 
+#if !defined(_WIN32) && !defined(__amigaos4__)
+#define USE_THREADDED_READER
+#endif
+
+#ifdef USE_THREADDED_READER
+// Size of the ring buffer between the USB reader thread and the decoder.  About 2 seconds of HD flux data
+#define STREAM_RING_SIZE (1024 * 1024)
+// How long the decoder waits for data before counting it as a failed read
+#define STREAM_WAIT_MS 20
+// Size of each USB read while streaming
+#define STREAM_CHUNK_SIZE 4096
+
+// While streaming the port feeds a ring buffer from a background thread.  The decoder blocks on the ring until data arrives
+// so neither side has to poll with a sleep.  Streaming runs until stop() is called (or this is destroyed)
+class BackgroundStreamReader {
+private:
+	SerialIO* m_port;
+	SPSCRingBuffer m_ring;
+	bool m_streaming;
+	std::atomic<bool> m_running;
+	std::thread m_thread;
+
+	// Fallback for ports that can't stream by themselves
+	void run() {
+		unsigned char buffer[1024];  // the LINUX serial buffer is only 512 bytes anyway
+		while (m_running) {
+			const unsigned int waiting = m_port->justRead(buffer, sizeof(buffer));
+			unsigned int written = 0;
+			while (written < waiting) {
+				const unsigned int added = m_ring.write(buffer + written, waiting - written);
+				written += added;
+				// Ring is full, let the decoder catch up
+				if (!added) {
+					if (!m_running) break;
+					std::this_thread::yield();
+				}
+			}
+			if (!waiting) std::this_thread::yield();
+		}
+		m_ring.close();
+	}
+
+public:
+	BackgroundStreamReader(SerialIO* port) : m_port(port), m_ring(STREAM_RING_SIZE), m_running(true) {
+		m_streaming = m_port->startReadStream(m_ring, STREAM_CHUNK_SIZE);
+		if (!m_streaming) m_thread = std::thread(&BackgroundStreamReader::run, this);
+	}
+	~BackgroundStreamReader() { stop(); }
+
+	// Stops reading.  Anything still in the ring can still be read
+	void stop() {
+		if (m_streaming) {
+			m_port->stopReadStream();
+			m_streaming = false;
+		}
+		m_running = false;
+		if (m_thread.joinable()) m_thread.join();
+	}
+
+	// Waits up to STREAM_WAIT_MS for data and then reads whatever is available up to dataLength bytes
+	unsigned int read(void* data, const unsigned int dataLength) {
+		if (!m_ring.waitForData(STREAM_WAIT_MS)) return 0;
+		return m_ring.read(data, dataLength);
+	}
+};
+#endif
+
 // Convert the last executed command that had an error to a string
 std::string lastCommandToName(LastCommand cmd)
 {
@@ -1235,7 +1304,11 @@ DiagnosticResponse ArduinoInterface::readCurrentTrack(void *trackData, const int
 		int readFail = 0;
 
 		// Buffer to read into
+#ifdef USE_THREADDED_READER
+		unsigned char tempReadBuffer[2048] = {0};
+#else
 		unsigned char tempReadBuffer[64] = {0};
+#endif
 
 		// Sliding window for abort
 		char slidingWindow[5] = {0, 0, 0, 0, 0};
@@ -1248,17 +1321,24 @@ DiagnosticResponse ArduinoInterface::readCurrentTrack(void *trackData, const int
 
 		// We know what this is, but the A
 		applyCommTimeouts(true);
+#ifdef USE_THREADDED_READER
+		BackgroundStreamReader backgroundReader(m_comPort);
+#endif
 
 		while (m_isStreaming)
 		{
 
 			// More efficient to read several bytes in one go
+#ifdef USE_THREADDED_READER
+			unsigned long bytesRead = backgroundReader.read(tempReadBuffer, sizeof tempReadBuffer);
+#else
 			unsigned long bytesAvailable = m_comPort->getBytesWaiting();
 			if (bytesAvailable < 1)
 				bytesAvailable = 1;
 			if (bytesAvailable > sizeof tempReadBuffer)
 				bytesAvailable = sizeof tempReadBuffer;
 			unsigned long bytesRead = m_comPort->read(tempReadBuffer, m_abortSignalled ? 1 : bytesAvailable);
+#endif
 			for (size_t a = 0; a < bytesRead; a++)
 			{
 				if (m_abortSignalled)
@@ -1273,6 +1353,9 @@ DiagnosticResponse ArduinoInterface::readCurrentTrack(void *trackData, const int
 					if (slidingWindow[0] == 'X' && slidingWindow[1] == 'Y' && slidingWindow[2] == 'Z' && slidingWindow[3] == SPECIAL_ABORT_CHAR && slidingWindow[4] == '1')
 					{
 						m_isStreaming = false;
+#ifdef USE_THREADDED_READER
+						backgroundReader.stop();
+#endif
 						m_comPort->purgeBuffers();
 						m_lastError = timeout ? DiagnosticResponse::drNoDiskInDrive : DiagnosticResponse::drOK;
 						applyCommTimeouts(false);
@@ -1313,14 +1396,19 @@ DiagnosticResponse ArduinoInterface::readCurrentTrack(void *trackData, const int
 					abortReadStreaming();
 					m_lastError = DiagnosticResponse::drReadResponseFailed;
 					m_isStreaming = false;
+#ifdef USE_THREADDED_READER
+					backgroundReader.stop();
+#endif
 					free(tmp);
 					applyCommTimeouts(false);
 					// Force a check for disk
 					checkForDisk(true);
 					return m_lastError;
 				}
+#ifndef USE_THREADDED_READER
 				else
 					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
 			}
 		}
 	}
@@ -1383,65 +1471,17 @@ DiagnosticResponse ArduinoInterface::readCurrentTrack(void *trackData, const int
 	return m_lastError;
 }
 
-#if !defined(_WIN32) && !defined(__amigaos4__)
-#define USE_THREADDED_READER
-#endif
-
-// Reads a complete rotation of the disk, and returns it using the callback function which can return FALSE to stop
-// An instance of RotationExtractor is required.  This is purely to save on re-allocations.  It is internally reset each time
-DiagnosticResponse ArduinoInterface::readRotation(MFMExtractionTarget& extractor, const unsigned int maxOutputSize, RotationExtractor::MFMSample* firstOutputBuffer, RotationExtractor::IndexSequenceMarker& startBitPatterns, std::function<bool(RotationExtractor::MFMSample** mfmData, const unsigned int dataLengthInBits)> onRotation, bool useHalfPLL) {
-	m_lastCommand = LastCommand::lcReadTrackStream;
-
-	if (m_version.major == 1 && m_version.minor < 8) {
-		m_lastError = DiagnosticResponse::drOldFirmware;
-		return m_lastError;
-	}
-
-	// Who would do this, right?
-	if (maxOutputSize < 1 || !firstOutputBuffer) {
-		m_lastError = DiagnosticResponse::drError;
-		return m_lastError;
-	}
-
-	const bool highPrecisionMode = !m_isHDMode && m_version.deviceFlags1 & FLAGS_HIGH_PRECISION_SUPPORT;
-	char mode = highPrecisionMode ? COMMAND_READTRACKSTREAM_HIGHPRECISION : COMMAND_READTRACKSTREAM;
-
-	if (mode == COMMAND_READTRACKSTREAM_HIGHPRECISION && m_version.deviceFlags1 & FLAGS_FLUX_READ && useHalfPLL) mode = COMMAND_READTRACKSTREAM_HALFPLL;
-
-	
-	m_lastError = runCommand(mode);
-
-	if (m_lastError != DiagnosticResponse::drOK) return m_lastError;
-
+// Receives the data from a streaming read command that has just been started, passing each block to onData as it arrives, until abortReadStreaming()
+// has been called and the board has confirmed it's stopped.  Returns drOK then, or drReadResponseFailed if the data stops arriving
+DiagnosticResponse ArduinoInterface::receiveStream(std::function<void(const unsigned char* data, const unsigned int length)> onData) {
 	m_isStreaming = true;
 
-
 #ifdef USE_THREADDED_READER
-	std::mutex safetyLock;
-	// I was using a deque, but its much faster to just keep switching between two vectors
-	std::vector<unsigned char> readBuffer;
-	readBuffer.reserve(4096);
-	std::vector<unsigned char> tempReadBuffer;
-	tempReadBuffer.reserve(4096);
 #ifdef _WIN32
 	m_comPort->setReadTimeouts(100, 0);  // match linux
 #endif
-	std::thread* backgroundReader = new std::thread([this, &readBuffer, &safetyLock]() {
-#ifdef _WIN32
-		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
-#endif
-		unsigned char buffer[1024];  // the LINUX serial buffer is only 512 bytes anyway
-		while (m_isStreaming) {
-			uint32_t waiting = m_comPort->justRead(buffer, 1024);
-			if (waiting>0) {
-				safetyLock.lock();				
-				readBuffer.insert(readBuffer.end(), buffer, buffer+waiting);
-				safetyLock.unlock();
-			} else
-				std::this_thread::sleep_for(std::chrono::microseconds(200));
-		}
-	});
-
+	BackgroundStreamReader backgroundReader(m_comPort);
+	unsigned char tempReadBuffer[4096];
 
 #else
 	applyCommTimeouts(true);
@@ -1455,200 +1495,59 @@ DiagnosticResponse ArduinoInterface::readRotation(MFMExtractionTarget& extractor
 	// Number of times we failed to read anything
 	int32_t readFail = 0;
 
-	// Reset ready for extraction
-	extractor.reset(m_isHDMode);
-
-	// Remind it if the 'index' data we want to sync to
-	extractor.setIndexSequence(startBitPatterns);
-
 	// Sliding window for abort
 	char slidingWindow[5] = { 0,0,0,0,0 };
-	bool timeout = false;
-	bool dataState = false;
-	bool isFirstByte = true;
-	unsigned char mfmSequences = 0;
 
 	for (;;) {
 
 		// More efficient to read several bytes in one go		
 #ifdef USE_THREADDED_READER
-		tempReadBuffer.resize(0); // should be just as fast as clear, but just in case
-		safetyLock.lock();
-		std::swap(tempReadBuffer, readBuffer);
-		safetyLock.unlock();
-
-		unsigned int bytesRead = tempReadBuffer.size();
-		
-		if (bytesRead < 1) std::this_thread::sleep_for(std::chrono::milliseconds(20)); 
-		for (const unsigned char byteRead : tempReadBuffer) {
+		const unsigned int bytesRead = backgroundReader.read(tempReadBuffer, sizeof tempReadBuffer);
 #else
 		unsigned int bytesAvailable = m_comPort->getBytesWaiting();
 		if (bytesAvailable < 1) bytesAvailable = 1;
 		if (bytesAvailable > sizeof tempReadBuffer) bytesAvailable = sizeof tempReadBuffer;
 		unsigned int bytesRead = m_comPort->read(tempReadBuffer, m_abortSignalled ? 1 : bytesAvailable);
-		for (size_t a = 0; a < bytesRead; a++) {
-			const unsigned char byteRead = tempReadBuffer[a];
 #endif
-			if (m_abortSignalled) {
+		if (m_abortSignalled) {
+			for (unsigned int a = 0; a < bytesRead; a++) {
 				// Make space
 				for (int s = 0; s < 4; s++) slidingWindow[s] = slidingWindow[s + 1];
 				// Append the new byte
-				slidingWindow[4] = byteRead;
+				slidingWindow[4] = tempReadBuffer[a];
 
 				// Watch the sliding window for the pattern we need
 				if (slidingWindow[0] == 'X' && slidingWindow[1] == 'Y' && slidingWindow[2] == 'Z' && slidingWindow[3] == SPECIAL_ABORT_CHAR && slidingWindow[4] == '1') {
 					m_isStreaming = false;
 #ifdef USE_THREADDED_READER
-					if (backgroundReader) {
-						if (backgroundReader->joinable()) backgroundReader->join();
-						delete backgroundReader;
-					}
+					backgroundReader.stop();
 #endif
 					m_comPort->purgeBuffers();
-					m_lastError = timeout ? DiagnosticResponse::drError : DiagnosticResponse::drOK;
 					applyCommTimeouts(false);
-					return m_lastError;
-				}
-			}
-			else {
-				unsigned char tmp;
-				RotationExtractor::MFMSequenceInfo sequence{};
-				if (m_isHDMode) {
-					for (int i = 6; i >= 0; i -= 2) {
-						tmp = byteRead >> i & 0x03;
-						sequence.mfm = (RotationExtractor::MFMSequence)((tmp == 0x03 ? 0 : tmp)+1);
-						sequence.timeNS = 2000 + (unsigned int)sequence.mfm * 2000;
-						extractor.submitSequence(sequence, tmp == 0x03);
-					}
-				}
-				else {
-					if (highPrecisionMode) {
-						if (isFirstByte) {
-							// Throw away the first byte
-							isFirstByte = false;
-							if (byteRead != 0xC3) {
-								// This should never happen.
-								abortReadStreaming();
-							}
-						}
-						else {
-							if (dataState) {
-
-								if (mode == COMMAND_READTRACKSTREAM_HALFPLL) {
-									const int32_t sequences[4] = { (mfmSequences >> 6) & 0x03, (mfmSequences >> 4) & 0x03, (mfmSequences >> 2) & 0x03, mfmSequences & 0x03 };
-
-									// First remove any flux time that us 000 as thats always fixed
-									int32_t readSpeed = (unsigned int)(byteRead & 0x7F) * 2000 / 128;
-
-									// Output the fluxes
-									for (int a = 0; a < 4; a++) {
-										if (sequences[a] == 0) {
-											sequence.mfm = RotationExtractor::MFMSequence::mfm000;
-											sequence.timeNS = 5000 + readSpeed;
-										}
-										else {
-											sequence.mfm = (RotationExtractor::MFMSequence)sequences[a];
-											sequence.timeNS = 1000 + readSpeed + (((int)sequence.mfm) * 2000);
-										}
-										sequence.pllTimeNS = sequence.timeNS;
-										extractor.submitSequence(sequence, ((byteRead & 0x80) != 0) && (a==0));
-									}
-
-								}
-								else {
-									int32_t readSpeed = (unsigned int)(byteRead & 0x7F) * 2000 / 128;
-									tmp = mfmSequences >> 6 & 0x03;
-									sequence.mfm = tmp == 0 ? RotationExtractor::MFMSequence::mfm000 : (RotationExtractor::MFMSequence)(tmp);
-									sequence.timeNS = 1000 + (unsigned int)sequence.mfm * 2000 + (sequence.mfm == RotationExtractor::MFMSequence::mfm000 ? -2000 : readSpeed);
-									extractor.submitSequence(sequence, (byteRead & 0x80) != 0);
-
-									tmp = mfmSequences >> 4 & 0x03;
-									sequence.mfm = tmp == 0 ? RotationExtractor::MFMSequence::mfm000 : (RotationExtractor::MFMSequence)(tmp);
-									sequence.timeNS = 1000 + (unsigned int)sequence.mfm * 2000 + (sequence.mfm == RotationExtractor::MFMSequence::mfm000 ? -2000 : readSpeed);
-									extractor.submitSequence(sequence, false);
-
-									tmp = mfmSequences >> 2 & 0x03;
-									sequence.mfm = tmp == 0 ? RotationExtractor::MFMSequence::mfm000 : (RotationExtractor::MFMSequence)(tmp);
-									sequence.timeNS = 1000 + (unsigned int)sequence.mfm * 2000 + (sequence.mfm == RotationExtractor::MFMSequence::mfm000 ? -2000 : readSpeed);
-									extractor.submitSequence(sequence, false);
-
-									tmp = mfmSequences & 0x03;
-									sequence.mfm = tmp == 0 ? RotationExtractor::MFMSequence::mfm000 : (RotationExtractor::MFMSequence)(tmp);
-									sequence.timeNS = 1000 + (unsigned int)sequence.mfm * 2000 + (sequence.mfm == RotationExtractor::MFMSequence::mfm000 ? -2000 : readSpeed);
-									extractor.submitSequence(sequence, false);
-								}
-
-								dataState = false;
-							}
-							else {
-								// in 'false' mode we get the flux data
-								dataState = true;
-								mfmSequences = byteRead;
-							}
-						}
-					}
-					else {
-						unsigned short readSpeed = (unsigned long long)((unsigned int)((byteRead & 0x07) * 16) * 2000) / 128;
-
-						// Now packet up the data in the format the rotation extractor expects it to be in
-						tmp = byteRead >> 5 & 0x03;
-						sequence.mfm = tmp == 0 ? RotationExtractor::MFMSequence::mfm000 : (RotationExtractor::MFMSequence)(tmp);
-						sequence.timeNS = 1000 + (unsigned int)sequence.mfm * 2000 + readSpeed;
-
-						extractor.submitSequence(sequence, (byteRead & 0x80) != 0);
-
-						tmp = byteRead >> 3 & 0x03;
-						sequence.mfm = tmp == 0 ? RotationExtractor::MFMSequence::mfm000 : (RotationExtractor::MFMSequence)(tmp);
-						sequence.timeNS = 1000 + (unsigned int)sequence.mfm * 2000 + readSpeed;
-
-						extractor.submitSequence(sequence, false);
-					}
-				}
-
-
-				// Is it ready to extract?
-				if (extractor.canExtract()) {
-					unsigned int bits = 0;
-					// Go!
-					if (extractor.extractRotation(firstOutputBuffer, bits, maxOutputSize)) {
-						m_diskInDrive = true;
-
-						if (!onRotation(&firstOutputBuffer, bits)) {
-							// And if the callback says so we stop.
-							abortReadStreaming();
-						}
-						// Always save this back
-						extractor.getIndexSequence(startBitPatterns);
-					}
-				}
-				else {
-					if (extractor.totalTimeReceived() > (m_isHDMode ? 1200000000U : 600000000U)) {
-						// No data, stop
-						abortReadStreaming();
-						timeout = true;
-					}
+					return DiagnosticResponse::drOK;
 				}
 			}
 		}
+		else
+			if (bytesRead) onData(tempReadBuffer, bytesRead);
+
 		if (bytesRead < 1) {
 			readFail++;
 			if (readFail > 30) {
 				m_abortStreaming = false; // force the 'abort' command to be sent
 				abortReadStreaming();
-				m_lastError = DiagnosticResponse::drReadResponseFailed;
 				m_isStreaming = false;
 #ifdef USE_THREADDED_READER
-				if (backgroundReader) {
-					if (backgroundReader->joinable()) backgroundReader->join();
-					delete backgroundReader;
-				}
+				backgroundReader.stop();
 #endif
 				applyCommTimeouts(false);
-				return m_lastError;
+				return DiagnosticResponse::drReadResponseFailed;
 			}
+#ifndef USE_THREADDED_READER
 			else {
 				std::this_thread::sleep_for(std::chrono::milliseconds(1));
 			}
+#endif
 		}
 		else {
 			readFail = 0;
@@ -1656,15 +1555,131 @@ DiagnosticResponse ArduinoInterface::readRotation(MFMExtractionTarget& extractor
 	}
 }
 
-// This is experiment and as such is not currently in use
-#define MAX_FLUX_SIGNAL 31
+// Reads a complete rotation of the disk, and returns it using the callback function which can return FALSE to stop
+// An instance of RotationExtractor is required.  This is purely to save on re-allocations.  It is internally reset each time
+DiagnosticResponse ArduinoInterface::readRotation(MFMExtractionTarget& extractor, const unsigned int maxOutputSize, RotationExtractor::MFMSample* firstOutputBuffer, RotationExtractor::IndexSequenceMarker& startBitPatterns, std::function<bool(RotationExtractor::MFMSample** mfmData, const unsigned int dataLengthInBits)> onRotation, bool useHalfPLL) {
+	m_lastCommand = LastCommand::lcReadTrackStream;
+
+	if (m_version.major == 1 && m_version.minor < 8) {
+		m_lastError = DiagnosticResponse::drOldFirmware;
+		return m_lastError;
+	}
+
+	// Who would do this, right?
+	if (maxOutputSize < 1 || !firstOutputBuffer) {
+		m_lastError = DiagnosticResponse::drError;
+		return m_lastError;
+	}
+
+	const bool highPrecisionMode = !m_isHDMode && m_version.deviceFlags1 & FLAGS_HIGH_PRECISION_SUPPORT;
+	char mode = highPrecisionMode ? COMMAND_READTRACKSTREAM_HIGHPRECISION : COMMAND_READTRACKSTREAM;
+
+	if (mode == COMMAND_READTRACKSTREAM_HIGHPRECISION && m_version.deviceFlags1 & FLAGS_FLUX_READ && useHalfPLL) mode = COMMAND_READTRACKSTREAM_HALFPLL;
+
+	
+	m_lastError = runCommand(mode);
+
+	if (m_lastError != DiagnosticResponse::drOK) return m_lastError;
+
+	// Reset ready for extraction
+	extractor.reset(m_isHDMode);
+
+	// Remind it if the 'index' data we want to sync to
+	extractor.setIndexSequence(startBitPatterns);
+
+	// Decodes the stream, which depends on the command used
+	StreamDecoder decoder;
+	decoder.reset(m_isHDMode ? StreamDecoder::StreamFormat::sfHD : (mode == COMMAND_READTRACKSTREAM_HALFPLL) ? StreamDecoder::StreamFormat::sfHalfPLL : highPrecisionMode ? StreamDecoder::StreamFormat::sfHighPrecision : StreamDecoder::StreamFormat::sfDD);
+
+	bool timeout = false;
+	bool isFirstByte = highPrecisionMode;
+
+	m_lastError = receiveStream([this, &extractor, &decoder, &timeout, &isFirstByte, &firstOutputBuffer, maxOutputSize, &startBitPatterns, &onRotation](const unsigned char* data, unsigned int length) {
+		if (isFirstByte) {
+			// Throw away the first byte
+			isFirstByte = false;
+			if (data[0] != 0xC3) {
+				// This should never happen.
+				abortReadStreaming();
+				return;
+			}
+			data++;
+			length--;
+		}
+
+		// Decode what was read and pass it on in one go
+		decoder.decode(data, length, extractor);
+
+		// Is it ready to extract?
+		if (extractor.canExtract()) {
+			unsigned int bits = 0;
+			// Go!
+			if (extractor.extractRotation(firstOutputBuffer, bits, maxOutputSize)) {
+				m_diskInDrive = true;
+
+				if (!onRotation(&firstOutputBuffer, bits)) {
+					// And if the callback says so we stop.
+					abortReadStreaming();
+				}
+				// Always save this back
+				extractor.getIndexSequence(startBitPatterns);
+			}
+		}
+		else {
+			if (extractor.totalTimeReceived() > (m_isHDMode ? 1200000000U : 600000000U)) {
+				// No data, stop
+				abortReadStreaming();
+				timeout = true;
+			}
+		}
+	});
+
+	if ((m_lastError == DiagnosticResponse::drOK) && (timeout)) m_lastError = DiagnosticResponse::drError;
+	return m_lastError;
+}
+
+// Streams RAW MFM data from the current track into mfmData, calling onData as it arrives so the caller can stop as soon as it has what it needs
+DiagnosticResponse ArduinoInterface::streamCurrentTrack(unsigned char* mfmData, const unsigned int maxLength, std::function<bool(const unsigned int bytesAvailable)> onData) {
+	m_lastCommand = LastCommand::lcReadTrackStream;
 
-// RAW Counter Values
-#define MIN_FLUX_ALLOWED 48										// in 62.5 time
-#define MAX_FLUX_ALLOWED (MIN_FLUX_ALLOWED + 61)				// in 62.5 time - comes out as '30'
-#define MAX_FLUX_REPEAT (MAX_FLUX_ALLOWED - 7)					// in 62.5 time - comes out as '26'
-#define FLUX_REPEAT_OFFSET (MAX_FLUX_REPEAT - MIN_FLUX_ALLOWED) // The amount MAX_FLUX_SIGNAL represents in clock ticks, which is 3625ns
+	if (m_version.major == 1 && m_version.minor < 8) {
+		m_lastError = DiagnosticResponse::drOldFirmware;
+		return m_lastError;
+	}
 
+	if (maxLength < 1 || !mfmData) {
+		m_lastError = DiagnosticResponse::drError;
+		return m_lastError;
+	}
+
+	m_lastError = runCommand(COMMAND_READTRACKSTREAM);
+	if (m_lastError != DiagnosticResponse::drOK) return m_lastError;
+
+	// The stream is decoded straight into the buffer as raw MFM
+	LinearExtractor extractor;
+	extractor.setOutputBuffer(mfmData, maxLength);
+	StreamDecoder decoder;
+	decoder.reset(m_isHDMode ? StreamDecoder::StreamFormat::sfHD : StreamDecoder::StreamFormat::sfDD);
+	bool reportedFull = false;
+
+	m_lastError = receiveStream([this, &extractor, &decoder, &reportedFull, &onData, maxLength](const unsigned char* data, const unsigned int length) {
+		if (reportedFull) return;
+		decoder.decode(data, length, extractor);
+
+		// Let the caller see what's arrived
+		if (extractor.canExtract()) {
+			// That's all there's room for
+			abortReadStreaming();
+			onData(maxLength);
+			reportedFull = true;
+		}
+		else
+			if (!onData(extractor.bytesWritten())) abortReadStreaming();
+	});
+	return m_lastError;
+}
+
+// This is experiment and as such is not currently in use
 // Reads a complete rotation of the disk, and returns it using the callback function which can return FALSE to stop
 // An instance of PLL is required.  This is purely to save on re-allocations.  It is internally reset each time
 DiagnosticResponse ArduinoInterface::readFlux(PLL::BridgePLL& pll, const unsigned int maxOutputSize, RotationExtractor::MFMSample* firstOutputBuffer, RotationExtractor::IndexSequenceMarker& startBitPatterns, std::function<bool(RotationExtractor::MFMSample** mfmData, const unsigned int dataLengthInBits)> onRotation) {
@@ -1684,130 +1699,43 @@ DiagnosticResponse ArduinoInterface::readFlux(PLL::BridgePLL& pll, const unsigne
 	m_lastError = runCommand(COMMAND_READTRACKSTREAM_FLUX);
 	if (m_lastError != DiagnosticResponse::drOK)
 		return m_lastError;
-	
-	// Let the class know we're doing some streaming stuff
-	m_isStreaming = true;
-	m_abortStreaming = false;
-	m_abortSignalled = false;
-
-	// Number of times we failed to read anything
-	int readFail = 0;
-
-	// Buffer to read into
-	unsigned char tempReadBuffer[2048] = { 0 };
 
-	// Sliding window for abort
-	char slidingWindow[5] = { 0,0,0,0,0 };
 	bool timeout = false;
-	bool dataState = false;
-	bool indexDetected = false;
-	unsigned char byte1 = 0;
-	applyCommTimeouts(true);
-
-	uint32_t fluxSoFar = 0;
+	StreamDecoder decoder;
+	decoder.reset(StreamDecoder::StreamFormat::sfDD);
 
 	pll.prepareExtractor(false, startBitPatterns);
 
-	for (;;) {
-
-		// More efficient to read several bytes in one go		
-		unsigned long bytesAvailable, bytesRead = 0;		
-		bytesAvailable = m_comPort->getBytesWaiting();
-		if (bytesAvailable < 1) bytesAvailable = 1;
-		if (bytesAvailable > sizeof tempReadBuffer) bytesAvailable = sizeof tempReadBuffer;
-		bytesRead = m_comPort->read(tempReadBuffer, m_abortSignalled ? 1 : bytesAvailable);
-
-		for (size_t a = 0; a < bytesRead; a++) {
-			if (m_abortSignalled) {
-				// Make space
-				for (int s = 0; s < 4; s++) slidingWindow[s] = slidingWindow[s + 1];
-				// Append the new byte
-				slidingWindow[4] = tempReadBuffer[a];
-
-				// Watch the sliding window for the pattern we need
-				if (slidingWindow[0] == 'X' && slidingWindow[1] == 'Y' && slidingWindow[2] == 'Z' && slidingWindow[3] == SPECIAL_ABORT_CHAR && slidingWindow[4] == '1') {
-					m_isStreaming = false;					
-					m_comPort->purgeBuffers();
-					m_lastError = timeout ? DiagnosticResponse::drError : DiagnosticResponse::drOK;
-					applyCommTimeouts(false);
-					return m_lastError;
-				}
-			}
-			else {
-				unsigned char byteRead = tempReadBuffer[a];
-
-				if (dataState) {
-
-					uint32_t flux[3];
-					flux[0] = byte1 & 0x1F;
-					flux[1] = (byte1 >> 5) | ((byteRead >> 2) & 0x18);
-					flux[2] = byteRead & 0x1F;
-					indexDetected |= (byteRead & 0x80) != 0;
-
-					for (int a = 0; a < 3; a++) {
-						switch (flux[a]) {
-						case MAX_FLUX_SIGNAL:
-							fluxSoFar += (uint32_t)(62.5f * FLUX_REPEAT_OFFSET);
-							break;
-						default:
-							fluxSoFar += (uint32_t)((flux[a] * 2 + MIN_FLUX_ALLOWED) * 62.5f);
-							pll.submitFlux(fluxSoFar, indexDetected);
-							indexDetected = false;
-							fluxSoFar = 0;
-						}
-					}
-
-					dataState = false;
-				}
-				else {
-					// in 'false' mode we get the flux data
-					dataState = true;
-					byte1 = byteRead;
-				}
-
+	m_lastError = receiveStream([this, &pll, &decoder, &timeout, &firstOutputBuffer, maxOutputSize, &startBitPatterns, &onRotation](const unsigned char* data, const unsigned int length) {
+		// Decode what was read and pass it on in one go
+		decoder.decodeFlux(data, length, pll);
 
-				// Is it ready to extract?
-				if (pll.canExtract()) {
-					unsigned int bits = 0;
-					// Go!
-					if (pll.extractRotation(firstOutputBuffer, bits, maxOutputSize)) {
-						m_diskInDrive = true;
+		// Is it ready to extract?
+		if (pll.canExtract()) {
+			unsigned int bits = 0;
+			// Go!
+			if (pll.extractRotation(firstOutputBuffer, bits, maxOutputSize)) {
+				m_diskInDrive = true;
 
-						if (!onRotation(&firstOutputBuffer, bits)) {
-							// And if the callback says so we stop.
-							abortReadStreaming();
-						}
-						// Always save this back
-						pll.getIndexSequence(startBitPatterns);
-					}
-				}
-				else {
-					if (pll.totalTimeReceived() > (m_isHDMode ? 1200000000U : 600000000U)) {
-						// No data, stop
-						abortReadStreaming();
-						timeout = true;
-					}
+				if (!onRotation(&firstOutputBuffer, bits)) {
+					// And if the callback says so we stop.
+					abortReadStreaming();
 				}
+				// Always save this back
+				pll.getIndexSequence(startBitPatterns);
 			}
 		}
-		if (bytesRead < 1) {
-			readFail++;
-			if (readFail > 30) {
-				m_abortStreaming = false; // force the 'abort' command to be sent
+		else {
+			if (pll.totalTimeReceived() > (m_isHDMode ? 1200000000U : 600000000U)) {
+				// No data, stop
 				abortReadStreaming();
-				m_lastError = DiagnosticResponse::drReadResponseFailed;
-				m_isStreaming = false;
-				applyCommTimeouts(false);
-				return m_lastError;
-			}
-			else {
-				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				timeout = true;
 			}
 		}
-		else {
-			readFail = 0;
-		}
-	}
+	});
+
+	if ((m_lastError == DiagnosticResponse::drOK) && (timeout)) m_lastError = DiagnosticResponse::drError;
+	return m_lastError;
 }
 
 // Stops the read streaming immediately and any data in the buffer will be discarded.
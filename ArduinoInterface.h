@@ -184,6 +184,10 @@ namespace ArduinoFloppyReader {
 		// Apply and change the timeouts on the com port
 		void applyCommTimeouts(bool shortTimeouts);
 
+		// Receives the data from a streaming read command that has just been started, passing each block to onData as it arrives, until abortReadStreaming()
+		// has been called and the board has confirmed it's stopped.  Returns drOK then, or drReadResponseFailed if the data stops arriving
+		DiagnosticResponse receiveStream(std::function<void(const unsigned char* data, const unsigned int length)> onData);
+
 		// Attempts to write a sector back to the disk.  This must be pre-formatted and MFM encoded correctly depending on usePrecomp
 		DiagnosticResponse internalWriteTrack(const unsigned char* data, const unsigned short numBytes, const bool writeFromIndexPulse, bool usePrecomp);
 
@@ -253,6 +257,10 @@ namespace ArduinoFloppyReader {
 		// Same as the above, but this uses the newer much more accurate flux read
 		DiagnosticResponse readFlux(PLL::BridgePLL& pll, const unsigned int maxOutputSize, RotationExtractor::MFMSample* firstOutputBuffer, RotationExtractor::IndexSequenceMarker& startBitPatterns, std::function<bool(RotationExtractor::MFMSample** mfmData, const unsigned int dataLengthInBits)> onRotation);
 
+		// Streams RAW MFM data from the current track and surface into mfmData, in the same format as readCurrentTrack, for as many revolutions as fit in maxLength.
+		// onData is called each time more has arrived with how many bytes are complete, and can return FALSE to stop early.  Requires Firmware V1.8
+		DiagnosticResponse streamCurrentTrack(unsigned char* mfmData, const unsigned int maxLength, std::function<bool(const unsigned int bytesAvailable)> onData);
+
 		// Reset reason information
 		DiagnosticResponse getResetReason(bool& WD, bool& BOD, bool& ExtReset, bool& PowerOn);
 		DiagnosticResponse clearResetReason();
@@ -18,7 +18,7 @@ int main()
     float startTracksBx = 721.0, startTracksBy = 237.0;
     float gap = 6.7f;
     const float trackRectWidth = 21.0, trackRectHeight = 21.0;
-    bool writeEditMode = false, readEditMode = false, verify = true, pcw = true, tracks82 = false, hdSelection = false;
+    bool writeEditMode = false, readEditMode = false, verify = true, pcw = true, delta = false, tracks82 = false, amigaDOS = false, hdSelection = false;
     int portIndex = 0, portNumbers = 0, dPortIndex = 0;
     const char *portList[MAX_PORTS];
     int tracksA[83] = {0}, tracksB[83] = {0};
@@ -79,11 +79,11 @@ int main()
                     GetASLFilename(GetString(MSG_DISK_TO_FILE), fileNameRead, PATH_MAX, TRUE);
                 if (isWriting)
                 {
-                    StartWrite(portList[portIndex], verify, pcw, tracksA, tracksB);
+                    StartWrite(portList[portIndex], verify, pcw, delta, tracksA, tracksB);
                 }
                 if (isReading)
                 {
-                    StartRead(portList[portIndex], verify, tracks82, tracksA, tracksB);
+                    StartRead(portList[portIndex], verify, tracks82, amigaDOS, tracksA, tracksB);
                 }
             }
             else
@@ -163,6 +163,7 @@ int main()
             isReading = true;
 
         GuiCheckBox((Rectangle){20, 275, 15, 15}, LS(VERIFY), &verify);
+        GuiCheckBox((Rectangle){140, 275, 15, 15}, LS(DELTA), &delta);
         GuiCheckBox((Rectangle){260, 275, 15, 15}, LS(PCW), &pcw);
 
         if (GuiTextBox((Rectangle){20, 330, 290, 25}, fileNameRead, PATH_MAX - 1, readEditMode))
@@ -177,6 +178,7 @@ int main()
 
         if (GuiCheckBox((Rectangle){20, 452, 15, 15}, LS(TRACKS_82), &tracks82))
             tracks82 = !tracks82;
+        GuiCheckBox((Rectangle){20, 425, 15, 15}, LS(AMIGADOS), &amigaDOS);
         if (GuiCheckBox((Rectangle){650, 515, 15, 15}, LS(HD_DISK_SELECTION), &hdSelection))
             hdSelection = !hdSelection;
         GuiLabel((Rectangle){70, 510, 150, 25}, LS(WAFFLE_DRIVE_PORT));
@@ -41,7 +41,7 @@ int main(int argc, char *argv[])
 	InitLocaleLibrary();
 
 	// Define the template for ReadArgs
-	const char *argsTemplate = "COMPORT/K,FILE/K,WRITE/S,VERIFY/S,NOBANNER/S,LISTSERIALS/S,DIAGNOSTIC/S,CLEAN/S,SETTINGS/S,SETTINGNAME/K,SETTINGVALUE/S";
+	const char *argsTemplate = "COMPORT/K,FILE/K,WRITE/S,VERIFY/S,DELTA/S,AMIGADOS/S,NOBANNER/S,LISTSERIALS/S,DIAGNOSTIC/S,CLEAN/S,SETTINGS/S,SETTINGNAME/K,SETTINGVALUE/S";
 	struct RDArgs *rdargs;
 	std::string settingName;
 	std::string filename;
@@ -53,6 +53,8 @@ int main(int argc, char *argv[])
 		STRPTR file;
 		LONG write;
 		LONG verify;
+		LONG delta;
+		LONG amigaDOS;
 		LONG nobanner;
 		LONG listSerials;
 		LONG diagnostic;
@@ -177,9 +179,9 @@ int main(int argc, char *argv[])
 	else
 	{
 		if (shell_args.write)
-			file2Disk(filename.c_str(), shell_args.verify);
+			file2Disk(filename.c_str(), shell_args.verify, shell_args.delta);
 		else
-			disk2file(filename.c_str());
+			disk2file(filename.c_str(), shell_args.amigaDOS);
 
 		writer.closeDevice();
 	}
@@ -84,7 +84,7 @@ int main(void)
     ULONG done = FALSE;
     const char *portList[MAX_PORTS];
     int portNumbers = 0, portIndex = -1;
-    bool verify = true, pcw = true, tracks82 = false, hdSelection = false;
+    bool verify = true, pcw = true, delta = false, tracks82 = false, amigaDOS = false, hdSelection = false;
     int tracksA[83] = {0}, tracksB[83] = {0};
 
     InitLocaleLibrary();
@@ -189,6 +189,12 @@ int main(void)
                                     GA_Selected,    TRUE,
                                     GA_Text,        GetString(MSG_PCW),
                                 End,
+                                LAYOUT_AddChild, OBJ(OBJ_WRITE_DELTA) = CheckBoxObject,
+                                    GA_ID,          OBJ_WRITE_DELTA,
+                                    GA_RelVerify,   TRUE,
+                                    GA_TabCycle,    TRUE,
+                                    GA_Text,        GetString(MSG_DELTA),
+                                End,
                             End,
                             LAYOUT_AddChild, OBJ(OBJ_START_WRITE) = ButtonObject,
                                 GA_ID, OBJ_START_WRITE,
@@ -224,6 +230,12 @@ int main(void)
                                     GA_RelVerify, TRUE,
                                     GA_Text, GetString(MSG_82_TRACKS),
                                 End,
+                                LAYOUT_AddChild, OBJ(OBJ_READ_AMIGADOS) = CheckBoxObject,
+                                    GA_ID, OBJ_READ_AMIGADOS,
+                                    GA_TabCycle, TRUE,
+                                    GA_RelVerify, TRUE,
+                                    GA_Text, GetString(MSG_AMIGADOS),
+                                End,
                             End,
                             LAYOUT_AddChild, OBJ(OBJ_START_READ) = ButtonObject,
                                 GA_ID, OBJ_START_READ,
@@ -577,9 +589,15 @@ int main(void)
                             case OBJ_WRITE_PCW:
                                 pcw = code;
                                 break;
+                            case OBJ_WRITE_DELTA:
+                                delta = code;
+                                break;
                             case OBJ_READ_TRACKS82:
                                 tracks82 = code;
                                 break;
+                            case OBJ_READ_AMIGADOS:
+                                amigaDOS = code;
+                                break;
                             case OBJ_HD_MODE:
                                 hdSelection = code;
                                 break;
@@ -592,7 +610,7 @@ int main(void)
                                     if (fileNameRead != NULL && !fileNameRead[0] == '\0')
                                     {
                                         if (!isWorking)
-                                            StartRead(portList[portIndex], verify, tracks82, tracksA, tracksB, window);
+                                            StartRead(portList[portIndex], verify, tracks82, amigaDOS, tracksA, tracksB, window);
                                         else
                                         {
                                             isWorking = FALSE;
@@ -612,7 +630,7 @@ int main(void)
                                     if (fileNameWrite != NULL && !fileNameWrite[0] == '\0')
                                     {
                                         if (!isWorking)
-                                            StartWrite(portList[portIndex], verify, pcw, tracksA, tracksB, window);
+                                            StartWrite(portList[portIndex], verify, pcw, delta, tracksA, tracksB, window);
                                         else
                                         {
                                             isWorking = FALSE;
@@ -307,6 +307,102 @@ void RotationExtractor::submitSequence(const MFMSequenceInfo& sequence, const bo
 }
 
 
+// Submit a block of sequences.  Anything that doesn't have its own version just does them one at a time
+unsigned int MFMExtractionTarget::submitSequences(const MFMSequenceInfo* sequences, const unsigned int count, const unsigned int* indexPositions, const unsigned int numIndexPositions, bool discardEarlySamples) {
+	const bool wasReady = canExtract();
+	unsigned int nextIndex = 0;
+	for (unsigned int a = 0; a < count; a++) {
+		const bool isIndex = (nextIndex < numIndexPositions) && (indexPositions[nextIndex] == a);
+		if (isIndex) nextIndex++;
+		submitSequence(sequences[a], isIndex, discardEarlySamples);
+		if ((!wasReady) && (canExtract())) return a + 1;
+	}
+	return count;
+}
+
+// Submits everything waiting to the extractor.  If it gets a rotation part way through, the rest is kept for after it has been extracted
+void MFMSequenceBatch::submit(MFMExtractionTarget& extractor) {
+	if (m_sequences.empty()) return;
+
+	const unsigned int used = extractor.submitSequences(m_sequences.data(), (unsigned int)m_sequences.size(), m_indexes.data(), (unsigned int)m_indexes.size());
+	if (used >= m_sequences.size()) {
+		clear();
+		return;
+	}
+
+	m_sequences.erase(m_sequences.begin(), m_sequences.begin() + used);
+	unsigned int kept = 0;
+	for (const unsigned int index : m_indexes)
+		if (index >= used) m_indexes[kept++] = index - used;
+	m_indexes.resize(kept);
+}
+
+// Submit a block of sequences.  Once the revolution time is known and we're not waiting for index pulses, storing a sequence is
+// just a copy and an add, so that case runs in a tight loop with the state held in locals.  Anything else goes through submitSequence
+unsigned int RotationExtractor::submitSequences(const MFMSequenceInfo* sequences, const unsigned int count, const unsigned int* indexPositions, const unsigned int numIndexPositions, bool discardEarlySamples) {
+	// If it was already ready, keep going.  This only stops when it *becomes* ready
+	const bool wasReady = canExtract();
+	unsigned int a = 0;
+	unsigned int nextIndex = 0;
+
+	while (a < count) {
+		const unsigned int nextIndexPosition = (nextIndex < numIndexPositions) ? indexPositions[nextIndex] : count;
+
+		if ((a < nextIndexPosition) && (!m_useIndex) && (m_revolutionTime)) {
+			// Everything up to the next index pulse
+			uint32_t sequencePos = m_sequencePos;
+			uint32_t currentTime = m_currentTime;
+			uint32_t timeReceived = m_timeReceived;
+			bool ready = false;
+
+			while (a < nextIndexPosition) {
+				const MFMSequenceInfo& sequence = sequences[a++];
+
+				// we reject the first 20uSec of data.  Makes things so much more stable
+				bool keep = true;
+				if (discardEarlySamples) {
+					timeReceived += sequence.timeNS;
+					keep = timeReceived >= 20000;
+				}
+
+				// And stop if we have too much.  Shouldn't happen
+				if ((keep) && (sequencePos < MAX_REVOLUTION_SEQUENCES)) {
+					m_sequences[sequencePos++] = sequence;
+					currentTime += (uint32_t)sequence.timeNS;
+
+					// This is a sneaky check-ahead for a full rotation, like a virtual index marker
+					if (currentTime >= m_revolutionTime) {
+						if (m_revolutionReadyAt == INDEX_NOT_FOUND)
+							m_revolutionReadyAt = sequencePos;
+						else
+							if (sequencePos > m_revolutionReadyAt + (OVERLAP_SEQUENCE_MATCHES * OVERLAP_EXTRA_BUFFER))
+								m_revolutionReady = true;
+					}
+				}
+
+				// Same test as canExtract()
+				if ((!wasReady) && (m_revolutionReady) && (m_revolutionReadyAt != INDEX_NOT_FOUND) && (sequencePos > 100)) {
+					ready = true;
+					break;
+				}
+			}
+
+			m_sequencePos = sequencePos;
+			m_currentTime = currentTime;
+			m_timeReceived = timeReceived;
+			if (ready) return a;
+		}
+		else {
+			const bool isIndex = a == nextIndexPosition;
+			if (isIndex) nextIndex++;
+			RotationExtractor::submitSequence(sequences[a++], isIndex, discardEarlySamples);
+			if ((!wasReady) && (canExtract())) return a;
+		}
+	}
+
+	return count;
+}
+
 // Reset this back to "empty"
 void RotationExtractor::reset(bool isHD) {
 	m_indexSequence.valid = false;
@@ -569,6 +665,52 @@ void LinearExtractor::submitSequence(const MFMSequenceInfo& sequence, bool isInd
 	if (sequence.mfm != MFMSequence::mfm000) writeLinearBit(true);
 }
 
+// Submit a block of sequences.  The byte being built is kept in a local rather than shifted in memory one bit at a time
+unsigned int LinearExtractor::submitSequences(const MFMSequenceInfo* sequences, const unsigned int count, const unsigned int* indexPositions, const unsigned int numIndexPositions, bool discardEarlySamples) {
+	// Nowhere to put them.  Just like submitSequence, they're ignored
+	if (!m_currentPosition) return count;
+
+	uint8_t* currentPosition = m_currentPosition;
+	uint32_t outputStreamPos = m_outputStreamPos;
+	uint32_t outputStreamBit = m_outputStreamBit;
+	uint32_t value = *currentPosition;
+	unsigned int a = 0;
+
+	while (a < count) {
+		const MFMSequenceInfo& sequence = sequences[a++];
+		m_totalTime += sequence.timeNS;
+
+		// Zeros followed by a one, except for 000
+		uint32_t bitsToWrite = (uint32_t)sequence.mfm;
+		if (bitsToWrite > 3) bitsToWrite = 3;
+		const uint32_t bits = (sequence.mfm != MFMSequence::mfm000) ? 1 : 0;
+		if (bits) bitsToWrite++;
+
+		for (uint32_t bit = bitsToWrite; bit > 0; bit--) {
+			value = (value << 1) | ((bit == 1) ? bits : 0);
+			if (++outputStreamBit >= 8) {
+				*currentPosition = (uint8_t)value;
+				outputStreamBit = 0;
+				outputStreamPos++;
+				if (outputStreamPos >= m_totalSize) {
+					currentPosition = nullptr;
+					break;
+				}
+				currentPosition++;
+				value = *currentPosition;
+			}
+		}
+		if (!currentPosition) break;
+	}
+
+	// Put back the byte thats part built
+	if (currentPosition) *currentPosition = (uint8_t)value;
+	m_currentPosition = currentPosition;
+	m_outputStreamPos = outputStreamPos;
+	m_outputStreamBit = outputStreamBit;
+	return a;
+}
+
 // Finalise the buffer (shifting the bits for the current byte into place) and returns the total number of bits received
 uint32_t LinearExtractor::finaliseAndGetNumBits() {
 	// Shift the remaining bits into place
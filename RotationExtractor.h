@@ -60,6 +60,7 @@
 #define INDEX_NOT_FOUND					0xFFFFFFFF
 
 #include <stdint.h>
+#include <vector>
 
 // A class that can receive data 
 class MFMExtractionTarget {
@@ -120,6 +121,10 @@ public:
 	// Submit a single sequence to the list - abstract function
 	virtual void submitSequence(const MFMSequenceInfo& sequence, bool isIndex, bool discardEarlySamples = true) = 0;
 
+	// Submit a block of sequences.  indexPositions lists (in order) which of them are at the index.  If canExtract() becomes TRUE part way
+	// through this stops straight after, and returns how many were used so the rest can be submitted after extraction.  The default just calls submitSequence
+	virtual unsigned int submitSequences(const MFMSequenceInfo* sequences, const unsigned int count, const unsigned int* indexPositions, const unsigned int numIndexPositions, bool discardEarlySamples = true);
+
 	// Returns TRUE if we are readt to extract (eg: full revolution or buffer full)
 	[[nodiscard]] virtual bool canExtract() const = 0;
 
@@ -136,6 +141,36 @@ public:
 	virtual ~MFMExtractionTarget() {};
 };
 
+// Sequences waiting to be submitted to an extractor as one block, and which of them are at the index.  If the extractor gets a
+// full rotation part way through, the rest is kept to be submitted again after the rotation has been extracted
+class MFMSequenceBatch {
+private:
+	std::vector<MFMExtractionTarget::MFMSequenceInfo> m_sequences;
+	std::vector<unsigned int> m_indexes;
+
+public:
+	void clear() { m_sequences.clear(); m_indexes.clear(); }
+	void reserve(const unsigned int count) { m_sequences.reserve(count); }
+	bool empty() const { return m_sequences.empty(); }
+
+	// Add a sequence
+	void add(const MFMExtractionTarget::MFMSequenceInfo& sequence, const bool isIndex) {
+		if (isIndex) m_indexes.push_back((unsigned int)m_sequences.size());
+		m_sequences.push_back(sequence);
+	}
+
+	// Add several sequences.  Bit n of indexMask is set if sequence n is at the index
+	void add(const MFMExtractionTarget::MFMSequenceInfo* sequences, const unsigned int count, const unsigned int indexMask) {
+		if (indexMask)
+			for (unsigned int a = 0; a < count; a++)
+				if ((indexMask >> a) & 1) m_indexes.push_back((unsigned int)m_sequences.size() + a);
+		m_sequences.insert(m_sequences.end(), sequences, sequences + count);
+	}
+
+	// Submits everything waiting to the extractor.  Check extractor.canExtract() afterwards
+	void submit(MFMExtractionTarget& extractor);
+};
+
 
 // Class to extract a single rotation from an incoming mfm data sequence and ensure it's a perfect MFM rotation
 class RotationExtractor : public MFMExtractionTarget  {
@@ -232,6 +267,9 @@ public:
 	// Submit a single sequence to the list
 	virtual void submitSequence(const MFMSequenceInfo& sequence, bool isIndex, bool discardEarlySamples = true) override;
 
+	// Submit a block of sequences, stopping once a revolution can be extracted
+	virtual unsigned int submitSequences(const MFMSequenceInfo* sequences, const unsigned int count, const unsigned int* indexPositions, const unsigned int numIndexPositions, bool discardEarlySamples = true) override;
+
 	// Returns TRUE if we should be able to extract a revolution
 	[[nodiscard]] virtual bool canExtract() const override { return (m_revolutionReadyAt != INDEX_NOT_FOUND) && (m_revolutionReady) && (m_sequencePos>100); }
 
@@ -270,6 +308,9 @@ public:
 	// Finalise the buffer (shifting the bits for the current byte into place) and returns the total number of bits received
 	uint32_t finaliseAndGetNumBits();
 
+	// How many whole bytes have been written to the buffer so far
+	uint32_t bytesWritten() const { return m_outputStreamPos; }
+
 	// Return the total amount of time data received so far
 	virtual uint32_t totalTimeReceived() const override { return m_totalTime; };
 
@@ -281,6 +322,9 @@ public:
 
 	// Submit a single sequence to the list - abstract function
 	virtual void submitSequence(const MFMSequenceInfo& sequence, bool isIndex, bool discardEarlySamples = true) override;
+
+	// Submit a block of sequences, stopping once the buffer is full
+	virtual unsigned int submitSequences(const MFMSequenceInfo* sequences, const unsigned int count, const unsigned int* indexPositions, const unsigned int numIndexPositions, bool discardEarlySamples = true) override;
 };
 
 
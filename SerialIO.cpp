@@ -27,12 +27,34 @@
 #define _SILENCE_ALL_CXX17_DEPRECATION_WARNINGS
 
 #include "SerialIO.h"
+#include "virtual_drawbridge.h"
 
 #include <string>
 #include <string.h>
 #include <locale>
 #include <iostream>
 #include <algorithm>
+#include <chrono>
+
+#ifdef SERIALIO_TERMIOS
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+#ifdef __APPLE__
+#include <IOKit/serial/ioss.h>
+#endif
+#endif
+
+// justRead() returns whatever has arrived, like ftdi_read_data does.  This is the most it will wait for something to turn up
+#define JUSTREAD_WAIT_MS 10
 
 // Constructor etc
 SerialIO::SerialIO() {
@@ -46,6 +68,10 @@ SerialIO::~SerialIO() {
 
 // Returns TRUE if the port is open
 bool SerialIO::isPortOpen() const {
+	if (m_virtual) return true;
+#ifdef SERIALIO_TERMIOS
+	if (m_portHandle != -1) return true;
+#endif
 	if (m_ftdi.isOpen()) return true;
 
 	return false;
@@ -55,6 +81,16 @@ bool SerialIO::isPortOpen() const {
 void SerialIO::purgeBuffers() {
 	if (!isPortOpen()) return;
 
+	if (m_virtual) {
+		m_virtual->purge(true, true);
+		return;
+	}
+#ifdef SERIALIO_TERMIOS
+	if (m_portHandle != -1) {
+		tcflush(m_portHandle, TCIOFLUSH);
+		return;
+	}
+#endif
 	if (m_ftdi.isOpen()) {
 		m_ftdi.FT_Purge(true, true);
 		return;
@@ -64,6 +100,16 @@ void SerialIO::purgeBuffers() {
 void SerialIO::purgeRxBuffer() {
 	if (!isPortOpen()) return;
 
+	if (m_virtual) {
+		m_virtual->purge(true, false);
+		return;
+	}
+#ifdef SERIALIO_TERMIOS
+	if (m_portHandle != -1) {
+		tcflush(m_portHandle, TCIFLUSH);
+		return;
+	}
+#endif
 	if (m_ftdi.isOpen()) {
 		m_ftdi.FT_PurgeRx();
 		return;
@@ -73,6 +119,16 @@ void SerialIO::purgeRxBuffer() {
 void SerialIO::purgeTxBuffer() {
 	if (!isPortOpen()) return;
 
+	if (m_virtual) {
+		m_virtual->purge(false, true);
+		return;
+	}
+#ifdef SERIALIO_TERMIOS
+	if (m_portHandle != -1) {
+		tcflush(m_portHandle, TCOFLUSH);
+		return;
+	}
+#endif
 	if (m_ftdi.isOpen()) {
 		m_ftdi.FT_PurgeTx();
 		return;
@@ -83,6 +139,14 @@ void SerialIO::purgeTxBuffer() {
 void SerialIO::setRTS(bool enableRTS) {
 	if (!isPortOpen()) return;
 
+	if (m_virtual) return;
+#ifdef SERIALIO_TERMIOS
+	if (m_portHandle != -1) {
+		int bits = TIOCM_RTS;
+		ioctl(m_portHandle, enableRTS ? TIOCMBIS : TIOCMBIC, &bits);
+		return;
+	}
+#endif
 	if (m_ftdi.isOpen()) {
 		if (enableRTS) m_ftdi.FT_SetRts(); else m_ftdi.FT_ClrRts();
 		return;
@@ -93,6 +157,14 @@ void SerialIO::setRTS(bool enableRTS) {
 void SerialIO::setDTR(bool enableDTR) {
 	if (!isPortOpen()) return;
 
+	if (m_virtual) return;
+#ifdef SERIALIO_TERMIOS
+	if (m_portHandle != -1) {
+		int bits = TIOCM_DTR;
+		ioctl(m_portHandle, enableDTR ? TIOCMBIS : TIOCMBIC, &bits);
+		return;
+	}
+#endif
 	if (m_ftdi.isOpen()) {
 		if (enableDTR) m_ftdi.FT_SetDtr(); else m_ftdi.FT_ClrDtr();
 		return;
@@ -103,6 +175,14 @@ void SerialIO::setDTR(bool enableDTR) {
 bool SerialIO::getCTSStatus() {
 	if (!isPortOpen()) return false;
 
+	if (m_virtual) return m_virtual->getCTSStatus();
+#ifdef SERIALIO_TERMIOS
+	if (m_portHandle != -1) {
+		int bits = 0;
+		if (ioctl(m_portHandle, TIOCMGET, &bits) < 0) return false;
+		return (bits & TIOCM_CTS) != 0;
+	}
+#endif
 	if (m_ftdi.isOpen()) {
 		uint32_t status;
 		if (m_ftdi.FT_GetModemStatus(&status) != FTDI::FT_STATUS::FT_OK) return false;
@@ -112,10 +192,55 @@ bool SerialIO::getCTSStatus() {
 	return false;
 }
 
+#ifdef SERIALIO_TERMIOS
+// tty devices that could be a USB serial adapter
+static const char* TTYDevicePrefixes[] = { "ttyUSB", "ttyACM", "cu.usbserial", "cu.usbmodem", nullptr };
+
+#ifdef __linux__
+// Reads the first line of a sysfs file
+static bool readSysfsLine(const std::string& filename, std::string& line) {
+	FILE* fle = fopen(filename.c_str(), "r");
+	if (!fle) return false;
+	char buffer[256] = { 0 };
+	const bool ok = fgets(buffer, sizeof(buffer), fle) != nullptr;
+	fclose(fle);
+	if (!ok) return false;
+	line = buffer;
+	while ((!line.empty()) && ((line.back() == '\n') || (line.back() == '\r'))) line.pop_back();
+	return true;
+}
+
+// Finds the USB device a tty belongs to and fills in its vid, pid and product name
+static void readUSBDetails(const std::string& ttyName, SerialIO::SerialPortInformation& info) {
+	char path[PATH_MAX];
+	if (!realpath(("/sys/class/tty/" + ttyName + "/device").c_str(), path)) return;
+
+	// The device is the interface (or a port under it), so walk up until the USB device itself is found
+	std::string folder = path;
+	for (int level = 0; level < 4; level++) {
+		std::string vid, pid;
+		if (readSysfsLine(folder + "/idVendor", vid) && readSysfsLine(folder + "/idProduct", pid)) {
+			info.vid = (unsigned int)strtoul(vid.c_str(), nullptr, 16);
+			info.pid = (unsigned int)strtoul(pid.c_str(), nullptr, 16);
+			readSysfsLine(folder + "/product", info.productName);
+			readSysfsLine(folder + "/serial", info.instanceID);
+			return;
+		}
+		const size_t pos = folder.rfind('/');
+		if ((pos == std::string::npos) || (pos == 0)) return;
+		folder.resize(pos);
+	}
+}
+#endif
+#endif
+
 // Returns a list of serial ports discovered on the system
 void SerialIO::enumSerialPorts(std::vector<SerialPortInformation>& serialPorts) {
 	serialPorts.clear();
 
+	// The USB details of the FTDI ports, so the same boards aren't listed again as ttys
+	std::vector<SerialPortInformation> ftdiDevices;
+
 	// Add in the FTDI ports detected
 	uint32_t numDevs;
 	FTDI::FT_STATUS status = m_ftdi.FT_CreateDeviceInfoList(&numDevs);
@@ -155,12 +280,44 @@ void SerialIO::enumSerialPorts(std::vector<SerialPortInformation>& serialPorts)
 
 					// Save
 					serialPorts.push_back(info);
+
+					SerialPortInformation device;
+					device.vid = info.vid;
+					device.pid = info.pid;
+					device.instanceID = devList[index].SerialNumber;
+					ftdiDevices.push_back(device);
 				}
 			}
 			free(devList);
 		}
 	}
 
+#ifdef SERIALIO_TERMIOS
+	// And any tty devices
+	DIR* dir = opendir("/dev");
+	if (dir) {
+		while (struct dirent* entry = readdir(dir)) {
+			const std::string name = entry->d_name;
+			bool match = false;
+			for (const char** prefix = TTYDevicePrefixes; *prefix; prefix++)
+				if (name.compare(0, strlen(*prefix), *prefix) == 0) match = true;
+			if (!match) continue;
+
+			SerialPortInformation info;
+			info.portName = "/dev/" + name;
+#ifdef __linux__
+			readUSBDetails(name, info);
+			// An FTDI board bound to ftdi_sio has already been listed above
+			if ((!info.instanceID.empty()) && (std::find_if(ftdiDevices.begin(), ftdiDevices.end(), [&info](const SerialPortInformation& device)->bool {
+				return (device.vid == info.vid) && (device.pid == info.pid) && (device.instanceID == info.instanceID);
+			}) != ftdiDevices.end())) continue;
+#endif
+			serialPorts.push_back(info);
+		}
+		closedir(dir);
+	}
+#endif
+
 	std::sort(serialPorts.begin(), serialPorts.end(), [](const SerialPortInformation& a, const SerialPortInformation& b)->int {
 		return a.portName < b.portName;
 	});
@@ -171,6 +328,11 @@ void SerialIO::setBufferSizes(const unsigned int rxSize, const unsigned int txSi
 	if (!isPortOpen()) {
 		return;
 	}
+	if (m_virtual) return;
+#ifdef SERIALIO_TERMIOS
+	// A tty's kernel buffer can't be resized.  Reads are kept going back to back instead
+	if (m_portHandle != -1) return;
+#endif
 	if (m_ftdi.isOpen()) {
 		// Larger than this size actually causes slowdowns.  This doesn't work the same as below.  Below is a buffer in Windows.  This is on the USB device I think
 		m_ftdi.FT_SetUSBParameters(rxSize < 256 ? 256 : rxSize, txSize);
@@ -182,6 +344,16 @@ void SerialIO::setBufferSizes(const unsigned int rxSize, const unsigned int txSi
 SerialIO::Response SerialIO::openPort(const std::string& portName) {
 	closePort();
 
+	// An emulated board, serving a disk image
+	if (portName.substr(0, strlen(VIRTUAL_PORT_PREFIX)) == VIRTUAL_PORT_PREFIX) {
+		m_virtual.reset(new VirtualDrawBridge());
+		if (!m_virtual->open(portName.substr(strlen(VIRTUAL_PORT_PREFIX)))) {
+			m_virtual.reset();
+			return Response::rNotFound;
+		}
+		return Response::rOK;
+	}
+
 	if (portName.length() > std::string(FTDI_PORT_PREFIX).length()) {
 		// Is it FTDI?
 		if (portName.substr(0, strlen(FTDI_PORT_PREFIX)) == FTDI_PORT_PREFIX) {
@@ -209,23 +381,135 @@ SerialIO::Response SerialIO::openPort(const std::string& portName) {
 		}
 	}
 
+#ifdef SERIALIO_TERMIOS
+	// Anything else is treated as a tty device
+	m_portHandle = open(portName.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (m_portHandle == -1) {
+		switch (errno) {
+			case ENOENT: return Response::rNotFound;
+			case EBUSY:
+			case EACCES: return Response::rInUse;
+			default: return Response::rUnknownError;
+		}
+	}
+	if (!isatty(m_portHandle)) {
+		closePort();
+		return Response::rNotFound;
+	}
+	// Stop anything else opening it while we have it
+	if (ioctl(m_portHandle, TIOCEXCL) < 0) {
+		closePort();
+		return Response::rInUse;
+	}
+	m_overrunCount = getOverrunCount();
+	return Response::rOK;
+#else
 	return Response::rNotImplemented;
+#endif
 }
 
 // Shuts the port down
 void SerialIO::closePort() {
 	if (!isPortOpen()) return;
 
+	if (m_virtual) {
+		m_virtual.reset();
+		return;
+	}
+#ifdef SERIALIO_TERMIOS
+	if (m_portHandle != -1) {
+		ioctl(m_portHandle, TIOCNXCL);
+		close(m_portHandle);
+		m_portHandle = -1;
+		return;
+	}
+#endif
 	if (m_ftdi.isOpen()) {
 		m_ftdi.FT_Close();
 		return;
 	}
 }
 
+#if defined(SERIALIO_TERMIOS) && !defined(__APPLE__)
+// Converts a baud rate to the termios constant.  Returns B0 if there isn't one
+static speed_t baudRateToSpeed(const unsigned int baudRate) {
+	switch (baudRate) {
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+#ifdef B460800
+		case 460800: return B460800;
+#endif
+#ifdef B921600
+		case 921600: return B921600;
+#endif
+#ifdef B1000000
+		case 1000000: return B1000000;
+#endif
+#ifdef B2000000
+		case 2000000: return B2000000;
+#endif
+#ifdef B3000000
+		case 3000000: return B3000000;
+#endif
+#ifdef B4000000
+		case 4000000: return B4000000;
+#endif
+		default: return B0;
+	}
+}
+#endif
+
 // Changes the configuration on the port
 SerialIO::Response SerialIO::configurePort(const Configuration& configuration) {
 	if (!isPortOpen()) return Response::rUnknownError;
 
+	// The emulator always runs at the speed the firmware expects
+	if (m_virtual) return Response::rOK;
+#ifdef SERIALIO_TERMIOS
+	if (m_portHandle != -1) {
+		struct termios term;
+		if (tcgetattr(m_portHandle, &term) < 0) return SerialIO::Response::rUnknownError;
+
+		// Raw 8N1, and reads return straight away.  Timeouts are handled with poll()
+		cfmakeraw(&term);
+		term.c_cflag |= CLOCAL | CREAD;
+		term.c_cflag &= ~(CSTOPB | PARENB);
+		if (configuration.ctsFlowControl) term.c_cflag |= CRTSCTS; else term.c_cflag &= ~CRTSCTS;
+		term.c_cc[VMIN] = 0;
+		term.c_cc[VTIME] = 0;
+
+#ifdef __APPLE__
+		// The speed is set afterwards with IOSSIOSPEED, which allows any rate
+		cfsetspeed(&term, B9600);
+#else
+		const speed_t speed = baudRateToSpeed(configuration.baudRate);
+		if (speed == B0) return SerialIO::Response::rUnknownError;
+		cfsetispeed(&term, speed);
+		cfsetospeed(&term, speed);
+#endif
+		if (tcsetattr(m_portHandle, TCSANOW, &term) < 0) return SerialIO::Response::rUnknownError;
+#ifdef __APPLE__
+		speed_t appleSpeed = configuration.baudRate;
+		if (ioctl(m_portHandle, IOSSIOSPEED, &appleSpeed) < 0) return SerialIO::Response::rUnknownError;
+#endif
+
+#ifdef __linux__
+		// Ask the driver to pass data on as soon as it arrives.  Not every driver (or a pty) supports this
+		struct serial_struct serial;
+		if (ioctl(m_portHandle, TIOCGSERIAL, &serial) == 0) {
+			serial.flags |= ASYNC_LOW_LATENCY;
+			ioctl(m_portHandle, TIOCSSERIAL, &serial);
+		}
+#endif
+		setDTR(false);
+		setRTS(false);
+		return SerialIO::Response::rOK;
+	}
+#endif
 	if (m_ftdi.isOpen()) {
 		if (m_ftdi.FT_SetFlowControl(configuration.ctsFlowControl ? FT_FLOW_RTS_CTS : FT_FLOW_NONE, 0, 0) != FTDI::FT_STATUS::FT_OK) return SerialIO::Response::rUnknownError;
 		if (m_ftdi.FT_SetDataCharacteristics(FTDI::FT_BITS::_8, FTDI::FT_STOP_BITS::_1, FTDI::FT_PARITY::NONE) != FTDI::FT_STATUS::FT_OK) return SerialIO::Response::rUnknownError;
@@ -243,8 +527,19 @@ SerialIO::Response SerialIO::configurePort(const Configuration& configuration) {
 bool SerialIO::checkForOverrun() {
 	if (!isPortOpen()) return false;
 
+	if (m_virtual) return false;
+#ifdef SERIALIO_TERMIOS
+	if (m_portHandle != -1) {
+		const unsigned int count = getOverrunCount();
+		const bool overrun = count != m_overrunCount;
+		m_overrunCount = count;
+		return overrun;
+	}
+#endif
 	if (m_ftdi.isOpen()) {
 		uint32_t status;
+		// The read stream polls the status while it runs, and keeps anything it saw after it stops
+		if (m_ftdi.readStreamOverrun()) return true;
 		if (m_ftdi.FT_GetModemStatus(&status) != FTDI::FT_STATUS::FT_OK) return false;
 		return (status & (FT_MODEM_STATUS_OE | FT_MODEM_STATUS_FE)) != 0;
 	}
@@ -255,6 +550,14 @@ bool SerialIO::checkForOverrun() {
 unsigned int SerialIO::getBytesWaiting() {
 	if (!isPortOpen()) return 0;
 
+	if (m_virtual) return m_virtual->getBytesWaiting();
+#ifdef SERIALIO_TERMIOS
+	if (m_portHandle != -1) {
+		int waiting = 0;
+		if (ioctl(m_portHandle, FIONREAD, &waiting) < 0) return 0;
+		return (unsigned int)waiting;
+	}
+#endif
 	if (m_ftdi.isOpen()) {
 		uint32_t queueSize = 0;
 		if (m_ftdi.FT_GetQueueStatus(&queueSize) != FTDI::FT_STATUS::FT_OK) return 0;
@@ -270,6 +573,24 @@ unsigned int SerialIO::write(const void* data, unsigned int dataLength) {
 	if ((data == nullptr) || (dataLength == 0)) return 0;
 	if (!isPortOpen()) return 0;
 
+	if (m_virtual) return m_virtual->write(data, dataLength);
+#ifdef SERIALIO_TERMIOS
+	if (m_portHandle != -1) {
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_writeTimeout + (m_writeTimeoutMultiplier * dataLength));
+		unsigned int written = 0;
+		while (written < dataLength) {
+			const ssize_t result = ::write(m_portHandle, (const unsigned char*)data + written, dataLength - written);
+			if (result > 0) {
+				written += (unsigned int)result;
+				continue;
+			}
+			if ((result < 0) && (errno != EAGAIN) && (errno != EINTR)) break;
+			const int remaining = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+			if ((remaining <= 0) || (!waitForPort(true, remaining))) break;
+		}
+		return written;
+	}
+#endif
 	if (m_ftdi.isOpen()) {
 		m_ftdi.FT_SetTimeouts(m_readTimeout + (m_readTimeoutMultiplier * dataLength), m_writeTimeout + (m_writeTimeoutMultiplier * dataLength));
 
@@ -281,11 +602,44 @@ unsigned int SerialIO::write(const void* data, unsigned int dataLength) {
 	return 0;
 }
 
+// Streams everything received into ring from a background thread until stopReadStream() is called
+bool SerialIO::startReadStream(SPSCRingBuffer& ring, const unsigned int chunkSize) {
+	if (!isPortOpen()) return false;
+
+	// The emulator is read on the caller's own thread with justRead()
+	if (m_virtual) return false;
+#ifdef SERIALIO_TERMIOS
+	// A tty is read on the caller's own thread with justRead()
+	if (m_portHandle != -1) return false;
+#endif
+	if (m_ftdi.isOpen()) {
+		// Each read still gives up after the normal timeout so the stream notices when it's stopped
+		m_ftdi.FT_SetTimeouts(m_readTimeout + (m_readTimeoutMultiplier * chunkSize), m_writeTimeout);
+		return m_ftdi.FT_StartReadStream(&ring, chunkSize) == FTDI::FT_STATUS::FT_OK;
+	}
+
+	return false;
+}
+
+// Stops the read stream
+void SerialIO::stopReadStream() {
+	m_ftdi.FT_StopReadStream();
+}
+
 // A very simple, uncluttered version of the below, mainly for linux
 unsigned int SerialIO::justRead(void* data, unsigned int dataLength) {
 	if ((data == nullptr) || (dataLength == 0)) return 0;
 	if (!isPortOpen()) return 0;
 
+	if (m_virtual) return m_virtual->read(data, dataLength, JUSTREAD_WAIT_MS, true);
+#ifdef SERIALIO_TERMIOS
+	if (m_portHandle != -1) {
+		// Return whatever is there as soon as anything arrives
+		if (!waitForPort(false, JUSTREAD_WAIT_MS)) return 0;
+		const ssize_t result = ::read(m_portHandle, data, dataLength);
+		return (result > 0) ? (unsigned int)result : 0;
+	}
+#endif
 	if (m_ftdi.isOpen()) {
 		m_ftdi.FT_SetTimeouts(m_readTimeout + (m_readTimeoutMultiplier * dataLength), m_writeTimeout + (m_writeTimeoutMultiplier * dataLength));
 
@@ -306,6 +660,25 @@ unsigned int SerialIO::read(void* data, unsigned int dataLength) {
 	if (!isPortOpen()) 
 		return 0;
 
+	if (m_virtual) return m_virtual->read(data, dataLength, m_readTimeout + (m_readTimeoutMultiplier * dataLength), false);
+#ifdef SERIALIO_TERMIOS
+	if (m_portHandle != -1) {
+		// Keep reading until it's all arrived or the deadline passes
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_readTimeout + (m_readTimeoutMultiplier * dataLength));
+		unsigned int dataRead = 0;
+		while (dataRead < dataLength) {
+			const ssize_t result = ::read(m_portHandle, (unsigned char*)data + dataRead, dataLength - dataRead);
+			if (result > 0) {
+				dataRead += (unsigned int)result;
+				continue;
+			}
+			if ((result < 0) && (errno != EAGAIN) && (errno != EINTR)) break;
+			const int remaining = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+			if ((remaining <= 0) || (!waitForPort(false, remaining))) break;
+		}
+		return dataRead;
+	}
+#endif
 	if (m_ftdi.isOpen()) {
 		m_ftdi.FT_SetTimeouts(m_readTimeout + (m_readTimeoutMultiplier * dataLength), m_writeTimeout + (m_writeTimeoutMultiplier * dataLength));
 		uint32_t dataRead = 0;
@@ -321,6 +694,12 @@ unsigned int SerialIO::read(void* data, unsigned int dataLength) {
 // Update timeouts
 void SerialIO::updateTimeouts() {
 	if (!isPortOpen()) return;
+	// The emulator works the timeouts out on each call
+	if (m_virtual) return;
+#ifdef SERIALIO_TERMIOS
+	// A tty works the timeouts out on each call
+	if (m_portHandle != -1) return;
+#endif
 
 	m_ftdi.FT_SetTimeouts(m_readTimeout + (m_readTimeoutMultiplier), m_writeTimeout + (m_writeTimeoutMultiplier));
 }
@@ -340,3 +719,28 @@ void SerialIO::setWriteTimeouts(unsigned int waitTimetimeout, unsigned int multi
 
 	updateTimeouts();
 }
+
+#ifdef SERIALIO_TERMIOS
+// Waits up to timeoutMS for the tty to be readable (or writable).  Returns FALSE on timeout or error
+bool SerialIO::waitForPort(const bool forWriting, const int timeoutMS) {
+	struct pollfd fd;
+	fd.fd = m_portHandle;
+	fd.events = forWriting ? POLLOUT : POLLIN;
+	fd.revents = 0;
+
+	for (;;) {
+		const int result = poll(&fd, 1, timeoutMS);
+		if ((result < 0) && (errno == EINTR)) continue;
+		return (result > 0) && (fd.revents & fd.events);
+	}
+}
+
+// Reads the driver's overrun count
+unsigned int SerialIO::getOverrunCount() {
+#ifdef __linux__
+	struct serial_icounter_struct counters;
+	if (ioctl(m_portHandle, TIOCGICOUNT, &counters) == 0) return (unsigned int)(counters.overrun + counters.buf_overrun);
+#endif
+	return 0;
+}
+#endif
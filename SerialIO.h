@@ -30,15 +30,39 @@
 
 #include <termios.h>
 
+#include <memory>
+
 #include "ftdi_impl.h"
 
 #define FTDI_PORT_PREFIX "FTDI:"
+// Followed by the path to an ADF or SCP file.  This is an emulated DrawBridge, see virtual_drawbridge.h
+#define VIRTUAL_PORT_PREFIX "VIRTUAL:"
+
+class VirtualDrawBridge;
+
+// Anything that isn't an FTDI port is opened as a normal tty device (eg: /dev/ttyACM0) on systems that have them
+#if !defined(_WIN32) && !defined(__amigaos4__)
+#define SERIALIO_TERMIOS
+#endif
 
 class SerialIO {
 private:
 	unsigned int m_readTimeout = 0, m_readTimeoutMultiplier = 0;
 	unsigned int m_writeTimeout = 0, m_writeTimeoutMultiplier = 0;
 	FTDI::FTDIInterface m_ftdi;
+	std::unique_ptr<VirtualDrawBridge> m_virtual;
+
+#ifdef SERIALIO_TERMIOS
+	// File handle for a tty port, or -1
+	int m_portHandle = -1;
+	// Driver overrun count when the port was opened
+	unsigned int m_overrunCount = 0;
+
+	// Waits up to timeoutMS for the tty to be readable (or writable).  Returns FALSE on timeout or error
+	bool waitForPort(const bool forWriting, const int timeoutMS);
+	// Reads the driver's overrun count
+	unsigned int getOverrunCount();
+#endif
 
 	// Update timeouts
 	void updateTimeouts();
@@ -118,6 +142,13 @@ public:
 	// A very simple, uncluttered version of the above, mainly for linux
 	unsigned int justRead(void* data, unsigned int dataLength);
 
+	// Streams everything received into ring from a background thread until stopReadStream() is called.  chunkSize is the size of each USB read.
+	// Don't call read() or justRead() while streaming.  Returns FALSE if streaming isn't possible
+	bool startReadStream(SPSCRingBuffer& ring, const unsigned int chunkSize = FT_STREAM_DEFAULT_CHUNK_SIZE);
+
+	// Stops the read stream.  The ring is closed when this returns
+	void stopReadStream();
+
 	// Sets the read timeouts. The actual timeout is calculated as waitTimetimeout + (multiplier * num bytes)
 	void setReadTimeouts(unsigned int waitTimetimeout, unsigned int multiplier);
 
@@ -174,7 +174,7 @@ void programmeSetting(const std::string &port, const std::string &settingName, c
 }
 
 // Read an ADF/SCP/IPF/IMG/IMA/ST file and write it to disk
-void file2Disk(const std::string &filename, bool verify)
+void file2Disk(const std::string &filename, bool verify, bool onlyChangedTracks)
 {
     const char *extension = strstr(filename.c_str(), ".");
     int32_t mode = -1;
@@ -230,6 +230,7 @@ void file2Disk(const std::string &filename, bool verify)
     }
 
     ADFResult result;
+    unsigned int tracksSkipped = 0;
 
     switch (mode)
     {
@@ -289,7 +290,7 @@ void file2Disk(const std::string &filename, bool verify)
                 printf("\r");
                 printf(GetString(MSG_WRITING_TRACK), currentTrack, (currentSide == DiskSurface::dsUpper) ? GetString(MSG_SIDE_UPPER) : GetString(MSG_SIDE_LOWER));
                 fflush(stdout);
-                return WriteResponse::wrContinue; });
+                return WriteResponse::wrContinue; }, onlyChangedTracks, &tracksSkipped);
         break;
     }
     case MODE_IMG:
@@ -366,10 +367,16 @@ void file2Disk(const std::string &filename, bool verify)
         printf("\n%s", GetString(MSG_UNKNOWN_ERROR));
         break;
     }
+
+    if (tracksSkipped)
+    {
+        printf("\n");
+        printf(GetString(MSG_TRACKS_SKIPPED), tracksSkipped);
+    }
 }
 
 // Read a disk and save it to ADF/SCP/IMG/IMA/ST files
-void disk2file(const std::string &filename)
+void disk2file(const std::string &filename, bool useFilesystem)
 {
     const char *extension = strstr(filename.c_str(), ".");
     int32_t mode = -1;
@@ -455,11 +462,12 @@ void disk2file(const std::string &filename)
     };
 
     ADFResult result;
+    std::vector<unsigned int> skippedBlocks;
 
     switch (mode)
     {
     case MODE_ADF:
-        result = writer.DiskToADF(filename, hdMode, 80, callback);
+        result = writer.DiskToADF(filename, hdMode, 80, callback, useFilesystem, &skippedBlocks);
         break;
     case MODE_SCP:
         result = writer.DiskToSCP(filename, hdMode, 80, 3, callback);
@@ -498,6 +506,15 @@ void disk2file(const std::string &filename)
         printf("\r%s", GetString(MSG_UNKNOWN_ERROR_OCCURRED));
         break;
     }
+
+    if (!skippedBlocks.empty())
+    {
+        printf("\n");
+        printf(GetString(MSG_BLOCKS_SKIPPED), (unsigned int)skippedBlocks.size());
+        printf(":");
+        for (const unsigned int block : skippedBlocks)
+            printf(" %u", block);
+    }
 }
 
 // Run drive cleaning action
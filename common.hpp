@@ -23,8 +23,8 @@ struct SettingName
 
 #define MAX_SETTINGS 5
 
-void file2Disk(const std::string &filename, bool verify);
-void disk2file(const std::string &filename);
+void file2Disk(const std::string &filename, bool verify, bool onlyChangedTracks);
+void disk2file(const std::string &filename, bool useFilesystem);
 void runCleaning(const std::string &port);
 void runDiagnostics(const std::string &port);
 void listSettings(const std::string &port);
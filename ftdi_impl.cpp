@@ -29,6 +29,10 @@ using namespace FTDI;
 #include <string.h>
 #include <stdio.h>
 #include <ftdi.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "ring_buffer.h"
 
 // Purge rx and tx buffers
 #define FT_PURGE_RX         1
@@ -134,6 +138,7 @@ FTDIInterface::FTDIInterface() {
 }
 
 FTDIInterface::~FTDIInterface() {
+	FT_StopReadStream();
 	if (open) {
 		libraryLoadCounter--;
 		if (devlist != nullptr) {
@@ -200,6 +205,7 @@ FTDI::FT_STATUS FTDIInterface::FT_ListDevices(void* pArg1, void* pArg2, uint32_t
 };
 
 FTDI::FT_STATUS FTDIInterface::FT_Close() {
+	FT_StopReadStream();
 	if (open)
         ftdi_usb_close(&ftdic);
 	return FTDI::FT_STATUS::FT_OK;
@@ -217,6 +223,87 @@ FTDI::FT_STATUS FTDIInterface::FT_Read(void* lpBuffer, uint32_t nBufferSize, uin
 	}
 };
 
+// Everything needed by the read stream thread
+struct FTDIInterface::ReadStream {
+	struct ftdi_context* ftdic = nullptr;
+	SPSCRingBuffer* ring = nullptr;
+	std::atomic<bool>* overrun = nullptr;
+	uint32_t chunkSize = 0;
+	unsigned int previousChunkSize = 0;
+	std::atomic<bool> running{ true };
+	std::thread thread;
+
+	// Writes to the ring, waiting for the consumer if it's full.  Gives up if the stream is stopped
+	void push(const unsigned char* data, uint32_t length) {
+		while (length) {
+			const uint32_t written = ring->write(data, length);
+			data += written;
+			length -= written;
+			if (!written) {
+				if (!running) return;
+				std::this_thread::yield();
+			}
+		}
+	}
+};
+
+// libftdi 0.x has no asynchronous reads, so there's only ever one read in flight, but it's reissued as soon as it returns.
+// ftdi_read_data() strips the status bytes from each packet, so the modem status is polled whenever a read comes back short and the chip has nothing waiting
+static void readStreamThread(FTDIInterface::ReadStream* stream) {
+	std::vector<unsigned char> buffer(stream->chunkSize);
+	while (stream->running) {
+		const int bytesRead = ftdi_read_data(stream->ftdic, buffer.data(), (int)buffer.size());
+		if (bytesRead < 0) break;
+		if (bytesRead) stream->push(buffer.data(), bytesRead);
+		if (bytesRead < (int)buffer.size()) {
+			unsigned short status = 0;
+			if ((ftdi_poll_modem_status(stream->ftdic, &status) == 0) && (status & FT_MODEM_STATUS_OE)) *stream->overrun = true;
+			if (!bytesRead) std::this_thread::yield();
+		}
+	}
+	stream->ring->close();
+}
+
+FTDI::FT_STATUS FTDIInterface::FT_StartReadStream(SPSCRingBuffer* ring, uint32_t chunkSize) {
+	if ((!ring) || (chunkSize < 64)) return FTDI::FT_STATUS::FT_INVALID_PARAMETER;
+	if (m_readStream) return FTDI::FT_STATUS::FT_OTHER_ERROR;
+
+	std::unique_ptr<ReadStream> stream(new ReadStream());
+	stream->ftdic = &ftdic;
+	stream->ring = ring;
+	stream->overrun = &m_readStreamOverrun;
+	stream->chunkSize = chunkSize;
+
+	// Anything libftdi has already read but not returned has to go first
+	if (ftdic.readbuffer_remaining) {
+		stream->push(ftdic.readbuffer + ftdic.readbuffer_offset, ftdic.readbuffer_remaining);
+		ftdic.readbuffer_offset = 0;
+		ftdic.readbuffer_remaining = 0;
+	}
+
+	ftdi_read_data_get_chunksize(&ftdic, &stream->previousChunkSize);
+	ftdi_read_data_set_chunksize(&ftdic, chunkSize);
+
+	stream->thread = std::thread(readStreamThread, stream.get());
+	m_readStream = std::move(stream);
+	return FTDI::FT_STATUS::FT_OK;
+}
+
+FTDI::FT_STATUS FTDIInterface::FT_StopReadStream() {
+	if (!m_readStream) return FTDI::FT_STATUS::FT_OK;
+
+	m_readStream->running = false;
+	if (m_readStream->thread.joinable()) m_readStream->thread.join();
+	if (m_readStream->previousChunkSize) ftdi_read_data_set_chunksize(&ftdic, m_readStream->previousChunkSize);
+
+	m_readStream.reset();
+	return FTDI::FT_STATUS::FT_OK;
+}
+
+bool FTDIInterface::readStreamOverrun() {
+	return m_readStreamOverrun.exchange(false);
+}
+
 FTDI::FT_STATUS FTDIInterface::FT_Write(void* lpBuffer, uint32_t nBufferSize, uint32_t* lpBytesWritten) { 
 	int32_t ret = ftdi_write_data(&ftdic, (unsigned char*) lpBuffer, nBufferSize);
 	if (ret < 0) {
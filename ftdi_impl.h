@@ -26,6 +26,10 @@
 #define FTDI_CLASS_H
 
 #include <ftdi.h>
+#include <memory>
+#include <atomic>
+
+class SPSCRingBuffer;
 
 namespace FTDI {	
 
@@ -171,6 +175,9 @@ namespace FTDI {
 	#define FT_DEFAULT_RX_TIMEOUT   300
 	#define FT_DEFAULT_TX_TIMEOUT   300
 
+	// Read streaming.  Size of each USB read
+	#define FT_STREAM_DEFAULT_CHUNK_SIZE	16384
+
 
 	class FTDIInterface {
 	private:
@@ -180,6 +187,14 @@ namespace FTDI {
 		struct ftdi_device_list *devlist = nullptr, *curdev = nullptr;
 		struct usb_device *dev = nullptr;
 		int libraryLoadCounter = 0;
+
+	public:
+		// State for FT_StartReadStream, only used inside ftdi_impl.cpp
+		struct ReadStream;
+	private:
+		std::unique_ptr<ReadStream> m_readStream;
+		// Set by the read stream when the chip reports an overrun.  Kept after the stream stops until readStreamOverrun() is called
+		std::atomic<bool> m_readStreamOverrun{ false };
 	public:
 
 		FTDIInterface();
@@ -196,6 +211,16 @@ namespace FTDI {
 		FT_STATUS FT_Close();
 
 		FT_STATUS FT_Read(void* lpBuffer, uint32_t nBufferSize, uint32_t* lpBytesReturned);
+
+		// Starts streaming everything received into ring from a background thread.  Reads of chunkSize bytes are kept going back to back
+		// so the chip's FIFO is always being drained.  Don't call FT_Read while streaming
+		FT_STATUS FT_StartReadStream(SPSCRingBuffer* ring, uint32_t chunkSize = FT_STREAM_DEFAULT_CHUNK_SIZE);
+		// Stops the stream.  The ring is closed once the last of the data has been written to it
+		FT_STATUS FT_StopReadStream();
+		// Returns TRUE if a read stream is running
+		bool isReadStreaming() const { return m_readStream != nullptr; };
+		// Returns TRUE if the chip flagged an overrun during a read stream since this was last called, and clears it
+		bool readStreamOverrun();
 		FT_STATUS FT_Write(void* lpBuffer, uint32_t nBufferSize, uint32_t* lpBytesWritten);
 
 		FT_STATUS FT_IoCtl(uint32_t dwIoControlCode, void* lpInBuf, uint32_t nInBufSize, void* lpOutBuf, uint32_t nOutBufSize, uint32_t* lpBytesReturned, void* lpOverlapped);
@@ -20,6 +20,19 @@ bool isReading = false;
 bool isWriting = false;
 pthread_t workerThread;
 
+// Show the result of an operation, adding how many tracks or blocks were skipped if there were any
+static void ShowResultMessage(const char *message, int skippedMessage, unsigned int skipped)
+{
+    if (skipped)
+    {
+        char details[256];
+        snprintf(details, sizeof(details), GetString(skippedMessage), skipped);
+        ShowMessage(PROGRAM_NAME, (std::string(message) + "\n\n" + details).c_str(), LS(BUTTON_OK));
+    }
+    else
+        ShowMessage(PROGRAM_NAME, message, LS(BUTTON_OK));
+}
+
 // Worker thread function
 void *writeFunction(void *arg)
 {
@@ -31,6 +44,8 @@ void *writeFunction(void *arg)
     int32_t mode = params->mode;
     bool verify = params->verify;
     bool precomp = params->precomp;
+    bool delta = params->delta;
+    unsigned int tracksSkipped = 0;
     bool hdMode = false;
     bool isSCP = true;
     bool isIPF = false;
@@ -154,7 +169,7 @@ void *writeFunction(void *arg)
                 if (*params->running)
                     return WriteResponse::wrContinue;
                 else
-                    return WriteResponse::wrAbort; });
+                    return WriteResponse::wrAbort; }, delta, &tracksSkipped);
         break;
     }
     case MODE_IMG:
@@ -201,7 +216,7 @@ void *writeFunction(void *arg)
         ShowMessage(PROGRAM_NAME, LS(BAD_SCP_FILE), LS(BUTTON_OK));
         break;
     case ADFResult::adfrComplete:
-        ShowMessage(PROGRAM_NAME, LS(FILE_WRITTEN), LS(BUTTON_OK));
+        ShowResultMessage(LS(FILE_WRITTEN), MSG_TRACKS_SKIPPED, tracksSkipped);
         break;
     case ADFResult::adfrExtendedADFNotSupported:
         ShowMessage(PROGRAM_NAME, LS(EXTENDED_ADF_NOT_SUPPORTED), LS(BUTTON_OK));
@@ -220,7 +235,7 @@ void *writeFunction(void *arg)
         ShowMessage(PROGRAM_NAME, LS(FIRMWARE_TOO_OLD), LS(BUTTON_OK));
         break;
     case ADFResult::adfrCompletedWithErrors:
-        ShowMessage(PROGRAM_NAME, LS(FILE_WRITTEN_ERRORS), LS(BUTTON_OK));
+        ShowResultMessage(LS(FILE_WRITTEN_ERRORS), MSG_TRACKS_SKIPPED, tracksSkipped);
         break;
     case ADFResult::adfrAborted:
         ShowMessage(PROGRAM_NAME, LS(WRITING_ABORTED), LS(BUTTON_OK));
@@ -267,6 +282,8 @@ void *readFunction(void *arg)
     int32_t mode = params->mode;
     bool hdMode = params->hdMode;
     bool tracks82 = params->tracks82;
+    bool amigaDOS = params->amigaDOS;
+    std::vector<unsigned int> skippedBlocks;
 
     if (!taskWriter->openDevice(portName))
     {
@@ -342,7 +359,7 @@ void *readFunction(void *arg)
     switch (mode)
     {
     case MODE_ADF:
-        result = taskWriter->DiskToADF(params->fileName, hdMode, tracks, callback);
+        result = taskWriter->DiskToADF(params->fileName, hdMode, tracks, callback, amigaDOS, &skippedBlocks);
         break;
     case MODE_SCP:
         result = taskWriter->DiskToSCP(params->fileName, hdMode, tracks, 3, callback);
@@ -356,7 +373,7 @@ void *readFunction(void *arg)
     switch (result)
     {
     case ADFResult::adfrComplete:
-        ShowMessage(PROGRAM_NAME, LS(FILE_CREATED), LS(BUTTON_OK));
+        ShowResultMessage(LS(FILE_CREATED), MSG_BLOCKS_SKIPPED, skippedBlocks.size());
         break;
     case ADFResult::adfrAborted:
         ShowMessage(PROGRAM_NAME, LS(FILE_ABORTED), LS(BUTTON_OK));
@@ -372,7 +389,7 @@ void *readFunction(void *arg)
         ShowMessage(PROGRAM_NAME, LS(FIRMWARE_V18_REQUIRED), LS(BUTTON_OK));
         break;
     case ADFResult::adfrCompletedWithErrors:
-        ShowMessage(PROGRAM_NAME, LS(FILE_CREATED_PARTIAL), LS(BUTTON_OK));
+        ShowResultMessage(LS(FILE_CREATED_PARTIAL), MSG_BLOCKS_SKIPPED, skippedBlocks.size());
         break;
     case ADFResult::adfrDriveError:
         ShowMessage(PROGRAM_NAME, LS(ERROR_COMM_ARDUINO), LS(BUTTON_OK));
@@ -397,7 +414,7 @@ void *readFunction(void *arg)
     return NULL;
 }
 
-void StartWrite(std::string portName, bool verify, bool pcw, int tracksA[83], int tracksB[83])
+void StartWrite(std::string portName, bool verify, bool pcw, bool delta, int tracksA[83], int tracksB[83])
 {
     stopWorking = false;
     if (!std::filesystem::exists(fileNameWrite))
@@ -463,6 +480,7 @@ void StartWrite(std::string portName, bool verify, bool pcw, int tracksA[83], in
         params->portName = portName.c_str();
         params->verify = verify;
         params->precomp = pcw;
+        params->delta = delta;
         pthread_create(&workerThread, NULL, writeFunction, params);
     }
     else
@@ -473,7 +491,7 @@ void StartWrite(std::string portName, bool verify, bool pcw, int tracksA[83], in
     isWriting = false;
 }
 
-void StartRead(std::string portName, bool verify, bool tracks82, int tracksA[83], int tracksB[83])
+void StartRead(std::string portName, bool verify, bool tracks82, bool amigaDOS, int tracksA[83], int tracksB[83])
 {
     stopWorking = false;
 
@@ -533,6 +551,7 @@ void StartRead(std::string portName, bool verify, bool tracks82, int tracksA[83]
         params->portName = portName.c_str();
         params->verify = verify;
         params->tracks82 = tracks82;
+        params->amigaDOS = amigaDOS;
         int pid = pthread_create(&workerThread, NULL, readFunction, params);
     }
     else
@@ -36,7 +36,9 @@ typedef struct __attribute__((packed))
     bool hdMode;
     bool verify;
     bool precomp;
+    bool delta;
     bool tracks82;
+    bool amigaDOS;
     bool *running;
     int *tracksA; // Pointer to tracksA array
     int *tracksB; // Pointer to tracksB array
@@ -54,7 +56,9 @@ enum
     OBJ_SELECT_READ_FILE,
     OBJ_WRITE_VERIFY,
     OBJ_WRITE_PCW,
+    OBJ_WRITE_DELTA,
     OBJ_READ_TRACKS82,
+    OBJ_READ_AMIGADOS,
     OBJ_PORT_LIST,
     OBJ_HD_MODE,
     OBJ_LEFT_COL,
@@ -75,11 +79,11 @@ enum
 void *writeFunction(void *arg);
 void *readFunction(void *arg);
 #ifndef RAGUI
-void StartWrite(std::string portName, bool verify, bool pcw, int tracksA[83], int tracksB[83]);
-void StartRead(std::string portName, bool verify, bool tracks82, int tracksA[83], int tracksB[83]);
+void StartWrite(std::string portName, bool verify, bool pcw, bool delta, int tracksA[83], int tracksB[83]);
+void StartRead(std::string portName, bool verify, bool tracks82, bool amigaDOS, int tracksA[83], int tracksB[83]);
 #else
-void StartWrite(std::string portName, bool verify, bool pcw, int tracksA[83], int tracksB[83], struct Window *window);
-void StartRead(std::string portName, bool verify, bool tracks82, int tracksA[83], int tracksB[83], struct Window *window);
+void StartWrite(std::string portName, bool verify, bool pcw, bool delta, int tracksA[83], int tracksB[83], struct Window *window);
+void StartRead(std::string portName, bool verify, bool tracks82, bool amigaDOS, int tracksA[83], int tracksB[83], struct Window *window);
 #endif
 
 #endif
\ No newline at end of file
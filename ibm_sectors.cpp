@@ -23,11 +23,14 @@
  #include <cmath>
  #endif
  #include "ibm_sectors.h"
+ #include "mfm_kernels.h"
  
  namespace IBM {
  
  #define IBM_DD_SECTORS 9
  #define IBM_HD_SECTORS 18
+ // Largest sector size code we accept, 2^(5+7) = MaxSectorSize
+ #define IBM_MAX_SECTOR_LENGTH 5
  
      // IAM A1A1A1FC
  #define MFM_SYNC_TRACK_HEADER				0x5224522452245552ULL
@@ -37,6 +40,9 @@
  #define MFM_SYNC_SECTOR_DATA				0x4489448944895545ULL
  // DDAM A1A1A1F8 (deleted data address mark)
  #define MFM_SYNC_DELETED_SECTOR_DATA        0x448944894489554AULL
+ // The sync words that make up the above
+ #define MFM_SYNC_WORD                       0x4489
+ #define MFM_SYNC_WORD_TRACK_HEADER          0x5224
  
  #pragma pack(push, 1)
      typedef struct {
@@ -81,8 +87,7 @@
      // IDAM data
      typedef struct {
          unsigned char dataMark[4]; // should be 0xA1A1A1FB
-         std::vector<unsigned char> data; // *should* be 512 but doesn't have to be
-         unsigned char crc[2];
+         unsigned char crc[2];      // the data (*should* be 512 but doesn't have to be) is decoded straight into the DecodedTrack
      } IBMSectorData;
  
      typedef struct {
@@ -99,43 +104,103 @@
      } IBMTrack;
  
  
+     DecodedTrack::DecodedTrack() {
+         // One extra sector on the end for the workspace
+         m_arena.resize((MaxSectorsPerTrack + 1) * MaxSectorSize);
+         for (uint32_t sector = 0; sector < MaxSectorsPerTrack; sector++)
+             sectors[sector].data = m_arena.data() + (sector * MaxSectorSize);
+     }
+ 
+     DecodedSector* DecodedTrack::add(const uint32_t sector, const uint32_t size) {
+         if ((sector >= MaxSectorsPerTrack) || (size > MaxSectorSize)) return nullptr;
+         found.set(sector);
+         sectors[sector].numErrors = 0;
+         sectors[sector].size = size;
+         return &sectors[sector];
+     }
+ 
      // Simple byte swap
      inline uint16_t wordSwap(uint16_t w) {
          return (w << 8) | (w >> 8);
      }
  
-     // CRC16
-     uint16_t crc16(char* pData, int length, uint32_t wCrc = 0xFFFF) {
-         uint8_t i;
-         while (length--) {
-             wCrc ^= *(unsigned char*)pData++ << 8;
-             for (i = 0; i < 8; i++)
-                 wCrc = wCrc & 0x8000 ? (wCrc << 1) ^ 0x1021 : wCrc << 1;
+     // CRC-CCITT lookup tables for slicing-by-8.  value[0] is the normal byte table, and value[n] is
+     // the effect of a byte that has n more bytes after it, so 8 bytes can be folded in at once
+     struct CRC16Table {
+         uint16_t value[8][256];
+ 
+         constexpr CRC16Table() : value() {
+             for (int byte = 0; byte < 256; byte++) {
+                 uint16_t crc = (uint16_t)(byte << 8);
+                 for (int bit = 0; bit < 8; bit++)
+                     crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+                 value[0][byte] = crc;
+             }
+             for (int slice = 1; slice < 8; slice++)
+                 for (int byte = 0; byte < 256; byte++) {
+                     const uint16_t previous = value[slice - 1][byte];
+                     value[slice][byte] = (uint16_t)((previous << 8) ^ value[0][previous >> 8]);
+                 }
          }
-         return wCrc & 0xffff;
+     };
+     static constexpr CRC16Table CRC16Tables;
+ 
+     // CRC16 - 8 bytes at a time, then any left over one at a time
+     uint16_t crc16(const void* data, size_t length, uint16_t crc) {
+         const uint8_t* pData = (const uint8_t*)data;
+         while (length >= 8) {
+             crc = CRC16Tables.value[7][pData[0] ^ (crc >> 8)] ^ CRC16Tables.value[6][pData[1] ^ (crc & 0xFF)] ^
+                   CRC16Tables.value[5][pData[2]] ^ CRC16Tables.value[4][pData[3]] ^
+                   CRC16Tables.value[3][pData[4]] ^ CRC16Tables.value[2][pData[5]] ^
+                   CRC16Tables.value[1][pData[6]] ^ CRC16Tables.value[0][pData[7]];
+             pData += 8;
+             length -= 8;
+         }
+         while (length--)
+             crc = (uint16_t)((crc << 8) ^ CRC16Tables.value[0][*pData++ ^ (crc >> 8)]);
+         return crc;
      }
  
-     // Extract the data, properly aligned into the output
-     void extractMFMDecodeRaw(const unsigned char* inTrack, const uint32_t dataLengthInBits, const uint32_t bitPos, uint32_t outputBytes, uint8_t* output) {
-         unsigned char byteOut = 0;
-         unsigned int byteOutPosition = 0;
+     // Lookup table to pull the 4 data bits out of a byte of MFM (the odd bits, clock bits are the even ones)
+     struct MFMDataTable {
+         uint8_t value[256];
  
-         uint32_t realBitPos = bitPos + 1;  // the +1 skips past the clock bit
+         constexpr MFMDataTable() : value() {
+             for (int byte = 0; byte < 256; byte++)
+                 value[byte] = (uint8_t)(((byte >> 3) & 8) | ((byte >> 2) & 4) | ((byte >> 1) & 2) | (byte & 1));
+         }
+     };
+     static constexpr MFMDataTable MFMDataBits;
  
-         unsigned char* memOut = output;
+     // Decodes 16 bits of MFM (big-endian, starting with a clock bit) into a byte
+     static inline uint8_t decodeMFMWord(const uint32_t mfm) {
+         return (uint8_t)((MFMDataBits.value[(mfm >> 8) & 0xFF] << 4) | MFMDataBits.value[mfm & 0xFF]);
+     }
  
-         while (outputBytes) {
-             for (uint32_t bit = 0; bit <= 7; bit++) {
-                 *memOut <<= 1;
-                 const uint32_t trackBytePos = realBitPos >> 3;
-                 const uint32_t trackBitPos = 7 - (realBitPos & 7);
-                 if (inTrack[trackBytePos] & (1 << trackBitPos)) *memOut |= 1;
-                 realBitPos = (realBitPos + 2) % dataLengthInBits;  // skip those clock bits
+     // Extract the data, properly aligned into the output
+     void extractMFMDecodeRaw(const unsigned char* inTrack, const uint32_t dataLengthInBits, const uint32_t bitPos, uint32_t outputBytes, uint8_t* output) {
+         if (dataLengthInBits & 7) {
+             // Not a whole number of bytes, so do it the slow way
+             uint32_t realBitPos = (bitPos + 1) % dataLengthInBits;  // the +1 skips past the clock bit
+             for (unsigned char* memOut = output; outputBytes; outputBytes--, memOut++) {
+                 for (uint32_t bit = 0; bit <= 7; bit++) {
+                     *memOut <<= 1;
+                     if (inTrack[realBitPos >> 3] & (1 << (7 - (realBitPos & 7)))) *memOut |= 1;
+                     realBitPos = (realBitPos + 2) % dataLengthInBits;  // skip those clock bits
+                 }
              }
-             // Move along and reset
-             memOut++;
-             outputBytes--;
+             return;
+         }
+ 
+         // Each output byte is 16 bits of MFM, so read 32 bits at a time and decode it through the table
+         const MFM::BitReader reader(inTrack, dataLengthInBits >> 3, (int)(bitPos % dataLengthInBits));
+         uint32_t count = 0;
+         for (; count + 2 <= outputBytes; count += 2) {
+             const uint32_t mfm = reader.readBits(count * 2);
+             output[count] = decodeMFMWord(mfm >> 16);
+             output[count + 1] = decodeMFMWord(mfm);
          }
+         if (count < outputBytes) output[count] = decodeMFMWord(reader.readBits(count * 2) >> 16);
      }
  
      // Searches for sectors - you can re-call this and it will update decodedTrack rather than replace it
@@ -144,11 +209,6 @@
          const uint32_t cylinder = trackNumber / 2;
          const bool upperSide = trackNumber & 1;
  
-         // Prepare our test buffer
-         uint64_t decoded = 0;
- 
-         int nextTrackBitCount = 0;
-         int i = 0;
          IBMSector sector;
  
          bool headerFound = false;
@@ -164,13 +224,28 @@
          uint32_t gapTotal = 0;
          uint32_t numGaps = 0;
  
-         // run the entire track length with some space to wrap around
-         for (uint32_t bit = 0; bit < dataLengthInBits; bit++) {
-             const uint32_t realBitPos = bit % dataLengthInBits;
-             const uint32_t trackBytePos = realBitPos >> 3;
-             const uint32_t trackBitPos = 7 - (realBitPos & 7);
-             decoded <<= 1ULL;   // shift off one bit to make room for the new bit
-             if (track[trackBytePos] & (1 << trackBitPos)) decoded |= 1;
+         // Find every pair of sync words at all bit alignments at once.  Each position is the last bit of the pair, so if it's
+         // the first two of the three sync words the whole 64-bit marker ends 32 bits later
+         std::vector<uint32_t>& syncPositions = decodedTrack.syncPositions[0];
+         std::vector<uint32_t>& trackSyncPositions = decodedTrack.syncPositions[1];
+         MFM::findSyncOffsets(track, dataLengthInBits >> 3, MFM_SYNC_WORD, syncPositions);
+         MFM::findSyncOffsets(track, dataLengthInBits >> 3, MFM_SYNC_WORD_TRACK_HEADER, trackSyncPositions);
+ 
+         // Then work through them in track order
+         size_t syncIndex = 0;
+         size_t trackSyncIndex = 0;
+         while ((syncIndex < syncPositions.size()) || (trackSyncIndex < trackSyncPositions.size())) {
+             uint32_t pairEnd;
+             if ((trackSyncIndex >= trackSyncPositions.size()) || ((syncIndex < syncPositions.size()) && (syncPositions[syncIndex] < trackSyncPositions[trackSyncIndex])))
+                 pairEnd = syncPositions[syncIndex++];
+             else
+                 pairEnd = trackSyncPositions[trackSyncIndex++];
+ 
+             // bit is the last bit of the marker, the same as it was when this scanned a bit at a time
+             const uint32_t bit = pairEnd + 32;
+             if (bit >= dataLengthInBits) continue;
+             const MFM::BitReader marker(track, dataLengthInBits >> 3, (int)(bit + 1 - 64));
+             const uint64_t decoded = (((uint64_t)marker.readBits(0)) << 32) | marker.readBits(4);
  
              if (decoded == MFM_SYNC_SECTOR_HEADER) {
                  // Grab sector header
@@ -185,7 +260,7 @@
                  }
  
                  extractMFMDecodeRaw(track, dataLengthInBits, bit + 1 - 64, sizeof(sector.header), (uint8_t*)&sector.header);
-                 uint16_t crc = crc16((char*)&sector.header, sizeof(sector.header) - 2);
+                 uint16_t crc = crc16(&sector.header, sizeof(sector.header) - 2);
                  sector.headerErrors = 0;
                  headerFound = true;
                  if (sector.header.sector < 1) {
@@ -194,6 +269,10 @@
                  }
  
                  if (crc != wordSwap(*(uint16_t*)sector.header.crc)) sector.headerErrors++;
+                 if (sector.header.length > IBM_MAX_SECTOR_LENGTH) {
+                     sector.header.length = sectorSize;
+                     sector.headerErrors++;
+                 }
                  if (!sector.headerErrors) sectorSize = sector.header.length;
                  if (sector.header.cylinder != cylinder) sector.headerErrors++;
                  if (sector.header.head != (upperSide ? 1 : 0)) sector.headerErrors++;
@@ -215,37 +294,39 @@
                      }
                      if (headerFound) {
                          const uint32_t sectorDataSize = 1 << (7 + sector.header.length);
-                         if (sector.data.data.size() != sectorDataSize) sector.data.data.resize(sectorDataSize);
+                         uint8_t* sectorData = decodedTrack.workspace();
                          uint32_t bitStart = bit + 1 - 64;
                          // Extract the header section
                          extractMFMDecodeRaw(track, dataLengthInBits, bitStart, 4, (uint8_t*)&sector.data.dataMark);
                          // Extract the sector data
                          bitStart += 4 * 8 * 2;
-                         extractMFMDecodeRaw(track, dataLengthInBits, bitStart, (uint32_t)sector.data.data.size(), (uint8_t*)&sector.data.data[0]);
+                         extractMFMDecodeRaw(track, dataLengthInBits, bitStart, sectorDataSize, sectorData);
                          // Extract the sector CRC
                          bitStart += sectorDataSize * 8 * 2;
                          extractMFMDecodeRaw(track, dataLengthInBits, bitStart, 2, (uint8_t*)&sector.data.crc);
                          // Validate
-                         uint16_t crc = crc16((char*)&sector.data.dataMark, 4);
-                         crc = crc16((char*)sector.data.data.data(), (uint32_t)sector.data.data.size(), crc);
+                         uint16_t crc = crc16(&sector.data.dataMark, 4);
+                         crc = crc16(sectorData, sectorDataSize, crc);
                          sector.dataValid = crc == wordSwap(*(uint16_t*)sector.data.crc);
  
                          // Standardize the sector
-                         DecodedSector sec;
-                         sec.data = sector.data.data;
-                         sec.numErrors = sector.headerErrors + sector.dataValid ? 0 : 1;
+                         const uint32_t numErrors = sector.headerErrors + sector.dataValid ? 0 : 1;
  
                          // See if this already exists 
-                         auto it = decodedTrack.sectors.find(sector.header.sector - 1);
-                         if (it == decodedTrack.sectors.end()) {
-                             if (sector.header.sector <= 22)
-                                 decodedTrack.sectors.insert(std::make_pair(sector.header.sector - 1, sec));
+                         DecodedSector* it = decodedTrack.find(sector.header.sector - 1);
+                         if (!it) {
+                             it = decodedTrack.add(sector.header.sector - 1, sectorDataSize);
+                             if (it) {
+                                 memcpy(it->data, sectorData, sectorDataSize);
+                                 it->numErrors = numErrors;
+                             }
                          }
                          else {
                              // Does exist. Keep the better copy
-                             if (it->second.numErrors > sec.numErrors) {
-                                 it->second.data = sec.data;
-                                 it->second.numErrors = sec.numErrors;
+                             if (it->numErrors > numErrors) {
+                                 memcpy(it->data, sectorData, sectorDataSize);
+                                 it->size = sectorDataSize;
+                                 it->numErrors = numErrors;
                              }
                          }
  
@@ -278,22 +359,22 @@
          // Add dummy sectors upto expectedSectors
          decodedTrack.sectorsWithErrors = 0;
          for (uint32_t sec = 0; sec < expectedSectors; sec++) {
-             auto it = decodedTrack.sectors.find(sec);
+             const DecodedSector* it = decodedTrack.find(sec);
  
              // Does a sector with this number exist?
-             if (it == decodedTrack.sectors.end()) {
+             if (!it) {
                  if (expectedNumSectors) {
                      // No. Create a dummy one - VERY NOT IDEAL!
-                     DecodedSector tmp;
-                     tmp.data.resize(sectorDataSize);
-                     memset(&tmp.data[0], 0, sizeof(tmp));
-                     tmp.numErrors = 0xFFFF;
-                     decodedTrack.sectors.insert(std::make_pair(sec, tmp));
+                     DecodedSector* tmp = decodedTrack.add(sec, sectorDataSize);
+                     if (tmp) {
+                         memset(tmp->data, 0, sectorDataSize);
+                         tmp->numErrors = 0xFFFF;
+                     }
                      decodedTrack.sectorsWithErrors++;
                  }
              }
              else
-                 if (it->second.numErrors) decodedTrack.sectorsWithErrors++;
+                 if (it->numErrors) decodedTrack.sectorsWithErrors++;
          }
      }
  
@@ -323,10 +404,10 @@
          serialNumber = 0;
  
          if (!decodedTrack) return false;
-         auto it = decodedTrack->sectors.find(0);
-         if (it == decodedTrack->sectors.end()) return false;
-         if (it->second.data.size() < 128) return false;
-         return getTrackDetails_IBM(it->second.data.data(), serialNumber, numHeads, totalSectors, sectorsPerTrack, bytesPerSector);
+         const DecodedSector* it = decodedTrack->find(0);
+         if (!it) return false;
+         if (it->size < 128) return false;
+         return getTrackDetails_IBM(it->data, serialNumber, numHeads, totalSectors, sectorsPerTrack, bytesPerSector);
      }
  
  
@@ -364,10 +445,17 @@
  
      // The fill is 0x4E, which endoded as MFM is
      uint32_t gapFillMFM(uint8_t* mem, const uint32_t size, const uint8_t value, uint8_t& lastByte, uint8_t* memOverflow) {
-         std::vector<uint8_t> data;
-         if (size < 1) return 0;
-         data.resize(size, value);
-         return encodeMFMdata(data.data(), mem, (uint32_t)data.size(), lastByte, memOverflow);
+         uint8_t data[256];
+         memset(data, value, sizeof(data));
+         uint32_t written = 0;
+         for (uint32_t remaining = size; remaining; ) {
+             const uint32_t chunk = std::min(remaining, (uint32_t)sizeof(data));
+             const uint32_t bytes = encodeMFMdata(data, mem + written, chunk, lastByte, memOverflow);
+             written += bytes;
+             if (bytes != chunk << 1) break;
+             remaining -= chunk;
+         }
+         return written;
      }
  
      // The fill is 0x4E, which endoded as MFM is
@@ -415,7 +503,7 @@
          uint8_t gap4bSize = 182;   // 0x4E - after all sectors
          bool writeTrackHeader = true;
  
-         if (decodedTrack->sectors.size() > 21) return 0;
+         if (decodedTrack->count() > 21) return 0;
  
          // NOTE: ALL OF THE ATARI TIMINGS NEED CHECKING!
          if (forceAtariTiming) {
@@ -425,7 +513,7 @@
              gap4bSize = 60;
          }
  
-         switch (decodedTrack->sectors.size()) {
+         switch (decodedTrack->count()) {
          case 10: // double density atari
              gap3Size = 40;
              forceAtariTiming = true;
@@ -468,7 +556,7 @@
              mem += writeMarkerMFM(mem, MFM_SYNC_TRACK_HEADER, lastByte, memOverflow);
          }
          mem += gapFillMFM(mem, gap1Size, 0x4E, lastByte, memOverflow);
-         for (uint32_t sec = 0; sec < decodedTrack->sectors.size(); sec++) {
+         for (uint32_t sec = 0; sec < decodedTrack->count(); sec++) {
              const DecodedSector& sector = decodedTrack->sectors[sec];
  
              mem += writeRawMFM(mem, 24, 0xAA, lastByte, memOverflow);
@@ -481,8 +569,8 @@
              header.cylinder = cylinder;
              header.head = upperSide ? 1 : 0;
              header.sector = sec + 1;
-             header.length = (unsigned char)(std::max(0, (int)log2(sector.data.size()) - 7));
-             *((uint16_t*)header.crc) = wordSwap(crc16((char*)&header, sizeof(header) - 2));
+             header.length = (unsigned char)(std::max(0, (int)log2(sector.size) - 7));
+             *((uint16_t*)header.crc) = wordSwap(crc16(&header, sizeof(header) - 2));
  
              mem += writeMarkerMFM(mem, MFM_SYNC_SECTOR_HEADER, lastByte, memOverflow);
              mem += encodeMFMdata(((uint8_t*)&header) + 4, mem, sizeof(header) - 4, lastByte, memOverflow);
@@ -491,11 +579,11 @@
              mem += writeRawMFM(mem, 24, 0xAA, lastByte, memOverflow);
              // Need this just for the CRC
              const uint8_t dataMark[4] = { 0xA1, 0xA1, 0xA1, 0xFB };
-             uint16_t crc = crc16((char*)&dataMark, 4);
-             crc = wordSwap(crc16((char*)sector.data.data(), (int)sector.data.size(), crc));
+             uint16_t crc = crc16(dataMark, sizeof(dataMark));
+             crc = wordSwap(crc16(sector.data, sector.size, crc));
  
              mem += writeMarkerMFM(mem, MFM_SYNC_SECTOR_DATA, lastByte, memOverflow);
-             mem += encodeMFMdata(sector.data.data(), mem, (uint32_t)sector.data.size(), lastByte, memOverflow);
+             mem += encodeMFMdata(sector.data, mem, sector.size, lastByte, memOverflow);
              mem += encodeMFMdata((uint8_t*)&crc, mem, sizeof(crc), lastByte, memOverflow);
  
              mem += gapFillMFM(mem, gap3Size, 0x4E, lastByte, memOverflow);
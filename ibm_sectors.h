@@ -16,31 +16,67 @@
 
 
  #include <stdint.h>
+ #include <stddef.h>
  #include <unordered_map>
  #include <map>
  #include <vector>
+ #include <bitset>
  
  namespace IBM {
  
      static const uint32_t MaxTrackSize = (0x3A00 * 2);
  
-     typedef std::vector<uint8_t> RawDecodedSector;
+     static const uint32_t MaxSectorsPerTrack = 22;
+     static const uint32_t MaxSectorSize = 4096;     // 2^(length+7), length can be up to 5
  
      // Structure to hold data while we decode it
      typedef struct {
          uint32_t numErrors = 0;					// Number of decoding errors found
-         RawDecodedSector data;          // decoded sector data
+         uint32_t size = 0;              // size of the sector data in bytes
+         uint8_t* data = nullptr;        // decoded sector data, this points into the DecodedTrack's arena
      } DecodedSector;
  
      // To hold a list of valid and checksum failed sectors
+     // Each sector number has its own slot, and all the sector data lives in one block that's allocated with the track and reused
+     // for every retry and every track, so decoding doesn't need to allocate anything
      struct DecodedTrack {
-         // A map of sector number to valid sectors 
-         std::map<int, DecodedSector> sectors;
+         // Slots indexed by sector number (0 based).  Only the ones marked in found are in use
+         DecodedSector sectors[MaxSectorsPerTrack];
+         std::bitset<MaxSectorsPerTrack> found;
  
          uint32_t sectorsWithErrors = 0;
+ 
+         DecodedTrack();
+         DecodedTrack(const DecodedTrack&) = delete;
+         DecodedTrack& operator=(const DecodedTrack&) = delete;
+ 
+         // Empties the track, the memory is kept for next time
+         void clear() { found.reset(); sectorsWithErrors = 0; }
+ 
+         // Number of sectors in the track
+         uint32_t count() const { return (uint32_t)found.count(); }
+ 
+         // Returns the sector, or nullptr if it hasn't been found
+         DecodedSector* find(const uint32_t sector) { return ((sector < MaxSectorsPerTrack) && found[sector]) ? &sectors[sector] : nullptr; }
+         const DecodedSector* find(const uint32_t sector) const { return ((sector < MaxSectorsPerTrack) && found[sector]) ? &sectors[sector] : nullptr; }
+ 
+         // Marks the sector as found and sets its size.  The data isn't cleared.  Returns nullptr if sector or size are out of range
+         DecodedSector* add(const uint32_t sector, const uint32_t size);
+ 
+         // Scratch space (MaxSectorSize bytes) to decode a sector into before deciding if it should replace the one in its slot
+         uint8_t* workspace() { return m_arena.data() + (MaxSectorsPerTrack * MaxSectorSize); }
+ 
+         // Where findSectors_IBM keeps the sync positions it finds, kept here so the memory is reused
+         std::vector<uint32_t> syncPositions[2];
+ 
+     private:
+         std::vector<uint8_t> m_arena;
      };
  
  
+     // CRC-CCITT as used by the sector headers and data.  Pass the previous result back in as crc to carry on over more data
+     uint16_t crc16(const void* data, size_t length, uint16_t crc = 0xFFFF);
+
      // Feed in Track 0, sector 0 and this will try to extract the number of sectors per track, or 0 on error
      bool getTrackDetails_IBM(const uint8_t* sector, uint32_t& serialNumber, uint32_t& numHeads, uint32_t& totalSectors, uint32_t& sectorsPerTrack, uint32_t& bytesPerSector);
      
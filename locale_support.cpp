@@ -124,7 +124,11 @@ static const char *DefaultStrings[] = {
     "Failed to lock public screen",                                                                               // MSG_DEBUG_FAILED_LOCK_SCREEN
     "Failed to open main window",                                                                                 // MSG_ERROR_FAILED_OPEN_WINDOW
     "Failed to create main window",                                                                               // MSG_ERROR_FAILED_CREATE_WINDOW
-    "Gadget %ld"                                                                                                  // MSG_DEBUG_UNKNOWN_GADGET
+    "Gadget %ld",                                                                                                 // MSG_DEBUG_UNKNOWN_GADGET
+    "Delta",                                                                                                      // MSG_DELTA
+    "%u tracks already matched the file and were not rewritten",                                                  // MSG_TRACKS_SKIPPED
+    "AmigaDOS",                                                                                                   // MSG_AMIGADOS
+    "%u unreadable free blocks were left blank"                                                                   // MSG_BLOCKS_SKIPPED
 };
 
 void InitLocaleLibrary(void)
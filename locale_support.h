@@ -120,7 +120,11 @@ enum
     MSG_DEBUG_FAILED_LOCK_SCREEN,
     MSG_ERROR_FAILED_OPEN_WINDOW,
     MSG_ERROR_FAILED_CREATE_WINDOW,
-    MSG_DEBUG_UNKNOWN_GADGET
+    MSG_DEBUG_UNKNOWN_GADGET,
+    MSG_DELTA,
+    MSG_TRACKS_SKIPPED,
+    MSG_AMIGADOS,
+    MSG_BLOCKS_SKIPPED
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,643 @@
+/* ArduinoFloppyReader (and writer)
+*
+* Copyright (C) 2017-2022 Robert Smith (@RobSmithDev)
+* https://amiga.robsmithdev.co.uk
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 3 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, see http://www.gnu.org/licenses/
+*/
+
+#include "mfm_kernels.h"
+#include <string.h>
+
+// Only one vector unit is compiled in, whichever the compiler is targeting
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define MFM_KERNELS_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MFM_KERNELS_NEON
+#elif defined(__ALTIVEC__)
+#include <altivec.h>
+// These clash with the STL
+#undef vector
+#undef pixel
+#undef bool
+#define MFM_KERNELS_ALTIVEC
+#ifdef __amigaos4__
+#include <proto/exec.h>
+#endif
+#endif
+
+#if defined(MFM_KERNELS_SSE2) || defined(MFM_KERNELS_NEON) || defined(MFM_KERNELS_ALTIVEC)
+#define MFM_KERNELS_VECTOR
+#endif
+
+namespace MFM {
+
+	// Data bits of an MFM long
+	static const uint32_t DataMask = 0x55555555;
+
+	// Reads 8 bytes from the track as a big-endian 64-bit value.  Anything outside of the track reads as zero
+	static inline uint64_t loadWindow(const unsigned char* track, const int dataLength, const int start) {
+		uint64_t window = 0;
+		if ((start >= 0) && (start + 8 <= dataLength)) {
+			memcpy(&window, track + start, sizeof(window));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			window = __builtin_bswap64(window);
+#endif
+		}
+		else {
+			for (int index = start; index < start + 8; index++)
+				window = (window << 8) | (((index >= 0) && (index < dataLength)) ? track[index] : 0);
+		}
+		return window;
+	}
+
+	// State shared by the sync scanners.  The track is split into 32-bit blocks, and each block is checked
+	// for all 32 possible end positions of the sync pattern in one go using a 64-bit window
+	struct SyncScanner {
+		const unsigned char* track;
+		int dataLength;
+		uint32_t totalBits;
+		int numBlocks;
+		int nextBlock = 0;
+		uint64_t invert[16];
+		std::vector<uint32_t>& offsets;
+
+		SyncScanner(const unsigned char* inTrack, const unsigned int inDataLength, const uint16_t syncWord, std::vector<uint32_t>& outOffsets) :
+			track(inTrack), dataLength((int)inDataLength), totalBits(inDataLength * 8), numBlocks((int)(inDataLength + 3) / 4), offsets(outOffsets) {
+			for (int bit = 0; bit < 16; bit++)
+				invert[bit] = (syncWord & (1 << bit)) ? 0 : ~0ULL;
+			offsets.clear();
+		}
+
+		// Check the block of 32 end-positions starting at bit (block*32).  The window holds the 32 bits before it too
+		inline void checkBlock(const int block) {
+			const uint64_t window = loadWindow(track, dataLength, (block * 4) - 4);
+
+			// Bit 'r' of match is set if the 16 bits of window starting at bit 'r' are the sync word
+			uint64_t match = ~0ULL;
+			for (int bit = 0; bit < 16; bit++)
+				match &= (window >> bit) ^ invert[bit];
+			// And we need it twice in a row
+			uint32_t hits = (uint32_t)(match & (match >> 16));
+
+			// Highest bit is the earliest in the stream
+			const uint32_t blockBit = block * 32;
+			while (hits) {
+				const int r = 31 - __builtin_clz(hits);
+				const uint32_t position = blockBit + 31 - r;
+				if (position >= totalBits) return;
+				offsets.push_back(position);
+				hits &= ~(1U << r);
+			}
+		}
+
+		// Check blocks from..to (inclusive) without re-checking any we have already done
+		inline void checkBlocks(int from, const int to) {
+			if (from < nextBlock) from = nextBlock;
+			for (int block = from; (block <= to) && (block < numBlocks); block++)
+				checkBlock(block);
+			if (to + 1 > nextBlock) nextBlock = to + 1;
+		}
+
+		// A match always contains a whole byte from candidates[] (see below).  If that byte is at 'byteIndex' the match ends in byte 'byteIndex+3'
+		inline void checkCandidates(const int firstByte, const int lastByte) {
+			checkBlocks((firstByte + 3) / 4, (lastByte + 3) / 4);
+		}
+	};
+
+	// Standard version, checks every block
+	static void findSyncScalar(const unsigned char* track, const unsigned int dataLength, const uint16_t syncWord, std::vector<uint32_t>& offsets) {
+		SyncScanner scanner(track, dataLength, syncWord, offsets);
+		scanner.checkBlocks(0, scanner.numBlocks - 1);
+	}
+
+	// Decodes numLongs longs.  Returns the checksum, without the mask applied, so it can be used to finish off a vector run
+	static inline uint32_t decodeOddEvenLongs(const uint32_t* oddInput, const uint32_t* evenInput, uint32_t* output, const unsigned int numLongs) {
+		uint32_t chksum = 0;
+		for (unsigned int count = 0; count < numLongs; count++) {
+			const uint32_t oddBits = oddInput[count];
+			const uint32_t evenBits = evenInput[count];
+			chksum ^= oddBits ^ evenBits;
+			output[count] = (evenBits & DataMask) | ((oddBits & DataMask) << 1);
+		}
+		return chksum;
+	}
+
+	// Encodes numLongs longs.  Returns the checksum, without the mask applied
+	static inline uint32_t encodeOddEvenLongs(const uint32_t* input, uint32_t* oddOutput, uint32_t* evenOutput, const unsigned int numLongs) {
+		uint32_t chksum = 0;
+		for (unsigned int count = 0; count < numLongs; count++) {
+			const uint32_t evenBits = input[count] & DataMask;
+			const uint32_t oddBits = (input[count] >> 1) & DataMask;
+			evenOutput[count] = evenBits;
+			oddOutput[count] = oddBits;
+			chksum ^= oddBits ^ evenBits;
+		}
+		return chksum;
+	}
+
+	static uint32_t decodeOddEvenScalar(const uint32_t* input, uint32_t* output, const unsigned int dataSize) {
+		const uint32_t* evenInput = (const uint32_t*)(((const unsigned char*)input) + dataSize);
+		return decodeOddEvenLongs(input, evenInput, output, dataSize / 4) & DataMask;
+	}
+
+	static uint32_t encodeOddEvenScalar(const uint32_t* input, uint32_t* output, const unsigned int dataSize) {
+		uint32_t* evenOutput = (uint32_t*)(((unsigned char*)output) + dataSize);
+		return encodeOddEvenLongs(input, output, evenOutput, dataSize / 4) & DataMask;
+	}
+
+	// The vector kernels work through 16 bytes at a time.  All of the shifts are done on masked data so no bit ever crosses
+	// into a neighbouring byte, which means the lane size and byte order don't matter.  Anything left over is done by the
+	// scalar code above
+
+#ifdef MFM_KERNELS_VECTOR
+	// Any 32-bit window matching the sync pattern must start with 0 to 7 bits of the pattern, followed by a whole byte of the track.
+	// So there are only 8 byte values that can be there.  The vector versions look for those 16 bytes at a time and only
+	// run the exact check on the blocks they could affect, which on a real track is a tiny fraction of them
+	static void getSyncCandidates(const uint16_t syncWord, uint8_t candidates[8]) {
+		const uint32_t pattern = syncWord | (((uint32_t)syncWord) << 16);
+		for (int offset = 0; offset < 8; offset++)
+			candidates[offset] = (uint8_t)(pattern >> (24 - offset));
+	}
+#endif
+
+#ifdef MFM_KERNELS_SSE2
+	static void findSyncVector(const unsigned char* track, const unsigned int dataLength, const uint16_t syncWord, std::vector<uint32_t>& offsets) {
+		SyncScanner scanner(track, dataLength, syncWord, offsets);
+		uint8_t candidates[8];
+		getSyncCandidates(syncWord, candidates);
+
+		__m128i compare[8];
+		for (int index = 0; index < 8; index++) compare[index] = _mm_set1_epi8((char)candidates[index]);
+
+		int byteIndex = 0;
+		for (; byteIndex + 16 <= scanner.dataLength; byteIndex += 16) {
+			const __m128i data = _mm_loadu_si128((const __m128i*)(track + byteIndex));
+			__m128i hit = _mm_cmpeq_epi8(data, compare[0]);
+			for (int index = 1; index < 8; index++) hit = _mm_or_si128(hit, _mm_cmpeq_epi8(data, compare[index]));
+			const int mask = _mm_movemask_epi8(hit);
+			if (mask) scanner.checkCandidates(byteIndex + __builtin_ctz(mask), byteIndex + (31 - __builtin_clz(mask)));
+		}
+		// Whatever is left over
+		scanner.checkBlocks((byteIndex + 3) / 4, scanner.numBlocks - 1);
+	}
+
+	static uint32_t decodeOddEvenVector(const uint32_t* input, uint32_t* output, const unsigned int dataSize) {
+		const unsigned char* oddInput = (const unsigned char*)input;
+		const unsigned char* evenInput = oddInput + dataSize;
+		unsigned char* out = (unsigned char*)output;
+		const unsigned int blocks = dataSize / 16;
+
+		const __m128i mask = _mm_set1_epi32((int)DataMask);
+		__m128i sum = _mm_setzero_si128();
+		for (unsigned int block = 0; block < blocks; block++) {
+			const __m128i oddBits = _mm_loadu_si128((const __m128i*)(oddInput + (block * 16)));
+			const __m128i evenBits = _mm_loadu_si128((const __m128i*)(evenInput + (block * 16)));
+			sum = _mm_xor_si128(sum, _mm_xor_si128(oddBits, evenBits));
+			_mm_storeu_si128((__m128i*)(out + (block * 16)), _mm_or_si128(_mm_and_si128(evenBits, mask), _mm_slli_epi64(_mm_and_si128(oddBits, mask), 1)));
+		}
+		uint32_t lanes[4];
+		_mm_storeu_si128((__m128i*)lanes, sum);
+		const unsigned int done = blocks * 4;
+		const uint32_t chksum = lanes[0] ^ lanes[1] ^ lanes[2] ^ lanes[3];
+		return (chksum ^ decodeOddEvenLongs(input + done, (const uint32_t*)evenInput + done, output + done, (dataSize / 4) - done)) & DataMask;
+	}
+
+	static uint32_t encodeOddEvenVector(const uint32_t* input, uint32_t* output, const unsigned int dataSize) {
+		const unsigned char* in = (const unsigned char*)input;
+		unsigned char* oddOutput = (unsigned char*)output;
+		unsigned char* evenOutput = oddOutput + dataSize;
+		const unsigned int blocks = dataSize / 16;
+
+		const __m128i mask = _mm_set1_epi32((int)DataMask);
+		__m128i sum = _mm_setzero_si128();
+		for (unsigned int block = 0; block < blocks; block++) {
+			const __m128i data = _mm_loadu_si128((const __m128i*)(in + (block * 16)));
+			const __m128i evenBits = _mm_and_si128(data, mask);
+			const __m128i oddBits = _mm_and_si128(_mm_srli_epi64(data, 1), mask);
+			_mm_storeu_si128((__m128i*)(evenOutput + (block * 16)), evenBits);
+			_mm_storeu_si128((__m128i*)(oddOutput + (block * 16)), oddBits);
+			sum = _mm_xor_si128(sum, _mm_xor_si128(oddBits, evenBits));
+		}
+		uint32_t lanes[4];
+		_mm_storeu_si128((__m128i*)lanes, sum);
+		const unsigned int done = blocks * 4;
+		const uint32_t chksum = lanes[0] ^ lanes[1] ^ lanes[2] ^ lanes[3];
+		return (chksum ^ encodeOddEvenLongs(input + done, output + done, (uint32_t*)evenOutput + done, (dataSize / 4) - done)) & DataMask;
+	}
+	static const char* VectorKernelName = "SSE2";
+#endif
+
+#ifdef MFM_KERNELS_NEON
+	static void findSyncVector(const unsigned char* track, const unsigned int dataLength, const uint16_t syncWord, std::vector<uint32_t>& offsets) {
+		SyncScanner scanner(track, dataLength, syncWord, offsets);
+		uint8_t candidates[8];
+		getSyncCandidates(syncWord, candidates);
+
+		uint8x16_t compare[8];
+		for (int index = 0; index < 8; index++) compare[index] = vdupq_n_u8(candidates[index]);
+
+		int byteIndex = 0;
+		for (; byteIndex + 16 <= scanner.dataLength; byteIndex += 16) {
+			const uint8x16_t data = vld1q_u8(track + byteIndex);
+			uint8x16_t hit = vceqq_u8(data, compare[0]);
+			for (int index = 1; index < 8; index++) hit = vorrq_u8(hit, vceqq_u8(data, compare[index]));
+			const uint64x2_t wide = vreinterpretq_u64_u8(hit);
+			if (vgetq_lane_u64(wide, 0) | vgetq_lane_u64(wide, 1)) scanner.checkCandidates(byteIndex, byteIndex + 15);
+		}
+		// Whatever is left over
+		scanner.checkBlocks((byteIndex + 3) / 4, scanner.numBlocks - 1);
+	}
+
+	static inline uint32_t foldChecksum(const uint8x16_t sum) {
+		uint32_t lanes[4];
+		vst1q_u8((uint8_t*)lanes, sum);
+		return lanes[0] ^ lanes[1] ^ lanes[2] ^ lanes[3];
+	}
+
+	static uint32_t decodeOddEvenVector(const uint32_t* input, uint32_t* output, const unsigned int dataSize) {
+		const uint8_t* oddInput = (const uint8_t*)input;
+		const uint8_t* evenInput = oddInput + dataSize;
+		uint8_t* out = (uint8_t*)output;
+		const unsigned int blocks = dataSize / 16;
+
+		const uint8x16_t mask = vdupq_n_u8(0x55);
+		uint8x16_t sum = vdupq_n_u8(0);
+		for (unsigned int block = 0; block < blocks; block++) {
+			const uint8x16_t oddBits = vld1q_u8(oddInput + (block * 16));
+			const uint8x16_t evenBits = vld1q_u8(evenInput + (block * 16));
+			sum = veorq_u8(sum, veorq_u8(oddBits, evenBits));
+			vst1q_u8(out + (block * 16), vorrq_u8(vandq_u8(evenBits, mask), vshlq_n_u8(vandq_u8(oddBits, mask), 1)));
+		}
+		const unsigned int done = blocks * 4;
+		return (foldChecksum(sum) ^ decodeOddEvenLongs(input + done, (const uint32_t*)evenInput + done, output + done, (dataSize / 4) - done)) & DataMask;
+	}
+
+	static uint32_t encodeOddEvenVector(const uint32_t* input, uint32_t* output, const unsigned int dataSize) {
+		const uint8_t* in = (const uint8_t*)input;
+		uint8_t* oddOutput = (uint8_t*)output;
+		uint8_t* evenOutput = oddOutput + dataSize;
+		const unsigned int blocks = dataSize / 16;
+
+		const uint8x16_t mask = vdupq_n_u8(0x55);
+		uint8x16_t sum = vdupq_n_u8(0);
+		for (unsigned int block = 0; block < blocks; block++) {
+			const uint8x16_t data = vld1q_u8(in + (block * 16));
+			const uint8x16_t evenBits = vandq_u8(data, mask);
+			const uint8x16_t oddBits = vandq_u8(vshrq_n_u8(data, 1), mask);
+			vst1q_u8(evenOutput + (block * 16), evenBits);
+			vst1q_u8(oddOutput + (block * 16), oddBits);
+			sum = veorq_u8(sum, veorq_u8(oddBits, evenBits));
+		}
+		const unsigned int done = blocks * 4;
+		return (foldChecksum(sum) ^ encodeOddEvenLongs(input + done, output + done, (uint32_t*)evenOutput + done, (dataSize / 4) - done)) & DataMask;
+	}
+	static const char* VectorKernelName = "NEON";
+#endif
+
+#ifdef MFM_KERNELS_ALTIVEC
+	static inline __vector unsigned char splatByte(const uint8_t value) {
+		union {
+			__vector unsigned char v;
+			uint8_t b[16];
+		} u;
+		memset(u.b, value, sizeof(u.b));
+		return u.v;
+	}
+
+	// Unaligned 16 byte load.  ptr+15 must be inside the buffer
+	static inline __vector unsigned char loadUnaligned(const unsigned char* ptr) {
+		return vec_perm(vec_ld(0, ptr), vec_ld(15, ptr), vec_lvsl(0, ptr));
+	}
+
+	static void findSyncVector(const unsigned char* track, const unsigned int dataLength, const uint16_t syncWord, std::vector<uint32_t>& offsets) {
+		SyncScanner scanner(track, dataLength, syncWord, offsets);
+		uint8_t candidates[8];
+		getSyncCandidates(syncWord, candidates);
+
+		__vector unsigned char compare[8];
+		for (int index = 0; index < 8; index++) compare[index] = splatByte(candidates[index]);
+		const __vector unsigned char zero = splatByte(0);
+
+		int byteIndex = 0;
+		for (; byteIndex + 16 <= scanner.dataLength; byteIndex += 16) {
+			const __vector unsigned char data = loadUnaligned(track + byteIndex);
+			__vector unsigned char hit = (__vector unsigned char)vec_cmpeq(data, compare[0]);
+			for (int index = 1; index < 8; index++) hit = vec_or(hit, (__vector unsigned char)vec_cmpeq(data, compare[index]));
+			if (vec_any_ne(hit, zero)) scanner.checkCandidates(byteIndex, byteIndex + 15);
+		}
+		// Whatever is left over
+		scanner.checkBlocks((byteIndex + 3) / 4, scanner.numBlocks - 1);
+	}
+
+	// Unaligned 16 byte store
+	static inline void storeUnaligned(const __vector unsigned char value, unsigned char* ptr) {
+		if ((((uintptr_t)ptr) & 15) == 0) {
+			vec_st(value, 0, ptr);
+		}
+		else {
+			union {
+				__vector unsigned char v;
+				uint8_t b[16];
+			} u;
+			u.v = value;
+			memcpy(ptr, u.b, sizeof(u.b));
+		}
+	}
+
+	static inline uint32_t foldChecksum(const __vector unsigned char sum) {
+		union {
+			__vector unsigned char v;
+			uint32_t l[4];
+		} u;
+		u.v = sum;
+		return u.l[0] ^ u.l[1] ^ u.l[2] ^ u.l[3];
+	}
+
+	static uint32_t decodeOddEvenVector(const uint32_t* input, uint32_t* output, const unsigned int dataSize) {
+		const unsigned char* oddInput = (const unsigned char*)input;
+		const unsigned char* evenInput = oddInput + dataSize;
+		unsigned char* out = (unsigned char*)output;
+		const unsigned int blocks = dataSize / 16;
+
+		const __vector unsigned char mask = splatByte(0x55);
+		const __vector unsigned char one = splatByte(1);
+		__vector unsigned char sum = splatByte(0);
+		for (unsigned int block = 0; block < blocks; block++) {
+			const __vector unsigned char oddBits = loadUnaligned(oddInput + (block * 16));
+			const __vector unsigned char evenBits = loadUnaligned(evenInput + (block * 16));
+			sum = vec_xor(sum, vec_xor(oddBits, evenBits));
+			storeUnaligned(vec_or(vec_and(evenBits, mask), vec_sl(vec_and(oddBits, mask), one)), out + (block * 16));
+		}
+		const unsigned int done = blocks * 4;
+		return (foldChecksum(sum) ^ decodeOddEvenLongs(input + done, (const uint32_t*)evenInput + done, output + done, (dataSize / 4) - done)) & DataMask;
+	}
+
+	static uint32_t encodeOddEvenVector(const uint32_t* input, uint32_t* output, const unsigned int dataSize) {
+		const unsigned char* in = (const unsigned char*)input;
+		unsigned char* oddOutput = (unsigned char*)output;
+		unsigned char* evenOutput = oddOutput + dataSize;
+		const unsigned int blocks = dataSize / 16;
+
+		const __vector unsigned char mask = splatByte(0x55);
+		const __vector unsigned char one = splatByte(1);
+		__vector unsigned char sum = splatByte(0);
+		for (unsigned int block = 0; block < blocks; block++) {
+			const __vector unsigned char data = loadUnaligned(in + (block * 16));
+			const __vector unsigned char evenBits = vec_and(data, mask);
+			const __vector unsigned char oddBits = vec_and(vec_sr(data, one), mask);
+			storeUnaligned(evenBits, evenOutput + (block * 16));
+			storeUnaligned(oddBits, oddOutput + (block * 16));
+			sum = vec_xor(sum, vec_xor(oddBits, evenBits));
+		}
+		const unsigned int done = blocks * 4;
+		return (foldChecksum(sum) ^ encodeOddEvenLongs(input + done, output + done, (uint32_t*)evenOutput + done, (dataSize / 4) - done)) & DataMask;
+	}
+	static const char* VectorKernelName = "AltiVec";
+#endif
+
+#ifdef MFM_KERNELS_VECTOR
+	// Returns TRUE if the vector unit we were compiled for is actually present
+	static bool vectorUnitAvailable() {
+#if defined(MFM_KERNELS_SSE2)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2");
+#elif defined(MFM_KERNELS_NEON)
+		// NEON is only compiled in when the compiler is targeting it, and it's mandatory on AArch64
+		return true;
+#elif defined(MFM_KERNELS_ALTIVEC)
+#ifdef __amigaos4__
+		uint32 vectorUnit = VECTORTYPE_NONE;
+		IExec->GetCPUInfoTags(GCIT_VectorUnit, &vectorUnit, TAG_DONE);
+		return vectorUnit == VECTORTYPE_ALTIVEC;
+#else
+		return true;
+#endif
+#endif
+	}
+#endif
+
+	// Clock bit table, indexed by [previous data bit][byte with only the data bits set].  A clock bit is a '1' only if the data bits either side of it are both '0'
+	struct ClockTable {
+		uint8_t value[2][256];
+
+		constexpr ClockTable() : value() {
+			for (int lastBit = 0; lastBit < 2; lastBit++)
+				for (int byte = 0; byte < 256; byte++) {
+					int output = byte;
+					int previous = lastBit;
+					// Clock bits are bits 7, 5, 3 and 1.  Data is 6, 4, 2, 0
+					for (int bit = 7; bit >= 1; bit -= 2) {
+						const int current = (byte >> (bit - 1)) & 1;
+						if (!(previous || current)) output |= 1 << bit;
+						previous = current;
+					}
+					value[lastBit][byte] = (uint8_t)output;
+				}
+		}
+	};
+	static constexpr ClockTable ClockBits;
+
+	unsigned char addClockBits(unsigned char* data, const unsigned int numBytes, const unsigned char previousByte) {
+		// The previous data bit comes from the input, so each byte can be looked up independently of the last
+		unsigned char previous = previousByte;
+		for (unsigned int count = 0; count < numBytes; count++) {
+			const unsigned char current = data[count];
+			data[count] = ClockBits.value[previous & 1][current];
+			previous = current;
+		}
+		return numBytes ? data[numBytes - 1] : previousByte;
+	}
+
+	// MFM legality state machine.  The state is what the (repaired) stream has just seen:
+	//   0 = last bit was a '1', 1-3 = that many '0's since the last '1' (3 means three or more), 4 = start of the data
+	// Each table is indexed by [state][next byte]
+	static const int CheckStateStart = 4;
+	struct CheckTable {
+		uint8_t nextState[5][256];
+		uint8_t violations[5][256];
+		uint8_t repaired[5][256];
+
+		constexpr CheckTable() : nextState(), violations(), repaired() {
+			for (int startState = 0; startState < 5; startState++)
+				for (int byte = 0; byte < 256; byte++) {
+					int state = startState;
+					int output = byte;
+					int errors = 0;
+					for (int bit = 7; bit >= 0; bit--) {
+						int current = (byte >> bit) & 1;
+						// Two '1's together.  Most likely a weak bit so the second one becomes a '0'
+						if (current && (state == 0)) {
+							errors |= 1 << bit;
+							output &= ~(1 << bit);
+							current = 0;
+						}
+						if (current) state = 0;
+						else {
+							const int zeros = ((state == CheckStateStart) ? 0 : state) + 1;
+							// More than three '0's in a row
+							if (zeros > 3) errors |= 1 << bit;
+							state = (zeros > 3) ? 3 : zeros;
+						}
+					}
+					nextState[startState][byte] = (uint8_t)state;
+					violations[startState][byte] = (uint8_t)errors;
+					repaired[startState][byte] = (uint8_t)output;
+				}
+		}
+	};
+	static constexpr CheckTable CheckBits;
+
+	// Runs one byte through the state machine
+	template<bool repair>
+	static inline void checkByte(unsigned char* data, const unsigned int position, int& state, unsigned int& numViolations, std::vector<uint32_t>* violations) {
+		const unsigned char byte = data[position];
+		const unsigned char errors = CheckBits.violations[state][byte];
+		if (repair) data[position] = CheckBits.repaired[state][byte];
+		state = CheckBits.nextState[state][byte];
+		if (errors) {
+			numViolations += __builtin_popcount(errors);
+			if (violations)
+				for (int bit = 7; bit >= 0; bit--)
+					if (errors & (1 << bit)) violations->push_back((position << 3) + (7 - bit));
+		}
+	}
+
+	// Returns a non-zero value if the 64 bits in window (big-endian) break a rule, given the state before them.
+	// Clean data is by far the common case, so this lets us skip the table for whole words at a time
+	static inline uint64_t findViolations(const uint64_t window, const int state) {
+		// The bits that came before, as a '1' followed by 'state' zeros
+		const uint64_t previous = 1ULL << state;
+		const uint64_t zeros = ~window;
+		const uint64_t previousZeros = ~previous;
+		const uint64_t ones = window & ((window >> 1) | (previous << 63));
+		const uint64_t runs = zeros & ((zeros >> 1) | (previousZeros << 63)) & ((zeros >> 2) | (previousZeros << 62)) & ((zeros >> 3) | (previousZeros << 61));
+		return ones | runs;
+	}
+
+	template<bool repair>
+	static unsigned int checkMFMData(unsigned char* data, const unsigned int numBytes, std::vector<uint32_t>* violations) {
+		if (violations) violations->clear();
+		if (!numBytes) return 0;
+
+		unsigned int numViolations = 0;
+		int state = CheckStateStart;
+		// The first byte has nothing before it, so it always goes through the table
+		checkByte<repair>(data, 0, state, numViolations, violations);
+
+		unsigned int position = 1;
+		while (position + 8 <= numBytes) {
+			uint64_t window;
+			memcpy(&window, data + position, sizeof(window));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			window = __builtin_bswap64(window);
+#endif
+			if (findViolations(window, state)) {
+				for (unsigned int count = 0; count < 8; count++)
+					checkByte<repair>(data, position + count, state, numViolations, violations);
+			}
+			else {
+				// A clean word always contains a '1', so the new state is just its trailing zeros
+				state = __builtin_ctzll(window);
+			}
+			position += 8;
+		}
+		for (; position < numBytes; position++)
+			checkByte<repair>(data, position, state, numViolations, violations);
+
+		return numViolations;
+	}
+
+	unsigned int checkMFM(const unsigned char* data, const unsigned int numBytes, std::vector<uint32_t>* violations) {
+		// Nothing is written when repair is false
+		return checkMFMData<false>(const_cast<unsigned char*>(data), numBytes, violations);
+	}
+
+	unsigned int repairMFM(unsigned char* data, const unsigned int numBytes, std::vector<uint32_t>* violations) {
+		return checkMFMData<true>(data, numBytes, violations);
+	}
+
+	// The set of kernels in use
+	struct KernelTable {
+		const char* name;
+		void (*findSync)(const unsigned char* track, const unsigned int dataLength, const uint16_t syncWord, std::vector<uint32_t>& offsets);
+		uint32_t (*decodeOddEven)(const uint32_t* input, uint32_t* output, const unsigned int dataSize);
+		uint32_t (*encodeOddEven)(const uint32_t* input, uint32_t* output, const unsigned int dataSize);
+	};
+
+	static const KernelTable ScalarKernels = { "Scalar", findSyncScalar, decodeOddEvenScalar, encodeOddEvenScalar };
+#ifdef MFM_KERNELS_VECTOR
+	static const KernelTable VectorKernels = { VectorKernelName, findSyncVector, decodeOddEvenVector, encodeOddEvenVector };
+#endif
+
+	// Picked the first time any kernel is used
+	static const KernelTable& kernels() {
+#ifdef MFM_KERNELS_VECTOR
+		static const KernelTable& table = vectorUnitAvailable() ? VectorKernels : ScalarKernels;
+#else
+		static const KernelTable& table = ScalarKernels;
+#endif
+		return table;
+	}
+
+	void findSyncOffsets(const unsigned char* track, const unsigned int dataLength, const uint16_t syncWord, std::vector<uint32_t>& offsets) {
+		kernels().findSync(track, dataLength, syncWord, offsets);
+	}
+
+	uint32_t decodeOddEven(const uint32_t* input, uint32_t* output, const unsigned int dataSize) {
+		return kernels().decodeOddEven(input, output, dataSize);
+	}
+
+	uint32_t encodeOddEven(const uint32_t* input, uint32_t* output, const unsigned int dataSize) {
+		return kernels().encodeOddEven(input, output, dataSize);
+	}
+
+	uint32_t decodeOddEven(const BitReader& input, const unsigned int byteOffset, uint32_t* output, const unsigned int dataSize) {
+		// If it happens to be byte aligned the normal kernel can read it directly
+		const unsigned char* direct = input.alignedPointer(byteOffset, dataSize * 2);
+		if (direct) return decodeOddEven((const uint32_t*)direct, output, dataSize);
+
+		// Work on the big-endian values and convert at the end, the masks and shifts don't care
+		uint32_t chksum = 0;
+		for (unsigned int count = 0; count < dataSize / 4; count++) {
+			const uint32_t oddBits = input.readBits(byteOffset + (count * 4));
+			const uint32_t evenBits = input.readBits(byteOffset + dataSize + (count * 4));
+			chksum ^= oddBits ^ evenBits;
+			output[count] = bigEndianToNative((evenBits & DataMask) | ((oddBits & DataMask) << 1));
+		}
+		return bigEndianToNative(chksum) & DataMask;
+	}
+
+	void BitReader::copyBytes(const unsigned int byteOffset, unsigned char* output, const unsigned int numBytes) const {
+		const unsigned char* direct = alignedPointer(byteOffset, numBytes);
+		if (direct) {
+			memcpy(output, direct, numBytes);
+			return;
+		}
+		unsigned int count = 0;
+		for (; count + 4 <= numBytes; count += 4) {
+			const uint32_t value = readLong(byteOffset + count);
+			memcpy(output + count, &value, sizeof(value));
+		}
+		for (; count < numBytes; count++)
+			output[count] = (unsigned char)(readBits(byteOffset + count) >> 24);
+	}
+
+	const char* kernelName() {
+		return kernels().name;
+	}
+
+};
@@ -0,0 +1,134 @@
+/* ArduinoFloppyReader (and writer)
+*
+* Copyright (C) 2017-2022 Robert Smith (@RobSmithDev)
+* https://amiga.robsmithdev.co.uk
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 3 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, see http://www.gnu.org/licenses/
+*/
+
+//////////////////////////////////////////////////////////////////////////////////////////
+// Low level MFM kernels used by the ADF reader and writer                              //
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// Purpose:
+// These are the hot loops that run for every track we read or write.  Each one has a plain
+// scalar version, and where the compiler targets a vector unit (SSE2, NEON or AltiVec) a
+// vector version too.  Which set is used is decided once at runtime, so a single binary
+// still runs on PPC machines without AltiVec.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace MFM {
+
+	// Converts a big-endian long (as the bits appear on disk) into the same value you'd get reading it from memory
+	static inline uint32_t bigEndianToNative(const uint32_t value) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		return __builtin_bswap32(value);
+#else
+		return value;
+#endif
+	}
+
+	// Reads MFM data from the track starting at any bit position without copying it to a byte boundary first.
+	// Each long is put together from a 64-bit window with a funnel shift.  Positions wrap around the end of the track
+	class BitReader {
+	private:
+		const unsigned char* m_track;
+		unsigned int m_dataLength;
+		unsigned int m_totalBits;
+		unsigned int m_startBit;
+
+	public:
+		// startBit can be negative, in which case it wraps back from the end of the track
+		BitReader(const unsigned char* track, const unsigned int dataLength, const int startBit) : m_track(track), m_dataLength(dataLength), m_totalBits(dataLength * 8) {
+			int bit = startBit % (int)m_totalBits;
+			if (bit < 0) bit += m_totalBits;
+			m_startBit = (unsigned int)bit;
+		}
+
+		// Returns the 32 bits starting byteOffset bytes in, as a big-endian value
+		inline uint32_t readBits(const unsigned int byteOffset) const {
+			unsigned int bit = m_startBit + (byteOffset << 3);
+			if (bit >= m_totalBits) bit -= m_totalBits;
+			const unsigned int byte = bit >> 3;
+
+			uint64_t window = 0;
+			if (byte + 8 <= m_dataLength) {
+				memcpy(&window, m_track + byte, sizeof(window));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+				window = __builtin_bswap64(window);
+#endif
+			}
+			else {
+				for (unsigned int index = 0; index < 8; index++)
+					window = (window << 8) | m_track[(byte + index) % m_dataLength];
+			}
+			return (uint32_t)(window >> (32 - (bit & 7)));
+		}
+
+		// Returns the long at byteOffset, the same as reading a uint32_t from byte-aligned memory
+		inline uint32_t readLong(const unsigned int byteOffset) const {
+			return bigEndianToNative(readBits(byteOffset));
+		}
+
+		// Returns a pointer straight into the track if the data is byte aligned and doesn't wrap, else nullptr
+		inline const unsigned char* alignedPointer(const unsigned int byteOffset, const unsigned int numBytes) const {
+			if (m_startBit & 7) return nullptr;
+			unsigned int byte = (m_startBit >> 3) + byteOffset;
+			if (byte >= m_dataLength) byte -= m_dataLength;
+			if (byte + numBytes > m_dataLength) return nullptr;
+			return m_track + byte;
+		}
+
+		// Copies (and byte aligns) numBytes from byteOffset into output
+		void copyBytes(const unsigned int byteOffset, unsigned char* output, const unsigned int numBytes) const;
+	};
+
+	// Scans the raw track for the sync pattern (syncWord twice in a row, eg: 0x44894489).
+	// offsets receives the stream bit position of the LAST bit of every match in ascending order.
+	// Bits before the start of the track read as zero, exactly like the old bit-by-bit scanner
+	void findSyncOffsets(const unsigned char* track, const unsigned int dataLength, const uint16_t syncWord, std::vector<uint32_t>& offsets);
+
+	// Amiga odd/even MFM decode.  input holds the odd bit longs followed by the even bit longs (dataSize bytes each)
+	// output receives dataSize bytes.  Returns the checksum calculated over the MFM data.  dataSize must be a multiple of 4
+	uint32_t decodeOddEven(const uint32_t* input, uint32_t* output, const unsigned int dataSize);
+
+	// As above, but reading straight from the track.  byteOffset is where the odd longs start
+	uint32_t decodeOddEven(const BitReader& input, const unsigned int byteOffset, uint32_t* output, const unsigned int dataSize);
+
+	// Amiga odd/even MFM encode (data bits only, the clock bits are filled in later).  output receives the odd bit longs
+	// followed by the even bit longs (dataSize bytes each).  Returns the checksum calculated over the MFM data
+	uint32_t encodeOddEven(const uint32_t* input, uint32_t* output, const unsigned int dataSize);
+
+	// Fills in the MFM clock bits for data that only has the data bits set, using a lookup table keyed on the previous data bit and the byte.
+	// previousByte is the byte before data[0].  Returns the last byte written ready for the next call
+	unsigned char addClockBits(unsigned char* data, const unsigned int numBytes, const unsigned char previousByte);
+
+	// Checks the MFM data follows the encoding rules: never two '1's together and never more than three '0's in a row.
+	// Returns the number of bad bit cells.  If violations isn't nullptr it receives the bit position of each one, counting from the
+	// most significant bit of data[0].  A '1' that directly follows another is counted once and then treated as a '0' from then on
+	unsigned int checkMFM(const unsigned char* data, const unsigned int numBytes, std::vector<uint32_t>* violations = nullptr);
+
+	// As checkMFM, but also clears the second '1' of any pair in data, as that's most likely a weak bit.  Runs of '0's are only reported
+	unsigned int repairMFM(unsigned char* data, const unsigned int numBytes, std::vector<uint32_t>* violations = nullptr);
+
+	// Returns the name of the kernel set selected at runtime
+	const char* kernelName();
+
+};
@@ -57,6 +57,7 @@ void BridgePLL::reset() {
     m_latency = 0;
     m_totalRealFlux = 0;
     m_prevLatency = 0;
+    m_batch.clear();
 #ifdef ENABLE_REPLY
     m_fluxReplayData.clear();
 #endif
@@ -67,6 +68,7 @@ void BridgePLL::prepareExtractor(bool isHD, const RotationExtractor::IndexSequen
 #ifdef ENABLE_REPLY
     m_fluxReplayData.clear();
 #endif
+    m_batch.clear();
     m_extractor->reset(isHD);
     m_extractor->setIndexSequence(indexSequence);
 }
@@ -84,6 +86,7 @@ void BridgePLL::rePlayData(const unsigned int maxBufferSize, RotationExtractor::
     m_latency = 0;
     m_totalRealFlux = 0;
     m_prevLatency = 0;
+    m_batch.clear();
 
     m_extractor->reset(m_extractor->isHD());
     m_extractor->setIndexSequence(indexMarker);
@@ -179,7 +182,7 @@ void BridgePLL::addToExtractor(unsigned int numZeros, unsigned int pllTimeInNS,
             sample.pllTimeNS = pllTimePerBitcell * 3;
             realTimeInNS -= sample.timeNS;
             pllTimeInNS -= sample.pllTimeNS;
-            m_extractor->submitSequence(sample, m_indexFound);
+            queueSequence(sample, m_indexFound);
             m_indexFound = false;
             numZeros -= 3;
         }
@@ -190,6 +193,16 @@ void BridgePLL::addToExtractor(unsigned int numZeros, unsigned int pllTimeInNS,
     sample.timeNS = realTimeInNS;
     sample.pllTimeNS = pllTimeInNS;
 
-    m_extractor->submitSequence(sample, m_indexFound);
+    queueSequence(sample, m_indexFound);
     m_indexFound = false;
+}
+
+// Queue a sequence for the extractor
+void BridgePLL::queueSequence(const RotationExtractor::MFMSequenceInfo& sequence, bool isIndex) {
+    m_batch.add(sequence, isIndex);
+}
+
+// Sends everything waiting to the extractor
+void BridgePLL::flushSequences() {
+    m_batch.submit(*m_extractor);
 }
\ No newline at end of file
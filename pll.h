@@ -36,6 +36,7 @@
 #include <stdint.h>
 #include "RotationExtractor.h"
 #include <queue>
+#include <vector>
 #include <functional>
 
 
@@ -74,9 +75,15 @@ namespace PLL {
 		// If the index was discovered
 		bool m_indexFound = false;
 
+		// Sequences waiting to go to the extractor, and which of them are at the index
+		MFMSequenceBatch m_batch;
+
 		// Add data to the Rotation Extractor
 		void addToExtractor(unsigned int numZeros, unsigned int pllTimeInNS, unsigned int realTimeInNS);
 
+		// Queue a sequence for the extractor
+		void queueSequence(const RotationExtractor::MFMSequenceInfo& sequence, bool isIndex);
+
 	public:
 		// Make me - if disabled this behaves very basic which might be useful for extraction of flux to SCP
 		BridgePLL(bool enabled, bool enableReplay);
@@ -100,8 +107,11 @@ namespace PLL {
 		// Return the active rotation extractor
 		MFMExtractionTarget* rotationExtractor() { return m_extractor; }
 
+		// Sequences are passed to the extractor in blocks.  This sends what's waiting.  If the extractor gets a full rotation part way through, the rest is kept for next time
+		void flushSequences();
+
 		// Pass on some functions from the extractor
-		bool canExtract() { return m_extractor->canExtract(); }
+		bool canExtract() { flushSequences(); return m_extractor->canExtract(); }
 		bool extractRotation(RotationExtractor::MFMSample* output, unsigned int& outputBits, const unsigned int maxBufferSizeBytes, const bool usePLLTime = false) { return m_extractor->extractRotation(output, outputBits, maxBufferSizeBytes, usePLLTime); }
 		void getIndexSequence(RotationExtractor::IndexSequenceMarker& sequence) const { m_extractor->getIndexSequence(sequence); }
 		unsigned int totalTimeReceived() const { return m_extractor->totalTimeReceived(); }
@@ -0,0 +1,97 @@
+/* ArduinoFloppyReader (and writer)
+*
+* Copyright (C) 2017-2022 Robert Smith (@RobSmithDev)
+* https://amiga.robsmithdev.co.uk
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 3 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, see http://www.gnu.org/licenses/
+*/
+
+#include "ring_buffer.h"
+#include <string.h>
+#include <chrono>
+
+SPSCRingBuffer::SPSCRingBuffer(const unsigned int capacity) : m_writePosition(0), m_readPosition(0), m_consumerWaiting(false), m_closed(false) {
+	uint32_t size = 16;
+	while (size < capacity) size <<= 1;
+	m_buffer.resize(size);
+	m_mask = size - 1;
+}
+
+void SPSCRingBuffer::reset() {
+	m_writePosition = 0;
+	m_readPosition = 0;
+	m_closed = false;
+}
+
+unsigned int SPSCRingBuffer::available() const {
+	return m_writePosition.load(std::memory_order_acquire) - m_readPosition.load(std::memory_order_acquire);
+}
+
+unsigned int SPSCRingBuffer::write(const void* data, const unsigned int dataLength) {
+	const uint32_t writePosition = m_writePosition.load(std::memory_order_relaxed);
+	const uint32_t freeSpace = (uint32_t)m_buffer.size() - (writePosition - m_readPosition.load(std::memory_order_acquire));
+	const uint32_t toWrite = (dataLength < freeSpace) ? dataLength : freeSpace;
+	if (!toWrite) return 0;
+
+	// Copy in up to two parts if it wraps around the end
+	const uint32_t start = writePosition & m_mask;
+	const uint32_t firstPart = ((uint32_t)m_buffer.size() - start < toWrite) ? (uint32_t)m_buffer.size() - start : toWrite;
+	memcpy(&m_buffer[start], data, firstPart);
+	if (toWrite > firstPart) memcpy(&m_buffer[0], (const unsigned char*)data + firstPart, toWrite - firstPart);
+
+	// This has to be seen before m_consumerWaiting is checked, so it's sequentially consistent rather than just a release
+	m_writePosition.store(writePosition + toWrite);
+	signalConsumer();
+	return toWrite;
+}
+
+void SPSCRingBuffer::close() {
+	m_closed.store(true);
+	signalConsumer();
+}
+
+void SPSCRingBuffer::signalConsumer() {
+	if (m_consumerWaiting.load()) {
+		std::lock_guard<std::mutex> lock(m_waitLock);
+		m_dataReady.notify_one();
+	}
+}
+
+unsigned int SPSCRingBuffer::read(void* data, const unsigned int dataLength) {
+	const uint32_t readPosition = m_readPosition.load(std::memory_order_relaxed);
+	const uint32_t waiting = m_writePosition.load(std::memory_order_acquire) - readPosition;
+	const uint32_t toRead = (dataLength < waiting) ? dataLength : waiting;
+	if (!toRead) return 0;
+
+	const uint32_t start = readPosition & m_mask;
+	const uint32_t firstPart = ((uint32_t)m_buffer.size() - start < toRead) ? (uint32_t)m_buffer.size() - start : toRead;
+	memcpy(data, &m_buffer[start], firstPart);
+	if (toRead > firstPart) memcpy((unsigned char*)data + firstPart, &m_buffer[0], toRead - firstPart);
+
+	m_readPosition.store(readPosition + toRead, std::memory_order_release);
+	return toRead;
+}
+
+bool SPSCRingBuffer::waitForData(const unsigned int timeoutMS) {
+	if (available()) return true;
+	if (m_closed.load()) return false;
+
+	std::unique_lock<std::mutex> lock(m_waitLock);
+	// Flag that we're waiting *before* checking again, so the producer either sees the flag or we see its data
+	m_consumerWaiting.store(true);
+	m_dataReady.wait_for(lock, std::chrono::milliseconds(timeoutMS), [this]() { return (available() != 0) || m_closed.load(); });
+	m_consumerWaiting.store(false);
+
+	return available() != 0;
+}
@@ -0,0 +1,87 @@
+/* ArduinoFloppyReader (and writer)
+*
+* Copyright (C) 2017-2022 Robert Smith (@RobSmithDev)
+* https://amiga.robsmithdev.co.uk
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 3 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, see http://www.gnu.org/licenses/
+*/
+
+//////////////////////////////////////////////////////////////////////////////////////////
+// Single producer, single consumer byte ring buffer                                    //
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// Purpose:
+// Moves the data streamed from the device between the thread reading the USB port and the
+// thread decoding it.  Reading and writing never take a lock, the read and write positions
+// are on their own cache lines, and the consumer can block until data arrives rather than
+// polling with a sleep.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#define RING_BUFFER_CACHE_LINE 64
+
+class SPSCRingBuffer {
+private:
+	// Only ever written by the producer
+	alignas(RING_BUFFER_CACHE_LINE) std::atomic<uint32_t> m_writePosition;
+	// Only ever written by the consumer
+	alignas(RING_BUFFER_CACHE_LINE) std::atomic<uint32_t> m_readPosition;
+
+	// Used to wake up the consumer.  The producer only takes the lock if the consumer is actually waiting
+	alignas(RING_BUFFER_CACHE_LINE) std::atomic<bool> m_consumerWaiting;
+	std::atomic<bool> m_closed;
+	std::mutex m_waitLock;
+	std::condition_variable m_dataReady;
+
+	std::vector<unsigned char> m_buffer;
+	uint32_t m_mask;
+
+	// Wake the consumer if it's waiting
+	void signalConsumer();
+
+public:
+	// capacity is rounded up to a power of two
+	SPSCRingBuffer(const unsigned int capacity);
+
+	SPSCRingBuffer(const SPSCRingBuffer&) = delete;
+	SPSCRingBuffer& operator=(const SPSCRingBuffer&) = delete;
+
+	// Producer: adds as much of data as will fit.  Returns how much was added
+	unsigned int write(const void* data, const unsigned int dataLength);
+
+	// Producer: no more data will be written.  This wakes up the consumer
+	void close();
+
+	// Consumer: removes up to dataLength bytes.  Returns how much was read, which may be zero.  This never blocks
+	unsigned int read(void* data, const unsigned int dataLength);
+
+	// Consumer: blocks until there is data to read, the buffer is closed, or timeoutMS passes.  Returns TRUE if there is data
+	bool waitForData(const unsigned int timeoutMS);
+
+	// Number of bytes waiting to be read
+	unsigned int available() const;
+
+	// Returns TRUE if close() has been called
+	bool isClosed() const { return m_closed.load(); }
+
+	// Empty the buffer and re-open it.  Only call this when neither side is using it
+	void reset();
+};
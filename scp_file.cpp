@@ -0,0 +1,294 @@
+/* ArduinoFloppyReader (and writer)
+*
+* Copyright (C) 2017-2022 Robert Smith (@RobSmithDev)
+* https://amiga.robsmithdev.co.uk
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 3 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, see http://www.gnu.org/licenses/
+*/
+
+#include "scp_file.h"
+#include <string.h>
+
+#ifdef SCP_USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// The file is little endian whatever we're running on
+static uint32_t readLE32(const unsigned char* data) {
+	return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+static uint32_t toLE32(const uint32_t value) {
+	uint32_t output;
+	unsigned char* bytes = (unsigned char*)&output;
+	for (int a = 0; a < 4; a++) bytes[a] = (unsigned char)(value >> (a * 8));
+	return output;
+}
+
+// Adds up the bytes for the SCP checksum
+static uint32_t sumBytes(const unsigned char* data, const size_t length) {
+	uint32_t total = 0;
+	for (size_t pos = 0; pos < length; pos++) total += data[pos];
+	return total;
+}
+
+// Bytes with their bits reversed, so the first MFM bit (the top one) can be found with ctz
+static const struct BitReverseTable {
+	unsigned char value[256];
+	BitReverseTable() {
+		for (unsigned int a = 0; a < 256; a++) {
+			unsigned char reversed = 0;
+			for (unsigned int bit = 0; bit < 8; bit++)
+				if (a & (1 << bit)) reversed |= 0x80 >> bit;
+			value[a] = reversed;
+		}
+	}
+} s_bitReverse;
+
+// Divides by 25 with a multiply and a shift.  Exact for every 32-bit value
+static inline uint32_t divideBy25(const uint32_t value) {
+	return (uint32_t)(((uint64_t)value * 0x51EB851FULL) >> 35);
+}
+
+// Converts a revolution from the RotationExtractor into SCP flux cells
+void revolutionToSCP(const RotationExtractor::MFMSample* samples, const unsigned int dataLengthInBits, const bool isHDMode, SCPTrackRevolution& revolution, SCPTrackData& output) {
+	// Every flux transition is at least one bit, and a padding zero is only needed every 1.6ms, so this is always enough
+	output.resize((dataLengthInBits + 16) * 2);
+	uint8_t* cell = output.data();
+	uint32_t indexTime = 0;
+	uint32_t trackLength = 0;
+	uint32_t pendingTime = 0;         // Time since the last flux transition
+	const unsigned int timeShift = isHDMode ? 1 : 0;
+
+	for (unsigned int bitsDone = 0; bitsDone < dataLengthInBits; bitsDone += 8, samples++) {
+		const unsigned int bitsHere = (dataLengthInBits - bitsDone < 8) ? dataLengthInBits - bitsDone : 8;
+
+		// Running total of the bit times through the byte, in the order the bits are on the disk
+		uint32_t timeBefore[9];
+		timeBefore[0] = 0;
+		for (unsigned int position = 0; position < 8; position++)
+			timeBefore[position + 1] = timeBefore[position] + ((uint32_t)samples->bittime[7 - position] >> timeShift);
+
+		// Visit just the '1' bits
+		uint32_t transitions = s_bitReverse.value[samples->mfmData] & ((1U << bitsHere) - 1);
+		unsigned int start = 0;
+		while (transitions) {
+			const unsigned int position = (unsigned int)__builtin_ctz(transitions);
+			transitions &= transitions - 1;
+
+			uint32_t time = divideBy25(pendingTime + timeBefore[position + 1] - timeBefore[start]);
+			indexTime += time;
+			pendingTime = 0;
+			start = position + 1;
+
+			// Handle data too big
+			while (time > 65535) {
+				*cell++ = 0;
+				*cell++ = 0;
+				time -= 65536;
+			}
+			*cell++ = (uint8_t)(time >> 8);
+			*cell++ = (uint8_t)(time & 0xFF);
+			trackLength++;
+		}
+		pendingTime += timeBefore[bitsHere] - timeBefore[start];
+	}
+
+	revolution.indexTime = indexTime;
+	revolution.trackLength = trackLength;
+	output.resize(cell - output.data());
+}
+
+// Creates the file.  The header is written properly by finish()
+bool SCPFileWriter::open(const std::string& filename, const SCPFileHeader& header) {
+	m_header = header;
+	m_header.checksum = 0;
+	memset(m_trackOffsets, 0, sizeof(m_trackOffsets));
+	m_checksum = 0;
+
+	m_file.open(filename, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+	if (!m_file.is_open()) return false;
+
+	// Space for the header and the offsets, they're filled in at the end
+	m_file.write((const char*)&m_header, sizeof(m_header));
+	m_file.write((const char*)m_trackOffsets, sizeof(m_trackOffsets));
+	m_position = sizeof(m_header) + sizeof(m_trackOffsets);
+	return m_file.good();
+}
+
+// Adds a track.  The revolution data offsets are filled in here
+bool SCPFileWriter::writeTrack(const SCPTrackInMemory& track) {
+	if ((!m_file.is_open()) || (track.header.trackNumber >= SCP_MAX_TRACKS)) return false;
+
+	// Work out how big it is
+	const size_t tableSize = sizeof(track.header) + (track.revolution.size() * sizeof(SCPTrackRevolution));
+	size_t totalSize = tableSize;
+	for (const SCPTrackData& data : track.revolutionData) totalSize += data.size();
+	m_buffer.resize(totalSize);
+
+	// Then gather it all together
+	unsigned char* output = m_buffer.data();
+	memcpy(output, &track.header, sizeof(track.header));
+	output += sizeof(track.header);
+
+	uint32_t dataPos = (uint32_t)tableSize;
+	for (size_t a = 0; a < track.revolution.size(); a++) {
+		SCPTrackRevolution revolution;
+		revolution.indexTime = toLE32(track.revolution[a].indexTime);
+		revolution.trackLength = toLE32(track.revolution[a].trackLength);
+		revolution.dataOffset = toLE32(dataPos);
+		memcpy(output, &revolution, sizeof(revolution));
+		output += sizeof(revolution);
+		if (a < track.revolutionData.size()) dataPos += (uint32_t)track.revolutionData[a].size();
+	}
+	for (const SCPTrackData& data : track.revolutionData) {
+		memcpy(output, data.data(), data.size());
+		output += data.size();
+	}
+
+	m_file.write((const char*)m_buffer.data(), m_buffer.size());
+	if (!m_file.good()) return false;
+
+	m_trackOffsets[track.header.trackNumber] = toLE32(m_position);
+	m_position += (uint32_t)m_buffer.size();
+	m_checksum += sumBytes(m_buffer.data(), m_buffer.size());
+	return true;
+}
+
+// Fills in the checksum and the track offsets and closes the file
+bool SCPFileWriter::finish() {
+	if (!m_file.is_open()) return false;
+
+	// The checksum covers everything after the header
+	m_header.checksum = toLE32(m_checksum + sumBytes((const unsigned char*)m_trackOffsets, sizeof(m_trackOffsets)));
+
+	m_file.seekp(0, std::ofstream::beg);
+	m_file.write((const char*)&m_header, sizeof(m_header));
+	m_file.write((const char*)m_trackOffsets, sizeof(m_trackOffsets));
+	const bool ok = m_file.good();
+	m_file.close();
+	return ok;
+}
+
+// Opens the file and checks the header
+SCPImage::Result SCPImage::open(const std::string& filename) {
+	close();
+
+#ifdef SCP_USE_MMAP
+	const int handle = ::open(filename.c_str(), O_RDONLY);
+	if (handle >= 0) {
+		struct stat info;
+		if ((fstat(handle, &info) == 0) && (info.st_size > 0)) {
+			void* mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, handle, 0);
+			if (mapped != MAP_FAILED) {
+				m_mapped = (const unsigned char*)mapped;
+				m_fileSize = (size_t)info.st_size;
+			}
+		}
+		::close(handle);
+	}
+#endif
+
+	if (!m_mapped) {
+		m_file = fopen(filename.c_str(), "rb");
+		if (!m_file) return Result::rFileError;
+		if (fseek(m_file, 0, SEEK_END) != 0) return Result::rFileIOError;
+		const long size = ftell(m_file);
+		if (size < 0) return Result::rFileIOError;
+		m_fileSize = (size_t)size;
+	}
+
+	const unsigned char* start = fetch(0, sizeof(SCPFileHeader) + sizeof(m_trackOffsets));
+	if (!start) return (m_fileSize < sizeof(SCPFileHeader) + sizeof(m_trackOffsets)) ? Result::rBadFile : Result::rFileIOError;
+	memcpy(&m_header, start, sizeof(m_header));
+	m_header.checksum = readLE32(start + 12);
+	for (unsigned int track = 0; track < SCP_MAX_TRACKS; track++)
+		m_trackOffsets[track] = readLE32(start + sizeof(SCPFileHeader) + (track * 4));
+
+	// Validate the format that we support
+	if ((m_header.headerSCP[0] != 'S') || (m_header.headerSCP[1] != 'C') || (m_header.headerSCP[2] != 'P')) return Result::rBadFile;
+	if (m_header.numHeads != 0) return Result::rBadFile;
+	if (m_header.flags & (1 << BITFLAG_EXTENDED)) return Result::rBadFile;
+	if ((m_header.bitcellEncoding != 0) && (m_header.bitcellEncoding != 16)) return Result::rBadFile;
+	if (m_header.numRevolutions < 1) return Result::rBadFile;
+	if ((m_header.endTrack >= SCP_MAX_TRACKS) || (m_header.startTrack > m_header.endTrack)) return Result::rBadFile;
+
+	return Result::rOK;
+}
+
+void SCPImage::close() {
+#ifdef SCP_USE_MMAP
+	if (m_mapped) munmap((void*)m_mapped, m_fileSize);
+#endif
+	m_mapped = nullptr;
+	if (m_file) fclose(m_file);
+	m_file = nullptr;
+	m_fileSize = 0;
+	m_trackBuffer.clear();
+	m_trackBuffer.shrink_to_fit();
+}
+
+// Returns length bytes from offset, or nullptr
+const unsigned char* SCPImage::fetch(const size_t offset, const size_t length) {
+	if ((offset > m_fileSize) || (length > m_fileSize - offset)) return nullptr;
+	if (m_mapped) return m_mapped + offset;
+	if (!m_file) return nullptr;
+
+	m_trackBuffer.resize(length);
+	if (fseek(m_file, (long)offset, SEEK_SET) != 0) return nullptr;
+	if (fread(m_trackBuffer.data(), 1, length, m_file) != length) return nullptr;
+	return m_trackBuffer.data();
+}
+
+// Finds the revolutions for a track
+SCPImage::Result SCPImage::readTrack(const unsigned int trackNumber, std::vector<Revolution>& revolutions) {
+	revolutions.clear();
+	if (trackNumber >= SCP_MAX_TRACKS) return Result::rBadFile;
+	const uint32_t trackOffset = m_trackOffsets[trackNumber];
+	if (!trackOffset) return Result::rBadFile;
+
+	// The header and the revolution table
+	const size_t tableSize = sizeof(SCPTrackHeader) + (m_header.numRevolutions * sizeof(SCPTrackRevolution));
+	if ((trackOffset > m_fileSize) || (tableSize > m_fileSize - trackOffset)) return Result::rBadFile;
+	const unsigned char* table = fetch(trackOffset, tableSize);
+	if (!table) return Result::rFileIOError;
+
+	if ((table[0] != 'T') || (table[1] != 'R') || (table[2] != 'K') || (table[3] != trackNumber)) return Result::rBadFile;
+
+	// Work out where the data is.  Without the mapping, the whole track is then read in one go
+	size_t trackSize = tableSize;
+	size_t dataOffsets[256];
+	for (unsigned int r = 0; r < m_header.numRevolutions; r++) {
+		const unsigned char* entry = table + sizeof(SCPTrackHeader) + (r * sizeof(SCPTrackRevolution));
+		Revolution revolution;
+		revolution.indexTime = readLE32(entry);
+		revolution.numCells = readLE32(entry + 4);
+		const size_t dataOffset = readLE32(entry + 8);
+		const size_t dataEnd = dataOffset + ((size_t)revolution.numCells * 2);
+		if ((dataOffset < tableSize) || (dataEnd > m_fileSize - trackOffset)) return Result::rBadFile;
+		if (dataEnd > trackSize) trackSize = dataEnd;
+		dataOffsets[r] = dataOffset;
+		revolution.cells = nullptr;
+		revolutions.push_back(revolution);
+	}
+
+	const unsigned char* track = fetch(trackOffset, trackSize);
+	if (!track) return Result::rFileIOError;
+	for (unsigned int r = 0; r < revolutions.size(); r++)
+		revolutions[r].cells = track + dataOffsets[r];
+
+	return Result::rOK;
+}
@@ -0,0 +1,172 @@
+/* ArduinoFloppyReader (and writer)
+*
+* Copyright (C) 2017-2022 Robert Smith (@RobSmithDev)
+* https://amiga.robsmithdev.co.uk
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 3 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, see http://www.gnu.org/licenses/
+*/
+
+//////////////////////////////////////////////////////////////////////////////////////////
+// SCP (SuperCard Pro) flux image files                                                 //
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// Purpose:
+// The file structures, and a writer that produces the file in a single forward pass.  The track offset table is
+// kept in memory and the checksum is added up as each track is written, so the only seek is back to the start at
+// the end to fill in the header and the table.
+//
+// Also here is the conversion from the revolutions the RotationExtractor produces into SCP flux cells, and SCPImage
+// for reading files back.  SCPImage memory maps the file where it can, only checks the header up front, and only looks
+// at a track's header and revolution table when that track is asked for.  The flux cells are handed out where they are
+// in the file rather than being copied.  Without mmap each track is read in as it's asked for instead.
+//
+// The multi-byte values in the headers are little endian, and the flux cells are big endian.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdio.h>
+#include "RotationExtractor.h"
+
+#if !defined(_WIN32) && !defined(__amigaos4__)
+#define SCP_USE_MMAP
+#endif
+
+#pragma pack(1) 
+
+/* Taken from https://www.cbmstuff.com/downloads/scp/scp_image_specs.txt
+This information is copyright(C) 2012 - 2020 By Jim Drew. Permission is granted
+for inclusion with any source code when keeping this copyright notice.
+*/
+struct SCPFileHeader {
+	char			headerSCP[3];
+	unsigned char	version;
+	unsigned char	diskType;
+	unsigned char	numRevolutions;
+	unsigned char	startTrack;
+	unsigned char   endTrack;
+	unsigned char	flags;
+	unsigned char	bitcellEncoding;   // 0=16 bits per sample, 
+	unsigned char	numHeads;
+	unsigned char   timeBase;          // Resolution. Time in ns = (timeBase+1)*25
+	uint32_t	checksum;
+};
+
+struct SCPTrackHeader {
+	char			headerTRK[3];
+	unsigned char	trackNumber;
+};
+
+struct SCPTrackRevolution {
+	uint32_t	indexTime;		// Time in NS/25 for this revolution
+	uint32_t	trackLength;	// Number of bit-cells in this revolution
+	uint32_t	dataOffset;		// From the start of SCPTrackHeader 
+};
+
+// Track data is 16-bit value in NS/25.  If =0 means no flux transition for max time 
+#pragma pack()
+
+#define BITFLAG_INDEX		0
+#define BITFLAG_96TPI		1
+#define BITFLAG_NORMALISED  3
+#define BITFLAG_EXTENDED    6
+#define BITFLAG_FLUXCREATOR 7
+
+// Number of entries in the track offset table that follows the header
+#define SCP_MAX_TRACKS 168
+
+// Flux cells for one revolution, already in file order (big endian) so they are the same on every host
+typedef std::vector<uint8_t> SCPTrackData;
+
+struct SCPTrackInMemory {
+	SCPTrackHeader header;
+	std::vector<SCPTrackRevolution> revolution;
+	std::vector<SCPTrackData> revolutionData;
+}; 
+
+// Converts a revolution from the RotationExtractor into SCP flux cells (16-bit big-endian, in 25ns units), replacing what's in output.
+// In HD mode the bit times are halved.  The indexTime and trackLength of revolution are filled in
+void revolutionToSCP(const RotationExtractor::MFMSample* samples, const unsigned int dataLengthInBits, const bool isHDMode, SCPTrackRevolution& revolution, SCPTrackData& output);
+
+// Writes an SCP file one track at a time
+class SCPFileWriter {
+private:
+	std::ofstream m_file;
+	SCPFileHeader m_header = {};
+	uint32_t m_trackOffsets[SCP_MAX_TRACKS] = {};
+	uint32_t m_position = 0;                 // Where the next track will go
+	uint32_t m_checksum = 0;                 // Of all the track data written so far
+	std::vector<unsigned char> m_buffer;     // The track being written, so it goes out in one write
+
+public:
+	// Creates the file.  The header is written properly by finish()
+	bool open(const std::string& filename, const SCPFileHeader& header);
+
+	// Adds a track.  The revolution data offsets are filled in here
+	bool writeTrack(const SCPTrackInMemory& track);
+
+	// Fills in the checksum and the track offsets and closes the file
+	bool finish();
+
+	// Closes the file as it is
+	void close() { if (m_file.is_open()) m_file.close(); }
+};
+
+// Read access to an SCP file
+class SCPImage {
+public:
+	enum class Result { rOK, rFileError, rFileIOError, rBadFile };
+
+	// A revolution of a track.  cells points straight into the image and is only valid until the next readTrack()
+	struct Revolution {
+		uint32_t indexTime;           // In timeBase units
+		uint32_t numCells;
+		const unsigned char* cells;   // numCells 16-bit big-endian values
+
+		uint16_t cell(const uint32_t index) const { return (uint16_t)((cells[index * 2] << 8) | cells[(index * 2) + 1]); }
+	};
+
+private:
+	SCPFileHeader m_header = {};
+	uint32_t m_trackOffsets[SCP_MAX_TRACKS] = {};
+	size_t m_fileSize = 0;
+
+	// Mapped
+	const unsigned char* m_mapped = nullptr;
+	// Or read a track at a time
+	FILE* m_file = nullptr;
+	std::vector<unsigned char> m_trackBuffer;
+
+	// Returns length bytes from offset, or nullptr
+	const unsigned char* fetch(const size_t offset, const size_t length);
+
+public:
+	SCPImage() {}
+	~SCPImage() { close(); }
+	SCPImage(const SCPImage&) = delete;
+	SCPImage& operator=(const SCPImage&) = delete;
+
+	// Opens the file and checks the header
+	Result open(const std::string& filename);
+	void close();
+
+	const SCPFileHeader& header() const { return m_header; }
+
+	// Finds the revolutions for a track (0..SCP_MAX_TRACKS-1)
+	Result readTrack(const unsigned int trackNumber, std::vector<Revolution>& revolutions);
+};
@@ -0,0 +1,197 @@
+/* ArduinoFloppyReader (and writer)
+*
+* Copyright (C) 2017-2022 Robert Smith (@RobSmithDev)
+* https://amiga.robsmithdev.co.uk
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 3 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, see http://www.gnu.org/licenses/
+*/
+
+#include "stream_decoder.h"
+
+typedef MFMExtractionTarget::MFMSequence MFMSequence;
+typedef MFMExtractionTarget::MFMSequenceInfo MFMSequenceInfo;
+
+// Sequences the batch is allocated for to start with.  A 4k read in HD mode is 16k
+#define STREAM_DECODER_BATCH_SIZE 16384
+
+// RAW Counter Values for the flux stream
+#define MAX_FLUX_SIGNAL 31
+#define MIN_FLUX_ALLOWED 48										// in 62.5 time
+#define MAX_FLUX_ALLOWED (MIN_FLUX_ALLOWED + 61)				// in 62.5 time - comes out as '30'
+#define MAX_FLUX_REPEAT (MAX_FLUX_ALLOWED - 7)					// in 62.5 time - comes out as '26'
+#define FLUX_REPEAT_OFFSET (MAX_FLUX_REPEAT - MIN_FLUX_ALLOWED) // The amount MAX_FLUX_SIGNAL represents in clock ticks, which is 3625ns
+
+// Everything a single byte decodes to
+struct DecodedByte {
+	MFMSequenceInfo sequence[4];
+	unsigned char count;
+	unsigned char indexMask;       // Bit n set if sequence n is at the index
+	unsigned char speedMask;       // Bit n set if sequence n has the speed from the following byte added to it
+};
+
+// Sequence values 0-3 as sent by the DD streams, where 0 means 000
+static MFMSequence streamSequence(const unsigned int value) {
+	return value ? (MFMSequence)value : MFMSequence::mfm000;
+}
+
+// All of the tables, built once at startup
+static struct DecoderTables {
+	DecodedByte dd[256];               // COMMAND_READTRACKSTREAM in DD mode
+	DecodedByte highPrecision[256];    // The first byte of each COMMAND_READTRACKSTREAM_HIGHPRECISION pair
+	DecodedByte halfPLL[256];          // The first byte of each COMMAND_READTRACKSTREAM_HALFPLL pair
+	DecodedByte hd[256];               // COMMAND_READTRACKSTREAM in HD mode
+	uint16_t speed[128];               // The speed in the second byte of the pairs, in ns
+	uint32_t flux[32];                 // The flux times in the flux stream, in ns
+
+	DecoderTables() {
+		for (unsigned int value = 0; value < 256; value++) {
+			// Two sequences and the speed in the bottom three bits
+			DecodedByte& dd = this->dd[value];
+			const unsigned short readSpeed = (unsigned short)((((value & 0x07) * 16) * 2000) / 128);
+			dd = {};
+			dd.count = 2;
+			dd.indexMask = (value & 0x80) ? 1 : 0;
+			dd.sequence[0].mfm = streamSequence((value >> 5) & 0x03);
+			dd.sequence[1].mfm = streamSequence((value >> 3) & 0x03);
+			for (int a = 0; a < 2; a++) dd.sequence[a].timeNS = 1000 + (unsigned int)dd.sequence[a].mfm * 2000 + readSpeed;
+
+			// Four sequences, and the speed follows
+			DecodedByte& hp = highPrecision[value];
+			DecodedByte& half = halfPLL[value];
+			hp = {};
+			half = {};
+			hp.count = 4;
+			half.count = 4;
+			half.speedMask = 0x0F;
+			for (int a = 0; a < 4; a++) {
+				const MFMSequence mfm = streamSequence((value >> (6 - (a * 2))) & 0x03);
+				hp.sequence[a].mfm = mfm;
+				half.sequence[a].mfm = mfm;
+				if (mfm == MFMSequence::mfm000) {
+					// This is always a fixed time
+					hp.sequence[a].timeNS = 1000 + (unsigned int)mfm * 2000 - 2000;
+					half.sequence[a].timeNS = 5000;
+				}
+				else {
+					hp.sequence[a].timeNS = 1000 + (unsigned int)mfm * 2000;
+					hp.speedMask |= 1 << a;
+					half.sequence[a].timeNS = 1000 + (unsigned int)mfm * 2000;
+				}
+				half.sequence[a].pllTimeNS = half.sequence[a].timeNS;
+			}
+
+			// Four sequences, where 3 means 01 at the index
+			DecodedByte& hd = this->hd[value];
+			hd = {};
+			hd.count = 4;
+			for (int a = 0; a < 4; a++) {
+				const unsigned int code = (value >> (6 - (a * 2))) & 0x03;
+				hd.sequence[a].mfm = (MFMSequence)((code == 0x03 ? 0 : code) + 1);
+				hd.sequence[a].timeNS = 2000 + (unsigned int)hd.sequence[a].mfm * 2000;
+				if (code == 0x03) hd.indexMask |= 1 << a;
+			}
+		}
+
+		for (unsigned int value = 0; value < 128; value++)
+			speed[value] = (uint16_t)(value * 2000 / 128);
+
+		for (unsigned int value = 0; value < 32; value++)
+			flux[value] = (value == MAX_FLUX_SIGNAL) ? (uint32_t)(62.5f * FLUX_REPEAT_OFFSET) : (uint32_t)((value * 2 + MIN_FLUX_ALLOWED) * 62.5f);
+	}
+} s_tables;
+
+// Prepare for a new stream
+void StreamDecoder::reset(const StreamFormat format) {
+	m_format = format;
+	m_havePending = false;
+	m_pending = 0;
+	m_fluxSoFar = 0;
+	m_indexDetected = false;
+	m_batch.clear();
+	m_batch.reserve(STREAM_DECODER_BATCH_SIZE);
+}
+
+// Decodes all of data and passes it to the extractor
+void StreamDecoder::decode(const unsigned char* data, const unsigned int length, MFMExtractionTarget& extractor) {
+	// Anything held back from last time is still at the start of the batch
+	switch (m_format) {
+	case StreamFormat::sfDD:
+	case StreamFormat::sfHD: {
+		const DecodedByte* table = (m_format == StreamFormat::sfHD) ? s_tables.hd : s_tables.dd;
+		for (unsigned int position = 0; position < length; position++) {
+			const DecodedByte& decoded = table[data[position]];
+			m_batch.add(decoded.sequence, decoded.count, decoded.indexMask);
+		}
+		break;
+	}
+
+	case StreamFormat::sfHighPrecision:
+	case StreamFormat::sfHalfPLL: {
+		const DecodedByte* table = (m_format == StreamFormat::sfHalfPLL) ? s_tables.halfPLL : s_tables.highPrecision;
+		const bool setPLLTime = m_format == StreamFormat::sfHalfPLL;
+		for (unsigned int position = 0; position < length; position++) {
+			const unsigned char value = data[position];
+			if (!m_havePending) {
+				// The first of the pair is the sequences, which can't be used until the speed arrives
+				m_pending = value;
+				m_havePending = true;
+				continue;
+			}
+			m_havePending = false;
+
+			const DecodedByte& decoded = table[m_pending];
+			const uint16_t readSpeed = s_tables.speed[value & 0x7F];
+			// The index flag is in the speed byte, and belongs to the first sequence
+			for (unsigned int a = 0; a < 4; a++) {
+				MFMSequenceInfo sequence = decoded.sequence[a];
+				if ((decoded.speedMask >> a) & 1) {
+					sequence.timeNS += readSpeed;
+					if (setPLLTime) sequence.pllTimeNS = sequence.timeNS;
+				}
+				m_batch.add(sequence, (a == 0) && (value & 0x80));
+			}
+		}
+		break;
+	}
+	}
+
+	// Hand it all over in one go.  If the extractor gets a full rotation, the rest is kept for after it has been extracted
+	m_batch.submit(extractor);
+}
+
+// Decodes the flux stream into the PLL
+void StreamDecoder::decodeFlux(const unsigned char* data, const unsigned int length, PLL::BridgePLL& pll) {
+	for (unsigned int position = 0; position < length; position++) {
+		const unsigned char value = data[position];
+		if (!m_havePending) {
+			m_pending = value;
+			m_havePending = true;
+			continue;
+		}
+		m_havePending = false;
+
+		// Three 5-bit values in two bytes, and the index flag in the top bit of the second
+		const unsigned int flux[3] = { (unsigned int)(m_pending & 0x1F), (unsigned int)((m_pending >> 5) | ((value >> 2) & 0x18)), (unsigned int)(value & 0x1F) };
+		m_indexDetected |= (value & 0x80) != 0;
+
+		for (int a = 0; a < 3; a++) {
+			m_fluxSoFar += s_tables.flux[flux[a]];
+			if (flux[a] != MAX_FLUX_SIGNAL) {
+				pll.submitFlux(m_fluxSoFar, m_indexDetected);
+				m_indexDetected = false;
+				m_fluxSoFar = 0;
+			}
+		}
+	}
+}
@@ -0,0 +1,68 @@
+/* ArduinoFloppyReader (and writer)
+*
+* Copyright (C) 2017-2022 Robert Smith (@RobSmithDev)
+* https://amiga.robsmithdev.co.uk
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 3 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, see http://www.gnu.org/licenses/
+*/
+
+//////////////////////////////////////////////////////////////////////////////////////////
+// Decoder for the data streamed by the DrawBridge read commands                        //
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// Purpose:
+// Every byte the streaming commands send packs two or four MFM sequences (or part of three
+// flux times) into bit fields.  Rather than unpacking these with shifts and branches for each
+// sequence, every possible byte is decoded once into a table, so each byte received is just
+// a lookup and a copy.  A whole buffer is decoded in one call and handed to the extractor as
+// a single block.  If the extractor gets a full rotation part way through the block, the rest
+// is held back until the next call, after the rotation has been taken.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "RotationExtractor.h"
+#include "pll.h"
+
+class StreamDecoder {
+public:
+	// The stream formats, each matching one of the read commands
+	enum class StreamFormat { sfDD, sfHighPrecision, sfHalfPLL, sfHD };
+
+private:
+	StreamFormat m_format = StreamFormat::sfDD;
+
+	// The high precision and flux formats send their data in pairs of bytes
+	bool m_havePending = false;
+	unsigned char m_pending = 0;
+
+	// Flux mode only
+	uint32_t m_fluxSoFar = 0;
+	bool m_indexDetected = false;
+
+	// Sequences waiting to go to the extractor, and which of them are at the index
+	MFMSequenceBatch m_batch;
+
+public:
+	// Prepare for a new stream
+	void reset(const StreamFormat format);
+
+	// Decodes all of data and passes it to the extractor.  Check extractor.canExtract() afterwards
+	void decode(const unsigned char* data, const unsigned int length, MFMExtractionTarget& extractor);
+
+	// As above, but for the flux stream, which goes through the PLL.  Check pll.canExtract() afterwards
+	void decodeFlux(const unsigned char* data, const unsigned int length, PLL::BridgePLL& pll);
+};
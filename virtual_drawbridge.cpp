@@ -0,0 +1,1051 @@
+/* ArduinoFloppyReader (and writer)
+*
+* Copyright (C) 2017-2022 Robert Smith (@RobSmithDev)
+* https://amiga.robsmithdev.co.uk
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 3 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, see http://www.gnu.org/licenses/
+*/
+
+#include "virtual_drawbridge.h"
+#include "ADFWriter.h"
+#include "mfm_kernels.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+
+// The commands, as the firmware sees them
+#define COMMAND_VERSION '?'
+#define COMMAND_REWIND '.'
+#define COMMAND_GOTOTRACK '#'
+#define COMMAND_HEAD0 '['
+#define COMMAND_HEAD1 ']'
+#define COMMAND_READTRACK '<'
+#define COMMAND_ENABLE '+'
+#define COMMAND_DISABLE '-'
+#define COMMAND_WRITETRACK '>'
+#define COMMAND_ENABLEWRITE '~'
+#define COMMAND_DIAGNOSTICS '&'
+#define COMMAND_ERASETRACK 'X'
+#define COMMAND_SWITCHTO_DD 'D'
+#define COMMAND_SWITCHTO_HD 'H'
+#define COMMAND_READTRACKSTREAM '{'
+#define COMMAND_WRITETRACKPRECOMP '}'
+#define COMMAND_CHECKDISKEXISTS '^'
+#define COMMAND_ENABLE_NOWAIT '*'
+#define COMMAND_GOTOTRACK_REPORT '='
+#define COMMAND_DO_NOCLICK_SEEK 'O'
+#define COMMAND_CHECK_DENSITY 'T'
+#define COMMAND_TEST_RPM 'P'
+#define COMMAND_CHECK_FEATURES '@'
+#define COMMAND_READTRACKSTREAM_HIGHPRECISION 'F'
+#define COMMAND_READTRACKSTREAM_FLUX 'L'
+#define COMMAND_READTRACKSTREAM_HALFPLL 'l'
+#define COMMAND_EEPROM_READ 'E'
+#define COMMAND_EEPROM_WRITE 'e'
+#define COMMAND_RESET 'R'
+#define COMMAND_WRITEFLUX 'Y'
+#define COMMAND_ERASEFLUX 'w'
+#define SPECIAL_ABORT_CHAR 'x'
+
+// What we claim to be
+#define FIRMWARE_VERSION "1V1,9"
+#define FIRMWARE_BUILD 24
+
+// Timing model
+#define REVOLUTION_NS 200000000U          // 300 RPM
+#define MOTOR_SPINUP_MS 500               // Motor on until the disk is up to speed
+#define HEAD_SETTLE_MS 15                 // After the last step
+#define LINK_BYTE_NS 5000                 // 10 bits at 2M baud
+#define STREAM_LOOKAHEAD_NS 20000000U     // How far ahead of the host the streamed data is prepared
+#define STREAM_CHUNK_SIZE 256
+#define PARAMETER_WAIT_MS 10              // How long optional parameters are waited for
+#define RECEIVE_TIMEOUT_MS 2000           // How long a write waits for its data
+
+#define MAX_CYLINDERS 84
+#define BITCELL_NS_DD 2000
+#define BITCELL_NS_HD 1000
+#define PRECOMP_NS 140
+
+// Flux read stream encoding
+#define MAX_FLUX_SIGNAL 31
+#define MIN_FLUX_ALLOWED 48
+#define MAX_FLUX_ALLOWED (MIN_FLUX_ALLOWED + 61)
+#define MAX_FLUX_REPEAT (MAX_FLUX_ALLOWED - 7)
+#define FLUX_REPEAT_OFFSET (MAX_FLUX_REPEAT - MIN_FLUX_ALLOWED)
+
+// Flux write encoding
+#define FLUX_MULTIPLIER_TIME_DB 125
+#define FLUX_MINIMUM_DB 22
+#define FLUX_REPEAT_COUNTER 27
+#define FLUX_SPECIAL_CODE_BLANK 30
+#define FLUX_SPECIAL_CODE_END 31
+
+// Step time per track for each TrackSearchSpeed
+static const unsigned int StepTimeMS[4] = { 12, 6, 4, 3 };
+
+static uint64_t timeNow() {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::chrono::steady_clock::time_point toTimePoint(const uint64_t time) {
+	return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(time)));
+}
+
+// Plays back a track from any position, as the head would see it
+class FluxReader {
+private:
+	const VirtualDrawBridge::FluxTrack& m_track;
+	size_t m_next;
+	uint32_t m_position;
+	uint64_t m_elapsed = 0;
+
+public:
+	FluxReader(const VirtualDrawBridge::FluxTrack& track, const uint32_t startPosition) : m_track(track), m_position(startPosition) {
+		m_next = std::lower_bound(track.begin(), track.end(), startPosition) - track.begin();
+	}
+
+	// Returns the time until the next flux transition.  indexPassed is set if the index pulse happened in that time.  A blank track returns a whole revolution
+	uint32_t nextFlux(bool& indexPassed) {
+		uint32_t time;
+		indexPassed = false;
+		if (m_next >= m_track.size()) {
+			indexPassed = true;
+			time = REVOLUTION_NS - m_position;
+			m_position = 0;
+			m_next = 0;
+			if (m_track.empty()) {
+				m_elapsed += time;
+				return time;
+			}
+		}
+		else time = 0;
+		time += m_track[m_next] - m_position;
+		m_position = m_track[m_next++];
+		m_elapsed += time;
+		return time;
+	}
+
+	// Total time played back
+	uint64_t elapsed() const { return m_elapsed; }
+};
+
+// Turns flux into the MFM sequences the streaming commands send: 1=01, 2=001, 3=0001 and 0=000 (no transition)
+class SequenceReader {
+private:
+	FluxReader m_flux;
+	const uint32_t m_bitcell;
+	const bool m_allowBlank;
+	uint32_t m_cellsLeft = 0;
+	uint32_t m_timeLeft = 0;
+	bool m_index = false;
+
+public:
+	SequenceReader(const VirtualDrawBridge::FluxTrack& track, const uint32_t startPosition, const uint32_t bitcell, const bool allowBlank) : m_flux(track, startPosition), m_bitcell(bitcell), m_allowBlank(allowBlank) {}
+
+	// Returns the next sequence.  timeNS is how long it really took.  index is set if the index pulse was during it
+	unsigned int next(uint32_t& timeNS, bool& index) {
+		if (!m_cellsLeft) {
+			bool indexPassed;
+			m_timeLeft = m_flux.nextFlux(indexPassed);
+			m_index |= indexPassed;
+			m_cellsLeft = (m_timeLeft + (m_bitcell / 2)) / m_bitcell;
+			if (m_cellsLeft < 2) m_cellsLeft = 2;
+		}
+		index = m_index;
+		m_index = false;
+
+		unsigned int sequence, cells;
+		if (m_cellsLeft <= 4) {
+			sequence = m_cellsLeft - 1;
+			cells = m_cellsLeft;
+			timeNS = m_timeLeft;
+		}
+		else {
+			// Too long to be a single sequence.  Without a code for "no transition" it has to be broken up with extra ones, much like noise on an unformatted track
+			sequence = m_allowBlank ? 0 : 3;
+			cells = m_allowBlank ? 3 : 4;
+			timeNS = cells * m_bitcell;
+			if (timeNS > m_timeLeft) timeNS = m_timeLeft;
+		}
+		m_cellsLeft -= cells;
+		if ((m_cellsLeft) && (m_cellsLeft < 2)) m_cellsLeft = 2;
+		m_timeLeft -= timeNS;
+		return sequence;
+	}
+
+	uint64_t elapsed() const { return m_flux.elapsed(); }
+};
+
+// Works out the speed value sent with the DD streams.  The host adds it to 1000+(sequence*2000), so a sequence that's exactly on time gives 1000
+static int32_t sequenceSpeed(const unsigned int sequence, const uint32_t timeNS) {
+	return (int32_t)timeNS - (int32_t)(1000 + (sequence * 2000));
+}
+
+// Constructor etc
+VirtualDrawBridge::VirtualDrawBridge() {
+	memset(m_eeprom, 0xFF, sizeof(m_eeprom));
+}
+
+VirtualDrawBridge::~VirtualDrawBridge() {
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_shutdown = true;
+	}
+	m_inputReady.notify_all();
+	m_outputReady.notify_all();
+	if (m_deviceThread.joinable()) m_deviceThread.join();
+}
+
+// Loads the disk image and starts the device running
+bool VirtualDrawBridge::open(const std::string& imageFilename) {
+	if (m_deviceThread.joinable()) return false;
+
+	std::ifstream file(imageFilename, std::ifstream::in | std::ifstream::binary);
+	if (!file.is_open()) return false;
+	char header[3] = { 0 };
+	file.read(header, sizeof(header));
+	file.close();
+
+	m_tracks.clear();
+	m_tracks.resize(MAX_CYLINDERS * 2);
+	m_trackLoaded.assign(MAX_CYLINDERS * 2, false);
+
+	const bool loaded = ((header[0] == 'S') && (header[1] == 'C') && (header[2] == 'P')) ? loadSCP(imageFilename) : loadADF(imageFilename);
+	if (!loaded) return false;
+
+	m_deviceThread = std::thread([this]() { deviceMain(); });
+	return true;
+}
+
+// Loads an ADF.  The size decides if its DD or HD
+bool VirtualDrawBridge::loadADF(const std::string& filename) {
+	std::ifstream file(filename, std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
+	if (!file.is_open()) return false;
+	const size_t size = (size_t)file.tellg();
+	file.seekg(0, std::ifstream::beg);
+
+	if ((size % (ADF_TRACK_SIZE_DD * 2) == 0) && (size / (ADF_TRACK_SIZE_DD * 2) <= MAX_CYLINDERS)) m_diskIsHD = false;
+	else
+		if ((size % (ADF_TRACK_SIZE_HD * 2) == 0) && (size / (ADF_TRACK_SIZE_HD * 2) <= MAX_CYLINDERS)) m_diskIsHD = true;
+		else return false;
+	if (!size) return false;
+
+	m_adfData.resize(size);
+	file.read((char*)m_adfData.data(), size);
+	return file.good();
+}
+
+static uint32_t readLE32(const unsigned char* data) {
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+// Loads an SCP file.  The second revolution is used if there is one, as the first is sometimes incorrect
+bool VirtualDrawBridge::loadSCP(const std::string& filename) {
+	std::ifstream file(filename, std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
+	if (!file.is_open()) return false;
+	const size_t size = (size_t)file.tellg();
+	file.seekg(0, std::ifstream::beg);
+	if (size < 16 + (168 * 4)) return false;
+
+	std::vector<unsigned char> scp(size);
+	file.read((char*)scp.data(), size);
+	if (!file.good()) return false;
+
+	const unsigned int numRevolutions = scp[5];
+	const uint32_t fluxMultiplier = (scp[11] + 1) * 25;
+	if ((!numRevolutions) || (scp[9] != 0)) return false;   // Only 16-bit samples are supported
+	const unsigned int revolution = (numRevolutions > 1) ? 1 : 0;
+
+	uint64_t totalFlux = 0, totalTransitions = 0;
+
+	for (unsigned int trackNumber = 0; trackNumber < MAX_CYLINDERS * 2; trackNumber++) {
+		const uint32_t trackOffset = readLE32(&scp[16 + (trackNumber * 4)]);
+		if ((!trackOffset) || (trackOffset + 4 + (numRevolutions * 12) > size)) continue;
+		const unsigned char* trk = &scp[trackOffset];
+		if ((trk[0] != 'T') || (trk[1] != 'R') || (trk[2] != 'K')) return false;
+
+		const unsigned char* rev = trk + 4 + (revolution * 12);
+		const uint64_t indexTime = (uint64_t)readLE32(rev) * fluxMultiplier;
+		const uint32_t trackLength = readLE32(rev + 4);
+		const uint32_t dataOffset = readLE32(rev + 8);
+		if ((!indexTime) || (trackOffset + dataOffset + (trackLength * 2) > size)) continue;
+
+		// Convert to nanoseconds, and stretch it to fit our revolution time
+		FluxTrack& output = m_tracks[trackNumber];
+		output.reserve(trackLength);
+		const unsigned char* data = &scp[trackOffset + dataOffset];
+		uint64_t position = 0;
+		for (uint32_t sample = 0; sample < trackLength; sample++) {
+			const uint32_t value = (data[sample * 2] << 8) | data[(sample * 2) + 1];
+			if (!value) {
+				position += 65536 * fluxMultiplier;
+				continue;
+			}
+			position += value * fluxMultiplier;
+			const uint64_t time = (position * REVOLUTION_NS) / indexTime;
+			if (time >= REVOLUTION_NS) break;
+			output.push_back((uint32_t)time);
+		}
+		if (!output.empty()) {
+			totalFlux += output.back();
+			totalTransitions += output.size();
+		}
+	}
+
+	// HD disks average well under 3us between transitions, DD disks well over
+	m_diskIsHD = (totalTransitions) && ((totalFlux / totalTransitions) < 3500);
+	m_trackLoaded.assign(MAX_CYLINDERS * 2, true);
+	return true;
+}
+
+// Returns the track under the head, encoding it from the ADF the first time its used
+const VirtualDrawBridge::FluxTrack& VirtualDrawBridge::track(const int cylinder, const int side) {
+	static const FluxTrack blankTrack;
+	if ((cylinder < 0) || (cylinder >= MAX_CYLINDERS)) return blankTrack;
+
+	const unsigned int trackNumber = (cylinder * 2) + side;
+	if (m_trackLoaded[trackNumber]) return m_tracks[trackNumber];
+	m_trackLoaded[trackNumber] = true;
+
+	const unsigned int sectorsPerTrack = m_diskIsHD ? NUM_SECTORS_PER_TRACK_HD : NUM_SECTORS_PER_TRACK_DD;
+	const size_t adfOffset = (size_t)trackNumber * sectorsPerTrack * SECTOR_BYTES;
+	if (adfOffset + (sectorsPerTrack * SECTOR_BYTES) > m_adfData.size()) return m_tracks[trackNumber];
+
+	// A whole revolution of MFM, filled with the "0"s gap, with the sectors in the middle of it
+	const uint32_t bitcell = m_diskIsHD ? BITCELL_NS_HD : BITCELL_NS_DD;
+	const unsigned int trackBytes = REVOLUTION_NS / bitcell / 8;
+	std::vector<uint32_t> mfmBuffer(trackBytes / 4);
+	unsigned char* mfm = (unsigned char*)mfmBuffer.data();
+	memset(mfm, 0xAA, trackBytes);
+
+	unsigned int position = ((trackBytes - (sectorsPerTrack * RAW_SECTOR_SIZE)) / 2) & ~3U;
+	unsigned char lastByte = 0xAA;
+	for (unsigned int sector = 0; sector < sectorsPerTrack; sector++) {
+		unsigned char* output = &mfm[position];
+		output[0] = (lastByte & 1) ? 0x2A : 0xAA;
+		output[4] = 0x44;
+		output[5] = 0x89;
+		output[6] = 0x44;
+		output[7] = 0x89;
+
+		uint32_t header[5] = { 0 };
+		unsigned char* headerBytes = (unsigned char*)header;
+		headerBytes[0] = 0xFF;
+		headerBytes[1] = trackNumber;
+		headerBytes[2] = sector;
+		headerBytes[3] = sectorsPerTrack - sector;
+		uint32_t headerChecksum = MFM::encodeOddEven(&header[0], (uint32_t*)&output[8], 4);
+		headerChecksum ^= MFM::encodeOddEven(&header[1], (uint32_t*)&output[16], 16);
+		MFM::encodeOddEven(&headerChecksum, (uint32_t*)&output[48], 4);
+		const uint32_t dataChecksum = MFM::encodeOddEven((const uint32_t*)&m_adfData[adfOffset + (sector * SECTOR_BYTES)], (uint32_t*)&output[64], SECTOR_BYTES);
+		MFM::encodeOddEven(&dataChecksum, (uint32_t*)&output[56], 4);
+		lastByte = MFM::addClockBits(&output[8], RAW_SECTOR_SIZE - 8, output[7]);
+		position += RAW_SECTOR_SIZE;
+	}
+	if (lastByte & 1) mfm[position] = 0x2A;
+
+	// And convert to flux
+	FluxTrack& output = m_tracks[trackNumber];
+	output.reserve(trackBytes * 4);
+	for (unsigned int bit = 0; bit < trackBytes * 8; bit++)
+		if (mfm[bit >> 3] & (0x80 >> (bit & 7))) output.push_back(bit * bitcell);
+
+	return output;
+}
+
+// Host: queues data for the device
+unsigned int VirtualDrawBridge::write(const void* data, const unsigned int dataLength) {
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_input.insert(m_input.end(), (const unsigned char*)data, (const unsigned char*)data + dataLength);
+	}
+	m_inputReady.notify_all();
+	return dataLength;
+}
+
+// Host: reads data that has "arrived"
+unsigned int VirtualDrawBridge::read(void* data, const unsigned int dataLength, const unsigned int timeoutMS, const bool anyAmount) {
+	const uint64_t deadline = timeNow() + ((uint64_t)timeoutMS * 1000000U);
+	unsigned char* output = (unsigned char*)data;
+	unsigned int dataRead = 0;
+
+	std::unique_lock<std::mutex> lock(m_lock);
+	for (;;) {
+		const uint64_t now = timeNow();
+		while ((dataRead < dataLength) && (!m_output.empty()) && (m_output.front().readyTime <= now)) {
+			OutputChunk& chunk = m_output.front();
+			const size_t amount = std::min((size_t)(dataLength - dataRead), chunk.data.size() - chunk.readPosition);
+			memcpy(output + dataRead, chunk.data.data() + chunk.readPosition, amount);
+			dataRead += (unsigned int)amount;
+			chunk.readPosition += amount;
+			if (chunk.readPosition >= chunk.data.size()) m_output.pop_front();
+		}
+		if ((dataRead >= dataLength) || ((anyAmount) && (dataRead))) break;
+		if ((now >= deadline) || (m_shutdown)) break;
+
+		// Wait for the next chunk to arrive, or for one to be sent
+		uint64_t wakeTime = deadline;
+		if ((!m_output.empty()) && (m_output.front().readyTime < wakeTime)) wakeTime = m_output.front().readyTime;
+		m_outputReady.wait_until(lock, toTimePoint(wakeTime));
+	}
+	return dataRead;
+}
+
+// Host: bytes that have arrived
+unsigned int VirtualDrawBridge::getBytesWaiting() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	const uint64_t now = timeNow();
+	unsigned int waiting = 0;
+	for (const OutputChunk& chunk : m_output) {
+		if (chunk.readyTime > now) break;
+		waiting += (unsigned int)(chunk.data.size() - chunk.readPosition);
+	}
+	return waiting;
+}
+
+// Host: only what has actually arrived can be thrown away.  Anything still on its way keeps coming
+void VirtualDrawBridge::purge(const bool rx, const bool tx) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (rx) {
+		const uint64_t now = timeNow();
+		while ((!m_output.empty()) && (m_output.front().readyTime <= now)) m_output.pop_front();
+	}
+	if (tx) m_input.clear();
+}
+
+// Host: CTS line
+bool VirtualDrawBridge::getCTSStatus() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_ctsHigh;
+}
+
+// Device: waits for a byte from the host.  A negative timeout waits forever.  Returns FALSE on timeout or shutdown
+bool VirtualDrawBridge::receive(unsigned char& value, const int timeoutMS) {
+	std::unique_lock<std::mutex> lock(m_lock);
+	const auto ready = [this]() { return m_shutdown || !m_input.empty(); };
+	if (timeoutMS < 0) m_inputReady.wait(lock, ready);
+	else m_inputReady.wait_for(lock, std::chrono::milliseconds(timeoutMS), ready);
+	if ((m_shutdown) || (m_input.empty())) return false;
+	value = m_input.front();
+	m_input.pop_front();
+	return true;
+}
+
+// Device: receive a block of data from the host
+bool VirtualDrawBridge::receive(unsigned char* data, const unsigned int length) {
+	for (unsigned int index = 0; index < length; index++)
+		if (!receive(data[index], RECEIVE_TIMEOUT_MS)) return false;
+	return true;
+}
+
+// Device: while streaming, any byte from the host stops it.  Waits until waitUntilTime for one to arrive.  Returns TRUE if one did, or on shutdown
+bool VirtualDrawBridge::abortReceived(const uint64_t waitUntilTime) {
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_inputReady.wait_until(lock, toTimePoint(waitUntilTime), [this]() { return m_shutdown || !m_input.empty(); });
+	if (m_shutdown) return true;
+	if (m_input.empty()) return false;
+	m_input.pop_front();
+	return true;
+}
+
+// Device: queues data for the host.  It arrives once the link has had time to send it, and not before readyTime
+void VirtualDrawBridge::send(const void* data, const unsigned int length, const uint64_t readyTime) {
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		uint64_t startTime = std::max(readyTime, timeNow());
+		if (m_linkFreeTime > startTime) startTime = m_linkFreeTime;
+		m_linkFreeTime = startTime + ((uint64_t)length * LINK_BYTE_NS);
+
+		OutputChunk chunk;
+		chunk.readyTime = m_linkFreeTime;
+		chunk.data.assign((const unsigned char*)data, (const unsigned char*)data + length);
+		chunk.readPosition = 0;
+		m_output.push_back(std::move(chunk));
+	}
+	m_outputReady.notify_all();
+}
+
+// Device: forget streamed data that hadn't been sent by time
+void VirtualDrawBridge::dropUnsentOutput(const uint64_t time) {
+	std::lock_guard<std::mutex> lock(m_lock);
+	while ((!m_output.empty()) && (m_output.back().readyTime > time)) m_output.pop_back();
+	m_linkFreeTime = m_output.empty() ? time : std::max(time, m_output.back().readyTime);
+}
+
+// Device: passes time.  Returns FALSE on shutdown
+bool VirtualDrawBridge::waitUntil(const uint64_t time) {
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_inputReady.wait_until(lock, toTimePoint(time), [this]() { return m_shutdown; });
+	return !m_shutdown;
+}
+
+// The time of the next index pulse at or after time
+uint64_t VirtualDrawBridge::nextIndexTime(const uint64_t time) const {
+	const uint64_t position = time % REVOLUTION_NS;
+	return position ? time + (REVOLUTION_NS - position) : time;
+}
+
+// Feature flags, some of which come from the EEPROM settings
+unsigned char VirtualDrawBridge::featureFlags() const {
+	unsigned char flags = FLAGS_HIGH_PRECISION_SUPPORT | FLAGS_DISKCHANGE_SUPPORT | FLAGS_FLUX_READ;
+	if ((m_eeprom[4] == 0x2B) && (m_eeprom[5] == 0xB2)) flags |= FLAGS_DRAWBRIDGE_PLUSMODE;
+	if ((m_eeprom[6] != 0x44) || (m_eeprom[7] != 0x53)) flags |= FLAGS_DENSITYDETECT_ENABLED;
+	if ((m_eeprom[8] == 0x53) && (m_eeprom[9] == 0x77)) flags |= FLAGS_SLOWSEEKING_MODE;
+	if ((m_eeprom[10] == 0x69) && (m_eeprom[11] == 0x61)) flags |= FLAGS_INDEX_ALIGN_MODE;
+	return flags;
+}
+
+// Turns the motor on and waits for it to get up to speed.  Returns FALSE on shutdown
+bool VirtualDrawBridge::spinUp() {
+	if (!m_motorOn) {
+		m_motorOn = true;
+		m_motorReadyTime = timeNow() + (MOTOR_SPINUP_MS * 1000000ULL);
+	}
+	return waitUntil(m_motorReadyTime);
+}
+
+// Moves the head
+void VirtualDrawBridge::seekTo(const int cylinder, const int searchSpeed) {
+	const unsigned int steps = (unsigned int)abs(cylinder - m_cylinder);
+	if (!steps) return;
+	unsigned int stepTime = StepTimeMS[searchSpeed & 3];
+	if (featureFlags() & FLAGS_SLOWSEEKING_MODE) stepTime *= 2;
+	m_cylinder = cylinder;
+	waitUntil(timeNow() + ((uint64_t)((steps * stepTime) + HEAD_SETTLE_MS) * 1000000U));
+}
+
+// The firmware's main loop
+void VirtualDrawBridge::deviceMain() {
+	unsigned char command;
+	while (receive(command)) runCommand(command);
+}
+
+// Runs a single command
+void VirtualDrawBridge::runCommand(const unsigned char command) {
+	switch (command) {
+	case SPECIAL_ABORT_CHAR:
+		// Only means something while streaming
+		break;
+
+	case COMMAND_VERSION:
+		send(FIRMWARE_VERSION, (unsigned int)strlen(FIRMWARE_VERSION));
+		break;
+
+	case COMMAND_RESET:
+		m_motorOn = false;
+		m_hdMode = false;
+		send('1');
+		break;
+
+	case COMMAND_CHECK_FEATURES: {
+		const unsigned char response[4] = { '1', featureFlags(), 0, FIRMWARE_BUILD };
+		send(response, sizeof(response));
+		break;
+	}
+
+	case COMMAND_REWIND:
+		seekTo(0, 1);
+		send('1');
+		break;
+
+	case COMMAND_GOTOTRACK:
+	case COMMAND_GOTOTRACK_REPORT: {
+		unsigned char digits[2];
+		if (!receive(digits, 2)) break;
+		if ((digits[0] < '0') || (digits[0] > '9') || (digits[1] < '0') || (digits[1] > '9')) {
+			send('0');
+			break;
+		}
+		const int cylinder = ((digits[0] - '0') * 10) + (digits[1] - '0');
+
+		if (command == COMMAND_GOTOTRACK) {
+			seekTo(cylinder, 1);
+			send('1');
+			break;
+		}
+
+		// The flags are sent as a raw byte, so if they're zero they don't get sent at all
+		unsigned char flags = 0;
+		if (!receive(flags, PARAMETER_WAIT_MS)) flags = 0;
+		if (cylinder >= MAX_CYLINDERS) {
+			send('0');
+			break;
+		}
+		if (cylinder == m_cylinder) {
+			send('2');
+			break;
+		}
+		seekTo(cylinder, flags & 3);
+		const char response[3] = { '1', (flags & 4) ? '1' : 'x', '0' };
+		send(response, sizeof(response));
+		break;
+	}
+
+	case COMMAND_HEAD0:
+		m_side = 1;
+		send('1');
+		break;
+
+	case COMMAND_HEAD1:
+		m_side = 0;
+		send('1');
+		break;
+
+	case COMMAND_ENABLE:
+		spinUp();
+		send('1');
+		break;
+
+	case COMMAND_ENABLE_NOWAIT:
+		if (!m_motorOn) {
+			m_motorOn = true;
+			m_motorReadyTime = timeNow() + (MOTOR_SPINUP_MS * 1000000ULL);
+		}
+		send('1');
+		break;
+
+	case COMMAND_DISABLE:
+		m_motorOn = false;
+		send('1');
+		break;
+
+	case COMMAND_ENABLEWRITE:
+		spinUp();
+		send('1');
+		break;
+
+	case COMMAND_CHECKDISKEXISTS:
+		// Disk present, not write protected
+		send("1#", 2);
+		break;
+
+	case COMMAND_DO_NOCLICK_SEEK:
+		send("110", 3);
+		break;
+
+	case COMMAND_CHECK_DENSITY: {
+		const char response[2] = { '1', m_diskIsHD ? 'H' : 'D' };
+		send(response, sizeof(response));
+		break;
+	}
+
+	case COMMAND_SWITCHTO_DD:
+	case COMMAND_SWITCHTO_HD:
+		m_hdMode = command == COMMAND_SWITCHTO_HD;
+		send('1');
+		break;
+
+	case COMMAND_TEST_RPM: {
+		// Measured from one index pulse to the next
+		send('1');
+		if (!spinUp()) break;
+		if (!waitUntil(nextIndexTime(timeNow()) + REVOLUTION_NS)) break;
+		char rpm[16];
+		snprintf(rpm, sizeof(rpm), "%.2f\n", 60000000000.0 / REVOLUTION_NS);
+		send(rpm, (unsigned int)strlen(rpm));
+		break;
+	}
+
+	case COMMAND_DIAGNOSTICS: {
+		unsigned char test = 0;
+		if (!receive(test, PARAMETER_WAIT_MS)) test = 0;
+		switch (test) {
+		case '1':
+		case '2': {
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_ctsHigh = test == '1';
+			break;
+		}
+		case '5': {
+			send('1');
+			unsigned char pattern[256];
+			for (unsigned int a = 0; a < sizeof(pattern); a++) pattern[a] = (unsigned char)a;
+			for (int a = 0; a <= 10; a++) send(pattern, sizeof(pattern));
+			return;
+		}
+		case '6':
+			send((featureFlags() & FLAGS_DRAWBRIDGE_PLUSMODE) ? '1' : '0');
+			return;
+		case 0: {
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_ctsHigh = false;
+			break;
+		}
+		}
+		send('1');
+		break;
+	}
+
+	case COMMAND_EEPROM_READ: {
+		send('1');
+		unsigned char position;
+		if (!receive(position, RECEIVE_TIMEOUT_MS)) break;
+		send(m_eeprom[position]);
+		break;
+	}
+
+	case COMMAND_EEPROM_WRITE: {
+		send('1');
+		unsigned char data[2];
+		if (!receive(data, 2)) break;
+		m_eeprom[data[0]] = data[1];
+		send('1');
+		break;
+	}
+
+	case COMMAND_READTRACKSTREAM:
+	case COMMAND_READTRACKSTREAM_HIGHPRECISION:
+	case COMMAND_READTRACKSTREAM_HALFPLL:
+	case COMMAND_READTRACKSTREAM_FLUX:
+		streamTrack(command);
+		break;
+
+	case COMMAND_READTRACK:
+		readTrack();
+		break;
+
+	case COMMAND_WRITETRACK:
+	case COMMAND_WRITETRACKPRECOMP:
+		writeTrack(command == COMMAND_WRITETRACKPRECOMP);
+		break;
+
+	case COMMAND_WRITEFLUX:
+		writeFlux();
+		break;
+
+	case COMMAND_ERASETRACK:
+	case COMMAND_ERASEFLUX:
+		eraseTrack(command == COMMAND_ERASEFLUX);
+		break;
+
+	default:
+		send('0');
+		break;
+	}
+}
+
+// Streams the track until the host sends anything back
+void VirtualDrawBridge::streamTrack(const unsigned char command) {
+	if ((m_hdMode) && (command != COMMAND_READTRACKSTREAM)) {
+		send('0');
+		return;
+	}
+	if (!spinUp()) return;
+	send('1');
+
+	uint64_t startTime = timeNow();
+	if (featureFlags() & FLAGS_INDEX_ALIGN_MODE) startTime = nextIndexTime(startTime);
+	const FluxTrack& trk = track(m_cylinder, m_side);
+	const uint32_t startPosition = startTime % REVOLUTION_NS;
+
+	FluxReader flux(trk, startPosition);
+	SequenceReader sequences(trk, startPosition, m_hdMode ? BITCELL_NS_HD : BITCELL_NS_DD, !m_hdMode);
+	bool indexPending = false;
+	unsigned int fluxTicks = 0;
+
+	std::vector<unsigned char> chunk;
+	chunk.reserve(STREAM_CHUNK_SIZE + 2);
+	if (command != COMMAND_READTRACKSTREAM && command != COMMAND_READTRACKSTREAM_FLUX) chunk.push_back(0xC3);
+
+	for (;;) {
+		uint32_t timeNS;
+		bool index;
+
+		if (command == COMMAND_READTRACKSTREAM_FLUX) {
+			// Three 5-bit flux times in every two bytes.  31 means 'no transition yet'
+			unsigned char values[3];
+			bool pairIndex = false;
+			for (int a = 0; a < 3; a++) {
+				if (!fluxTicks) {
+					const uint32_t time = flux.nextFlux(index);
+					pairIndex |= index;
+					fluxTicks = ((time * 16) + 500) / 1000;
+					if (!fluxTicks) fluxTicks = 1;
+				}
+				if (fluxTicks > MAX_FLUX_ALLOWED) {
+					values[a] = MAX_FLUX_SIGNAL;
+					fluxTicks -= FLUX_REPEAT_OFFSET;
+				}
+				else {
+					values[a] = (fluxTicks < MIN_FLUX_ALLOWED) ? 0 : std::min((fluxTicks - MIN_FLUX_ALLOWED) / 2, 30U);
+					fluxTicks = 0;
+				}
+			}
+			chunk.push_back(values[0] | ((values[1] & 0x07) << 5));
+			chunk.push_back((pairIndex ? 0x80 : 0) | ((values[1] & 0x18) << 2) | values[2]);
+		}
+		else
+			if (m_hdMode) {
+				// Four sequences per byte.  3 marks the index, and stands for a '01'
+				unsigned char output = 0;
+				for (int a = 0; a < 4; a++) {
+					unsigned int sequence = sequences.next(timeNS, index);
+					indexPending |= index;
+					if ((sequence == 1) && (indexPending)) {
+						sequence = 4;
+						indexPending = false;
+					}
+					output = (output << 2) | (sequence - 1);
+				}
+				chunk.push_back(output);
+			}
+			else
+				if (command == COMMAND_READTRACKSTREAM) {
+					// Two sequences per byte, with a 3-bit speed
+					unsigned int sequence[2];
+					int32_t speed = 1000;
+					bool byteIndex = false;
+					for (int a = 1; a >= 0; a--) {
+						sequence[a] = sequences.next(timeNS, index);
+						byteIndex |= index;
+						if (sequence[a]) speed = sequenceSpeed(sequence[a], timeNS);
+					}
+					const int32_t speedValue = std::max(0, std::min(7, (speed + 125) / 250));
+					chunk.push_back((byteIndex ? 0x80 : 0) | (sequence[1] << 5) | (sequence[0] << 3) | speedValue);
+				}
+				else {
+					// Four sequences, then the index and a 7-bit speed
+					unsigned char output = 0;
+					int32_t speedTotal = 0, speedCount = 0;
+					bool byteIndex = false;
+					for (int a = 0; a < 4; a++) {
+						const unsigned int sequence = sequences.next(timeNS, index);
+						byteIndex |= index;
+						output = (output << 2) | sequence;
+						if (sequence) {
+							speedTotal += sequenceSpeed(sequence, timeNS);
+							speedCount++;
+						}
+					}
+					const int32_t speed = speedCount ? speedTotal / speedCount : 1000;
+					chunk.push_back(output);
+					chunk.push_back((byteIndex ? 0x80 : 0) | std::max(0, std::min(127, ((speed * 128) + 1000) / 2000)));
+				}
+
+		if (chunk.size() >= STREAM_CHUNK_SIZE) {
+			const uint64_t readyTime = startTime + ((command == COMMAND_READTRACKSTREAM_FLUX) ? flux.elapsed() : sequences.elapsed());
+			send(chunk.data(), (unsigned int)chunk.size(), readyTime);
+			chunk.clear();
+			if (abortReceived(readyTime - STREAM_LOOKAHEAD_NS)) break;
+		}
+	}
+
+	// Anything that was read ahead and not sent yet never existed
+	dropUnsentOutput(timeNow());
+	send("XYZx1", 5);
+}
+
+// The original read command.  Sends a fixed amount of packed MFM, from the index pulse if asked, then a zero
+void VirtualDrawBridge::readTrack() {
+	if (m_hdMode) {
+		send('0');
+		return;
+	}
+	send('1');
+	unsigned char fromIndex;
+	if (!receive(fromIndex, RECEIVE_TIMEOUT_MS)) return;
+	if (!spinUp()) return;
+
+	uint64_t startTime = timeNow();
+	if (fromIndex) startTime = nextIndexTime(startTime);
+	SequenceReader sequences(track(m_cylinder, m_side), startTime % REVOLUTION_NS, BITCELL_NS_DD, false);
+
+	std::vector<unsigned char> chunk;
+	chunk.reserve(STREAM_CHUNK_SIZE);
+	unsigned int bits = 0;
+	while (bits < RAW_TRACKDATA_LENGTH_DD * 8) {
+		unsigned char output = 0;
+		for (int a = 0; a < 4; a++) {
+			uint32_t timeNS;
+			bool index;
+			const unsigned int sequence = sequences.next(timeNS, index);
+			output = (output << 2) | sequence;
+			bits += sequence + 1;
+		}
+		chunk.push_back(output);
+		if (chunk.size() >= STREAM_CHUNK_SIZE) {
+			send(chunk.data(), (unsigned int)chunk.size(), startTime + sequences.elapsed());
+			chunk.clear();
+		}
+	}
+	chunk.push_back(0);
+	send(chunk.data(), (unsigned int)chunk.size(), startTime + sequences.elapsed());
+}
+
+// Writes MFM to the track. DD data is either raw MFM or the packed precomp format, HD is packed and zero terminated
+void VirtualDrawBridge::writeTrack(const bool precomp) {
+	send('1');
+	send('Y');
+
+	unsigned char length[2] = { 0, 0 };
+	if ((!m_hdMode) && (!receive(length, 2))) return;
+	unsigned char fromIndex;
+	if (!receive(fromIndex, RECEIVE_TIMEOUT_MS)) return;
+	if (!spinUp()) return;
+
+	uint64_t startTime = timeNow();
+	if (fromIndex) startTime = nextIndexTime(startTime);
+	if (!waitUntil(startTime)) return;
+	send('!');
+
+	std::vector<uint32_t> transitions;
+	uint32_t position = 0;
+
+	if (m_hdMode) {
+		// Four sequences per byte, in the order bits 5-4, 3-2, 1-0 then 7-6
+		unsigned char value;
+		for (;;) {
+			if (!receive(value, RECEIVE_TIMEOUT_MS)) {
+				send('X');
+				return;
+			}
+			if (!value) break;
+			static const int shifts[4] = { 4, 2, 0, 6 };
+			for (int a = 0; a < 4; a++) {
+				const unsigned int sequence = (value >> shifts[a]) & 3;
+				if (!sequence) continue;
+				position += (sequence + 1) * BITCELL_NS_HD;
+				transitions.push_back(position);
+			}
+		}
+	}
+	else {
+		const unsigned int numBytes = (length[0] << 8) | length[1];
+		std::vector<unsigned char> data(numBytes);
+		if (!receive(data.data(), numBytes)) {
+			send('X');
+			return;
+		}
+		if (precomp) {
+			// Two sequences per byte, low nibble first.  The bottom two bits are the number of cells-2, the others shift the transition early or late
+			for (const unsigned char value : data)
+				for (int shift = 0; shift <= 4; shift += 4) {
+					const unsigned char nibble = value >> shift;
+					position += ((nibble & 3) + 2) * BITCELL_NS_DD;
+					transitions.push_back((nibble & 0x04) ? position - PRECOMP_NS : (nibble & 0x08) ? position + PRECOMP_NS : position);
+				}
+		}
+		else {
+			for (const unsigned char value : data)
+				for (int bit = 7; bit >= 0; bit--) {
+					position += BITCELL_NS_DD;
+					if (value & (1 << bit)) transitions.push_back(position);
+				}
+		}
+	}
+
+	commitWrite(startTime, transitions, position);
+	if (!waitUntil(startTime + position)) return;
+	send('1');
+}
+
+// Writes flux timings to the track, starting a number of ticks after the index pulse
+void VirtualDrawBridge::writeFlux() {
+	if (m_hdMode) {
+		send('0');
+		return;
+	}
+	send('1');
+	send('Y');
+
+	unsigned char header[5];
+	if (!receive(header, 5)) return;
+	const uint32_t offsetNS = (uint32_t)(((header[0] | (header[1] << 8) | (header[2] << 16)) * 625ULL) / 10);
+	const bool terminateAtIndex = (header[3] & 1) != 0;
+
+	// The first flux is sent on its own, then they come in blocks of 8 packed into 5 bytes
+	std::vector<uint32_t> transitions;
+	uint32_t position = 0;
+	bool finished = false;
+	auto addFlux = [&position, &transitions, &finished](const unsigned char code) {
+		if (finished) return;
+		switch (code) {
+		case FLUX_SPECIAL_CODE_END: finished = true; break;
+		case FLUX_SPECIAL_CODE_BLANK: position += FLUX_REPEAT_COUNTER * FLUX_MULTIPLIER_TIME_DB; break;
+		default:
+			position += (code + FLUX_MINIMUM_DB) * FLUX_MULTIPLIER_TIME_DB;
+			transitions.push_back(position);
+			break;
+		}
+	};
+	addFlux(header[4] & 0x1F);
+	while (!finished) {
+		unsigned char b[5];
+		if (!receive(b, 5)) {
+			send('X');
+			return;
+		}
+		addFlux(b[0] & 0x1F);
+		addFlux((b[1] & 0x0F) | ((b[0] & 0x20) ? 0x10 : 0));
+		addFlux((b[1] >> 4) | ((b[0] & 0x40) ? 0x10 : 0));
+		addFlux((b[2] & 0x0F) | ((b[0] & 0x80) ? 0x10 : 0));
+		addFlux((b[2] >> 4) | ((b[3] & 0x80) ? 0x10 : 0));
+		addFlux(b[3] & 0x1F);
+		addFlux((b[4] & 0x0F) | ((b[3] & 0x20) ? 0x10 : 0));
+		addFlux((b[4] >> 4) | ((b[3] & 0x40) ? 0x10 : 0));
+	}
+	if (!spinUp()) return;
+
+	const uint64_t startTime = nextIndexTime(timeNow()) + offsetNS;
+	bool reachedIndex = false;
+	if ((terminateAtIndex) && (offsetNS + position > REVOLUTION_NS)) {
+		position = (offsetNS < REVOLUTION_NS) ? REVOLUTION_NS - offsetNS : 0;
+		while ((!transitions.empty()) && (transitions.back() >= position)) transitions.pop_back();
+		reachedIndex = true;
+	}
+
+	commitWrite(startTime, transitions, position);
+	if (!waitUntil(startTime + position)) return;
+	send(reachedIndex ? 'I' : '1');
+}
+
+// Erases the track for a whole revolution, either with a '0's pattern or by removing all flux
+void VirtualDrawBridge::eraseTrack(const bool removeFlux) {
+	send('1');
+	if (!spinUp()) return;
+	send('Y');
+
+	std::vector<uint32_t> transitions;
+	if (!removeFlux) {
+		const uint32_t spacing = (m_hdMode ? BITCELL_NS_HD : BITCELL_NS_DD) * 2;
+		for (uint32_t position = spacing; position <= REVOLUTION_NS; position += spacing) transitions.push_back(position);
+	}
+	const uint64_t startTime = timeNow();
+	commitWrite(startTime, transitions, REVOLUTION_NS);
+	if (!waitUntil(startTime + REVOLUTION_NS)) return;
+	send('1');
+}
+
+// Replaces the part of the current track that was written.  transitions are relative to startTime and a write longer than a revolution overwrites its own start
+void VirtualDrawBridge::commitWrite(const uint64_t startTime, const std::vector<uint32_t>& transitions, const uint32_t duration) {
+	track(m_cylinder, m_side);
+	if (m_cylinder >= MAX_CYLINDERS) return;
+	FluxTrack& trk = m_tracks[(m_cylinder * 2) + m_side];
+	const uint32_t startPosition = startTime % REVOLUTION_NS;
+
+	FluxTrack output;
+	output.reserve(trk.size() + transitions.size());
+	if (duration < REVOLUTION_NS) {
+		for (const uint32_t time : trk)
+			if (((time + REVOLUTION_NS - startPosition) % REVOLUTION_NS) >= duration) output.push_back(time);
+	}
+	for (const uint32_t time : transitions)
+		if ((duration < REVOLUTION_NS) || (time > duration - REVOLUTION_NS)) output.push_back((uint32_t)((startPosition + (uint64_t)time) % REVOLUTION_NS));
+
+	std::sort(output.begin(), output.end());
+	trk.swap(output);
+}
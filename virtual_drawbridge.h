@@ -0,0 +1,141 @@
+/* ArduinoFloppyReader (and writer)
+*
+* Copyright (C) 2017-2022 Robert Smith (@RobSmithDev)
+* https://amiga.robsmithdev.co.uk
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 3 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, see http://www.gnu.org/licenses/
+*/
+
+//////////////////////////////////////////////////////////////////////////////////////////
+// In-process DrawBridge emulator                                                       //
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// Purpose:
+// Pretends to be a DrawBridge board with a drive attached and a disk inserted, so the read
+// and write code can be run (and timed) without any hardware.  SerialIO hands everything
+// written to the "port" to the emulator, which runs the firmware's command set on its own
+// thread and queues the replies.  The disk is loaded from an ADF or SCP file.
+//
+// Timing:
+// The disk spins at 300 RPM from the moment the image is loaded, so streams start wherever
+// the head happens to be, seeks take a step and settle time per track, the motor has a
+// spin-up delay and writes take as long as they would on a real disk.  Replies are released
+// to the host no faster than the 2M baud link could carry them.
+//
+// Writes only change the copy of the disk held in memory, the image file is never modified.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class VirtualDrawBridge {
+public:
+	// A disk track.  Each entry is the time of a flux transition in nanoseconds after the index pulse, in ascending order
+	typedef std::vector<uint32_t> FluxTrack;
+
+private:
+	// Data waiting to be collected by the host, and the time it "arrives"
+	struct OutputChunk {
+		uint64_t readyTime;
+		std::vector<unsigned char> data;
+		size_t readPosition;
+	};
+
+	// The disk
+	std::vector<unsigned char> m_adfData;      // The ADF file, tracks are encoded from this the first time they're used
+	std::vector<FluxTrack> m_tracks;           // Indexed as (cylinder*2)+side
+	std::vector<bool> m_trackLoaded;
+	bool m_diskIsHD = false;
+
+	// Drive state.  Only touched by the device thread
+	int m_cylinder = 0;
+	int m_side = 0;                            // 1=upper
+	bool m_hdMode = false;
+	bool m_motorOn = false;
+	uint64_t m_motorReadyTime = 0;
+	unsigned char m_eeprom[256];
+
+	// Host to device
+	std::deque<unsigned char> m_input;
+	// Device to host
+	std::deque<OutputChunk> m_output;
+	uint64_t m_linkFreeTime = 0;               // When the serial link will have finished sending what's queued
+
+	std::mutex m_lock;
+	std::condition_variable m_inputReady;
+	std::condition_variable m_outputReady;
+	bool m_shutdown = false;
+	bool m_ctsHigh = false;
+	std::thread m_deviceThread;
+
+	// Loading
+	bool loadADF(const std::string& filename);
+	bool loadSCP(const std::string& filename);
+	const FluxTrack& track(const int cylinder, const int side);
+
+	// Device side of the link
+	bool receive(unsigned char& value, const int timeoutMS = -1);
+	bool receive(unsigned char* data, const unsigned int length);
+	bool abortReceived(const uint64_t waitUntilTime);
+	void send(const void* data, const unsigned int length, const uint64_t readyTime = 0);
+	void send(const char value) { send(&value, 1); }
+	bool waitUntil(const uint64_t time);
+	void dropUnsentOutput(const uint64_t time);
+
+	// Firmware
+	void deviceMain();
+	void runCommand(const unsigned char command);
+	void seekTo(const int cylinder, const int searchSpeed);
+	bool spinUp();
+	uint64_t nextIndexTime(const uint64_t time) const;
+	unsigned char featureFlags() const;
+	void streamTrack(const unsigned char command);
+	void readTrack();
+	void writeTrack(const bool precomp);
+	void writeFlux();
+	void eraseTrack(const bool removeFlux);
+	void commitWrite(const uint64_t startTime, const std::vector<uint32_t>& transitions, const uint32_t duration);
+
+public:
+	VirtualDrawBridge();
+	~VirtualDrawBridge();
+
+	VirtualDrawBridge(const VirtualDrawBridge&) = delete;
+	VirtualDrawBridge& operator=(const VirtualDrawBridge&) = delete;
+
+	// Loads the disk image (ADF or SCP, based on the contents) and powers up the "board".  Returns FALSE if the file can't be used
+	bool open(const std::string& imageFilename);
+
+	// Host: queues data for the device.  Returns how much was written
+	unsigned int write(const void* data, const unsigned int dataLength);
+
+	// Host: reads data from the device.  Waits up to timeoutMS for all of it, or if anyAmount is TRUE, only until something arrives
+	unsigned int read(void* data, const unsigned int dataLength, const unsigned int timeoutMS, const bool anyAmount);
+
+	// Host: number of bytes that have arrived and not been read
+	unsigned int getBytesWaiting();
+
+	// Host: discard anything waiting in either direction
+	void purge(const bool rx, const bool tx);
+
+	// Host: state of the CTS line, which the diagnostics command can change
+	bool getCTSStatus();
+};